@@ -0,0 +1,60 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright 2021 Ricerca Security, Inc. All rights reserved. */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <unordered_map>
+#include <vector>
+
+// The size of the chunks the small allocations are carved out of. It is the
+// size of a transparent huge page on AArch64 and x86-64 with 4 KiB pages.
+constexpr std::size_t ARENA_CHUNK_SIZE = 2 * 1024 * 1024;
+// Larger allocations are mapped on their own, so that they are returned to
+// the system when freed, e.g. the trace data of a long session.
+constexpr std::size_t ARENA_LARGE_SIZE = 64 * 1024;
+
+// A memory resource that maps the memory of the caches in large chunks, so
+// that millions of cache entries do not fragment the heap. A small allocation
+// is never freed by itself, so a pool should be put on top of the arena to
+// reuse the freed blocks. release() unmaps the whole arena at once.
+//
+// With huge pages, the mappings of a huge page or more are aligned to huge
+// pages and advised to be backed by transparent huge pages, which cuts the TLB
+// misses of the caches that grow to hundreds of megabytes. It is only a hint,
+// and has no effect if transparent huge pages are disabled.
+struct Arena : std::pmr::memory_resource {
+  explicit Arena(bool use_huge_pages = false);
+  ~Arena();
+
+  // Disable copy constructor.
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  // Unmaps all memory. Nothing allocated from the arena may be used after it.
+  void release();
+  std::size_t mappedSize() const { return this->mapped_size; }
+
+private:
+  const bool use_huge_pages;
+
+  std::vector<std::pair<void *, std::size_t>> chunks;
+  std::unordered_map<void *, std::size_t> large_mappings;
+  std::size_t mapped_size;
+
+  // The free space at the end of the last chunk.
+  std::uint8_t *chunk_ptr;
+  std::size_t chunk_left;
+
+  bool usesHugePages(std::size_t size) const;
+  void *map(std::size_t size);
+  void unmap(void *addr, std::size_t size);
+
+  void *do_allocate(std::size_t bytes, std::size_t alignment) override;
+  void do_deallocate(void *p, std::size_t bytes,
+                     std::size_t alignment) override;
+  bool do_is_equal(const std::pmr::memory_resource &other) const
+      noexcept override;
+};
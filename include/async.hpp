@@ -0,0 +1,91 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright 2021 Ricerca Security, Inc. All rights reserved. */
+
+#pragma once
+
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <sys/uio.h>
+#include <thread>
+#include <vector>
+
+#include "bitmap.hpp"
+#include "common.hpp"
+#include "process.hpp"
+
+// The number of the sessions whose results are kept. The result of a session
+// is kept until the session ASYNC_SLOT_NUM tickets later is submitted, so that
+// the caller can evaluate a result while the next session is decoded.
+constexpr std::size_t ASYNC_SLOT_NUM = 2;
+
+// A decoding session submitted to AsyncDecoder. The segments point to the
+// trace data of the caller, which must be kept until the session is finished.
+struct AsyncSession {
+  std::uint64_t ticket;
+  std::uint8_t trace_id;
+  std::vector<MemoryMap> memory_maps;
+  std::vector<struct iovec> segments;
+};
+
+// Decodes the sessions of a process on a background thread, so that the
+// caller can run the target while the previous trace data is decoded. The
+// sessions are decoded in the submitted order. Since the bitmap of the process
+// is overwritten by the next session, the bitmap of each session is copied
+// into the result slot of the ticket.
+struct AsyncDecoder {
+  // Resets the process, runs it on the segments and finalizes it.
+  using SessionRunner = std::function<ProcessResultType(AsyncSession &)>;
+
+  AsyncDecoder(const Bitmap &bitmap, SessionRunner &&run_session);
+  ~AsyncDecoder();
+
+  // Disable copy constructor.
+  AsyncDecoder(const AsyncDecoder &) = delete;
+  AsyncDecoder &operator=(const AsyncDecoder &) = delete;
+
+  // Returns the ticket of the session, or std::nullopt if the result of the
+  // session ASYNC_SLOT_NUM tickets earlier has not been collected yet.
+  std::optional<std::uint64_t> submit(std::uint8_t trace_id,
+                                      std::vector<MemoryMap> &&memory_maps,
+                                      std::vector<struct iovec> &&segments);
+  // Returns whether the result of the ticket is kept.
+  bool hasTicket(std::uint64_t ticket);
+  // Returns the result of the session, or std::nullopt if the session is not
+  // finished yet.
+  std::optional<ProcessResultType> poll(std::uint64_t ticket);
+  // Blocks until the session is finished and returns the result.
+  ProcessResultType wait(std::uint64_t ticket);
+  // The bitmap of the finished session.
+  std::uint8_t *getBitmap(std::uint64_t ticket);
+
+private:
+  struct Slot {
+    std::uint64_t ticket = 0;
+    ProcessResultType result = ProcessResultType::PROCESS_SUCCESS;
+    // Set once the result is returned by poll or wait.
+    bool collected = true;
+    std::vector<std::uint8_t> bitmap;
+  };
+
+  const Bitmap bitmap;
+  const SessionRunner run_session;
+
+  std::mutex mutex;
+  std::condition_variable submitted;
+  std::condition_variable finished;
+  std::deque<AsyncSession> sessions;
+  std::array<Slot, ASYNC_SLOT_NUM> slots;
+  std::uint64_t submitted_ticket;
+  std::uint64_t finished_ticket;
+  bool stopping;
+
+  // Started last, since it uses the members above.
+  std::thread worker;
+
+  void work();
+};
@@ -3,20 +3,100 @@
 
 #pragma once
 
+#include <cstdint>
+#include <memory_resource>
+#include <vector>
+
 #include "common.hpp"
 
 #define BITMAP_SIZE 0x10000
 #define BITMAP_FILENAME "edge_coverage_bitmap.out"
 
+// Width of a single bitmap cell. AFL-style fuzzers use 8-bit counters, while
+// profiling use cases need wider counters that do not wrap around so quickly.
+enum class BitmapCellType {
+  U8,
+  U16,
+  U32,
+};
+
+// A non-zero bitmap cell, used to save and restore the bitmap sparsely.
+struct BitmapCell {
+  std::uint32_t index;
+  std::uint32_t count;
+};
+
 struct Bitmap {
   std::uint8_t *const data;
+  // The number of cells, not the number of bytes.
   const std::size_t size;
+  const BitmapCellType cell_type;
 
-  Bitmap(std::uint8_t *data, std::size_t size);
+  Bitmap(std::uint8_t *data, std::size_t size,
+         BitmapCellType cell_type = BitmapCellType::U8);
 
   void reset() const;
+  std::size_t byteSize() const;
+
+  void writeKey(std::uint64_t key) const;
+  void writeKeys(const std::pmr::vector<std::size_t> &keys) const;
+
+  // Appends the non-zero cells in the order of the index.
+  void readCells(std::vector<BitmapCell> &cells) const;
+  // Appends the differences of the cells from the previous data of the
+  // bitmap, which wrap around like the counters.
+  void readDelta(const std::vector<std::uint8_t> &prev_data,
+                 std::vector<BitmapCell> &cells) const;
+  // Adds the counts to the cells.
+  void addCells(const std::vector<BitmapCell> &cells) const;
 };
 
+std::size_t getBitmapCellSize(BitmapCellType cell_type);
+
 std::uint64_t generateBitmapKey(const Location &from_location,
                                 const Location &to_location,
                                 std::size_t bitmap_size);
+
+// The hot write loop is instantiated for each cell type, so that the
+// dispatch on the cell type happens once per call instead of once per key.
+template <typename T>
+inline void writeBitmapCells(std::uint8_t *data,
+                             const std::pmr::vector<std::size_t> &keys) {
+  T *const cells = reinterpret_cast<T *>(data);
+  for (const std::size_t key : keys) {
+    cells[key]++;
+  }
+}
+
+inline void Bitmap::writeKey(const std::uint64_t key) const {
+  switch (this->cell_type) {
+  case BitmapCellType::U8:
+    this->data[key]++;
+    break;
+  case BitmapCellType::U16:
+    reinterpret_cast<std::uint16_t *>(this->data)[key]++;
+    break;
+  case BitmapCellType::U32:
+    reinterpret_cast<std::uint32_t *>(this->data)[key]++;
+    break;
+  default:
+    __builtin_unreachable();
+  }
+}
+
+inline void
+Bitmap::writeKeys(const std::pmr::vector<std::size_t> &keys) const {
+  switch (this->cell_type) {
+  case BitmapCellType::U8:
+    writeBitmapCells<std::uint8_t>(this->data, keys);
+    break;
+  case BitmapCellType::U16:
+    writeBitmapCells<std::uint16_t>(this->data, keys);
+    break;
+  case BitmapCellType::U32:
+    writeBitmapCells<std::uint32_t>(this->data, keys);
+    break;
+  default:
+    __builtin_unreachable();
+  }
+}
@@ -4,9 +4,16 @@
 #pragma once
 
 #include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <optional>
 #include <tuple>
 #include <unordered_map>
+#include <vector>
 
+#include "arena.hpp"
 #include "common.hpp"
 #include "disassembler.hpp"
 #include "trace.hpp"
@@ -29,15 +36,111 @@ template <> struct hash<TraceKey> {
 };
 } // namespace std
 
+// The branch instruction that ends the block starting at a location, together
+// with the bitmap keys of both outgoing edges of the block and the indices of
+// both successor blocks in the cache.
+struct BranchInsnCacheEntry {
+  static constexpr std::size_t NO_INDEX =
+      std::numeric_limits<std::size_t>::max();
+
+  BranchInsn insn;
+
+  std::size_t taken_bitmap_key;
+  std::size_t not_taken_bitmap_key;
+
+  // NO_INDEX until the successor block is decoded for the first time.
+  std::size_t taken_index;
+  std::size_t not_taken_index;
+
+  BranchInsnCacheEntry(const BranchInsn &insn, std::size_t taken_bitmap_key,
+                       std::size_t not_taken_bitmap_key);
+};
+
+// The instructions disassembled from a start offset up to the branch
+// instruction that ends the block. Any offset in the range reaches the same
+// branch instruction.
+struct BlockInterval {
+  addr_t start_offset;
+  BranchInsn insn;
+};
+
+// The number of the entries of the indirect target cache in bits.
+constexpr std::size_t INDIRECT_TARGET_CACHE_BITS = 12;
+
+// The destination of an indirect branch from a location to a target address,
+// together with the bitmap key of the edge.
+struct IndirectTargetCacheEntry {
+  Location src_location;
+  addr_t target_address;
+
+  Location dest_location;
+  std::size_t bitmap_key;
+
+  // The entry is valid only in the generation it was added in.
+  std::uint64_t generation;
+
+  bool matches(const Location &src_location, const addr_t target_address,
+               const std::uint64_t generation) const {
+    return this->generation == generation and
+           this->target_address == target_address and
+           this->src_location == src_location;
+  }
+};
+
 struct Cache {
-  std::unordered_map<Location, BranchInsn> branch_insn_cache;
-  std::unordered_map<TraceKey, AtomTrace> trace_cache;
+  // The built-in arena and the pool that reuses the blocks freed on it, unless
+  // the cache is given a memory resource. They are held by pointers, so that
+  // the containers keep them when the cache is moved.
+  std::unique_ptr<Arena> arena;
+  std::unique_ptr<std::pmr::unsynchronized_pool_resource> pool;
+  // The resource of the containers below, the cached traces and the trace
+  // data of the decoder.
+  std::pmr::memory_resource *resource;
+
+  std::pmr::vector<BranchInsnCacheEntry> branch_insns;
+  std::pmr::unordered_map<Location, std::size_t> branch_insn_cache;
+  std::pmr::unordered_map<TraceKey, AtomTrace> trace_cache;
+  // The block intervals of each memory image keyed by the offset of the
+  // branch instruction. The intervals never overlap, since an interval ends at
+  // the first branch instruction.
+  std::pmr::unordered_map<image_id_t, std::pmr::map<addr_t, BlockInterval>>
+      block_intervals;
+
+  // Direct-mapped, so that a lookup is a single probe. A conflicting entry is
+  // overwritten. The destinations depend on the memory maps, so the entries
+  // are invalidated by moving on to the next generation when they change.
+  std::pmr::vector<IndirectTargetCacheEntry> indirect_targets;
+  std::uint64_t indirect_target_generation;
+
+  // On the built-in arena, backed by transparent huge pages if use_huge_pages
+  // is set.
+  explicit Cache(bool use_huge_pages = false);
+  // On the memory resource, which must outlive the cache.
+  explicit Cache(std::pmr::memory_resource *resource);
+
+  // Drops all entries. The built-in arena is unmapped at once. Nothing else
+  // may be left on the resource, e.g. the trace data of the decoder.
+  void clear();
+
+  std::optional<std::size_t> findBranchInsnCache(const Location &key) const;
+  std::size_t addBranchInsnCache(const Location &key,
+                                 const BranchInsnCacheEntry &entry);
+
+  // Returns the branch instruction of the block interval that contains the
+  // location, if any.
+  std::optional<BranchInsn> findBlockInterval(const Location &location) const;
+  void addBlockInterval(const Location &location, const BranchInsn &insn);
 
-  BranchInsn getBranchInsnCache(const Location &key) const;
-  void addBranchInsnCache(const Location &key, const BranchInsn &branch_insn);
-  bool isCachedBranchInsn(const Location &key) const;
+  // The returned pointer stays valid while entries are added.
+  const AtomTrace *findTraceCache(const TraceKey &key) const;
+  void addTraceCache(const TraceKey &key, AtomTrace &&trace);
 
-  AtomTrace getTraceCache(const TraceKey &key) const;
-  void addTraceCache(const TraceKey &key, const AtomTrace &trace);
-  bool isCachedTrace(const TraceKey &key) const;
+  IndirectTargetCacheEntry &getIndirectTargetCache(const Location &src_location,
+                                                   addr_t target_address) {
+    const std::uint64_t h = (target_address ^ (src_location.offset << 1) ^
+                             src_location.id) *
+                            0x9e3779b97f4a7c15;
+    return this->indirect_targets[h >> (64 - INDIRECT_TARGET_CACHE_BITS)];
+  }
+  void invalidateIndirectTargetCache();
 };
@@ -33,8 +33,11 @@ struct MemoryMap {
   const addr_t start_address;
   const addr_t end_address;
   const image_id_t id;
+  // The path to the executable. It is only informational.
+  const std::string path;
 
-  MemoryMap(addr_t start_address, addr_t end_address, image_id_t id);
+  MemoryMap(addr_t start_address, addr_t end_address, image_id_t id,
+            const std::string &path = std::string());
 };
 
 struct Location {
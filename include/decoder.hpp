@@ -3,6 +3,12 @@
 
 #pragma once
 
+#include <array>
+#include <cstdint>
+#include <memory_resource>
+#include <optional>
+#include <vector>
+
 enum class PacketType {
   // Extension header
   ETM4_PKT_I_EXTENSION,
@@ -51,24 +57,139 @@ struct Packet {
   std::string toString() const;
 };
 
+// The atoms of an atom packet, which are determined by the header byte alone.
+// en_bits_len is 0 if the header is not an atom packet.
+struct AtomFormat {
+  PacketType type;
+  std::uint32_t en_bits;
+  std::size_t en_bits_len;
+};
+
+constexpr AtomFormat decodeAtomFormat(const std::uint8_t header) {
+  // Atom 1 packet header: 0b1111011x
+  if ((header & 0b11111110) == 0b11110110) {
+    return {PacketType::ETM4_PKT_I_ATOM_F1, header & 0b1u, 1}; // 1x (E or N)
+  }
+
+  // Atom 2 packet header: 0b110110xx
+  if ((header & 0b11111100) == 0b11011000) {
+    return {PacketType::ETM4_PKT_I_ATOM_F2, header & 0b11u, 2}; // 2x (E or N)
+  }
+
+  // Atom 3 packet header: 0b11111xxx
+  if ((header & 0b11111000) == 0b11111000) {
+    return {PacketType::ETM4_PKT_I_ATOM_F3, header & 0b111u, 3}; // 3x (E or N)
+  }
+
+  // Atom 4 packet header: 0b110111xx
+  if ((header & 0b11111100) == 0b11011100) {
+    constexpr std::uint32_t f4_patterns[] = {
+        0b1110, // EEEN
+        0b0000, // NNNN
+        0b1010, // ENEN
+        0b0101  // NENE
+    };
+    return {PacketType::ETM4_PKT_I_ATOM_F4, f4_patterns[header & 0b11], 4};
+  }
+
+  // Atom 5 packet header: 0b11010101 - 0b11010111, 0b11110101
+  if ((0b11010101 <= header and header <= 0b11010111) or
+      header == 0b11110101) {
+    switch (((header & 0b00100000) >> 3) | (header & 0b11)) {
+    case 0b101:
+      return {PacketType::ETM4_PKT_I_ATOM_F5, 0b11110, 5}; // EEEEN
+    case 0b001:
+      return {PacketType::ETM4_PKT_I_ATOM_F5, 0b00000, 5}; // NNNNN
+    case 0b010:
+      return {PacketType::ETM4_PKT_I_ATOM_F5, 0b01010, 5}; // NENEN
+    case 0b011:
+      return {PacketType::ETM4_PKT_I_ATOM_F5, 0b10101, 5}; // ENENE
+    default:
+      return {PacketType::PKT_UNKNOWN, 0, 0};
+    }
+  }
+
+  // Atom 6 packet header: 0b11000000 - 0b11010100, 0b11100000 - 0b11110100
+  if ((0b11000000 <= header and header <= 0b11010100) or
+      (0b11100000 <= header and header <= 0b11110100)) {
+    const std::size_t e_cnt = (header & 0b11111) + 3; // count of E's
+    // Set pattern to string of E's, and check if the last branch is E.
+    const std::uint32_t en_bits =
+        (((std::uint32_t)0x1 << e_cnt) - 1) |
+        ((header & 0b100000) ? 0 : ((std::uint32_t)0x1 << e_cnt));
+    return {PacketType::ETM4_PKT_I_ATOM_F6, en_bits, e_cnt + 1};
+  }
+
+  return {PacketType::PKT_UNKNOWN, 0, 0};
+}
+
+// The atom formats indexed by the header byte, so that atom packets can be
+// decoded with a single lookup.
+constexpr std::array<AtomFormat, 256> makeAtomFormats() {
+  std::array<AtomFormat, 256> atom_formats{};
+  for (std::size_t header = 0; header < 256; ++header) {
+    atom_formats[header] = decodeAtomFormat(header);
+  }
+  return atom_formats;
+}
+
+inline constexpr std::array<AtomFormat, 256> ATOM_FORMATS = makeAtomFormats();
+
 enum class DecodeState {
   START,
   RESTART,
   TRACE,
+  // Outside the memory maps or the target context. The atoms are skipped
+  // without disassembling until an address packet on the memory maps in the
+  // target context brings the trace back.
+  UNMAPPED,
   EXCEPTION_ADDR1,
   EXCEPTION_ADDR2,
   WAIT_ADDR_AFTER_TRACE_ON
 };
 
+// The size of an A-sync packet, eleven 0x00 bytes followed by 0x80.
+constexpr std::size_t ASYNC_PACKET_SIZE = 12;
+
 struct Decoder {
-  std::vector<std::uint8_t> trace_data;
+  std::pmr::vector<std::uint8_t> trace_data;
   std::size_t trace_data_offset;
   DecodeState state;
 
+  // The packet boundaries are known only after an A-sync packet. They are lost
+  // at the start of the trace and at an unknown packet, e.g. in a corrupted or
+  // overwritten trace buffer.
+  bool is_synced;
+
   std::uint64_t address_reg;
 
+  // The context of the trace, updated by the context packets. The context ID
+  // is unknown until the first context packet with a Context ID section.
+  std::optional<std::uint32_t> context_id;
+  std::uint32_t vmid;
+
+  // Only the trace of this context ID, e.g. the PID of the target, is decoded
+  // if it is set. It is kept over the sessions.
+  std::optional<std::uint32_t> target_context_id;
+
+  // The trace data is allocated on the memory resource.
+  explicit Decoder(std::pmr::memory_resource *resource =
+                       std::pmr::get_default_resource())
+      : trace_data(resource) {}
+
   Packet decodePacket();
   void reset();
+  // Moves to the next A-sync packet. Returns false if it is not found in the
+  // trace data, in which case the trace data is skipped except the bytes that
+  // may start an A-sync packet.
+  bool sync();
+
+  // Returns false if the trace is filtered out by the context ID. The context
+  // is not known to be the target until a context packet says so.
+  bool isTargetContext() const {
+    return not this->target_context_id.has_value() or
+           this->context_id == this->target_context_id;
+  }
 
 private:
   Packet decodeExtensionPacket();
@@ -84,10 +205,7 @@ private:
   Packet decodeAddressLong64IS0Packet();
   Packet decodeAddressLong64IS0WithContextPacket();
 
-  Packet decodeAtomF1Packet();
-  Packet decodeAtomF2Packet();
-  Packet decodeAtomF3Packet();
-  Packet decodeAtomF4Packet();
-  Packet decodeAtomF5Packet();
-  Packet decodeAtomF6Packet();
+  Packet decodeAtomPacket();
+
+  void decodeContextSections(std::size_t info_offset);
 };
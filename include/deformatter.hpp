@@ -3,13 +3,30 @@
 
 #pragma once
 
+#include <array>
+#include <cstdint>
+#include <memory_resource>
+#include <vector>
+
+// The size of a frame of the formatted trace data.
+constexpr std::size_t FRAME_SIZE = 16;
+
 struct Deformatter {
   std::uint8_t trace_id;
   std::uint8_t target_trace_id;
 
+  // The trace data need not end at a frame boundary. The rest of the frame is
+  // kept here until the next trace data completes it.
+  std::array<std::uint8_t, FRAME_SIZE> partial_frame;
+  std::size_t partial_frame_size;
+
   Deformatter() = default;
 
   void deformatTraceData(const std::uint8_t *data, const std::size_t data_size,
-                         std::vector<std::uint8_t> &deformat_data);
+                         std::pmr::vector<std::uint8_t> &deformat_data);
   void reset(std::uint8_t target_trace_id);
+
+private:
+  void deformatFrame(const std::uint8_t *frame,
+                     std::pmr::vector<std::uint8_t> &deformat_data);
 };
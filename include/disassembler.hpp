@@ -8,6 +8,9 @@
 
 #include "common.hpp"
 
+// All A64 instructions are 4 bytes long.
+constexpr std::size_t A64_INSN_SIZE = 4;
+
 enum class BranchType {
   DIRECT_BRANCH,
   INDIRECT_BRANCH,
@@ -30,4 +33,6 @@ void disassembleInit(csh *handle);
 void disassembleDelete(csh *handle);
 BranchInsn getNextBranchInsn(const csh &handle, const Location &location,
                              const std::vector<MemoryImage> &memory_images);
+std::vector<BranchInsn> getBranchInsns(const csh &handle,
+                                       const MemoryImage &memory_image);
 void checkCapstoneVersion();
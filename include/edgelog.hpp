@@ -0,0 +1,119 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright 2021 Ricerca Security, Inc. All rights reserved. */
+
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "common.hpp"
+#include "edgemap.hpp"
+
+// The edge log is a compact binary form of the edge list. It starts with the
+// magic and the version, which are followed by records:
+//
+//   IMAGES: type, image_num, {start_address, end_address, path_len, path}...
+//   EDGES:  type, edge_num, byte_size, edges...
+//
+// All integers except the type are varints. The IMAGES record begins a new
+// decoding session. Each edge is encoded relative to the destination of the
+// previous edge in the session:
+//
+//   head:      zigzag(src.offset - prev.offset) << 2
+//              | (src.id != prev.id) << 1 | (dest.id != src.id)
+//   src.id:    only if it differs from prev.id
+//   dest:      zigzag(dest.offset - src.offset)
+//   dest.id:   only if it differs from src.id
+//
+// Since the source of an edge is usually close to the destination of the
+// previous edge, and direct branches are short, most edges take 2-4 bytes.
+constexpr char EDGE_LOG_MAGIC[8] = {'C', 'S', 'E', 'D', 'G', 'L', 'O', 'G'};
+constexpr std::uint64_t EDGE_LOG_VERSION = 1;
+
+// A varint of a 64-bit value takes 10 bytes at most, and an edge takes 4
+// varints at most.
+constexpr std::size_t MAX_VARINT_SIZE = 10;
+constexpr std::size_t MAX_EDGE_SIZE = 4 * MAX_VARINT_SIZE;
+
+enum class EdgeLogRecordType : std::uint8_t {
+  IMAGES = 1,
+  EDGES = 2,
+};
+
+inline void appendVarint(binary_data_t &buffer, std::uint64_t value) {
+  while (value >= 0x80) {
+    buffer.push_back(static_cast<std::uint8_t>(value | 0x80));
+    value >>= 7;
+  }
+  buffer.push_back(static_cast<std::uint8_t>(value));
+}
+
+inline std::uint64_t encodeZigzag(const std::uint64_t from,
+                                  const std::uint64_t to) {
+  const std::int64_t delta = static_cast<std::int64_t>(to - from);
+  return (static_cast<std::uint64_t>(delta) << 1) ^
+         static_cast<std::uint64_t>(delta >> 63);
+}
+
+inline std::uint64_t decodeZigzag(const std::uint64_t from,
+                                  const std::uint64_t value) {
+  return from + ((value >> 1) ^ (~(value & 1) + 1));
+}
+
+// Appends the edge and updates prev_location to the destination.
+inline void appendEdge(binary_data_t &buffer, Location &prev_location,
+                       const Location &src_location,
+                       const Location &dest_location) {
+  const bool src_id_changed = src_location.id != prev_location.id;
+  const bool dest_id_changed = dest_location.id != src_location.id;
+
+  appendVarint(buffer,
+               (encodeZigzag(prev_location.offset, src_location.offset) << 2) |
+                   (src_id_changed << 1) | dest_id_changed);
+  if (src_id_changed) {
+    appendVarint(buffer, src_location.id);
+  }
+  appendVarint(buffer, encodeZigzag(src_location.offset, dest_location.offset));
+  if (dest_id_changed) {
+    appendVarint(buffer, dest_location.id);
+  }
+
+  prev_location = dest_location;
+}
+
+void appendEdgeLogHeader(binary_data_t &buffer);
+void appendEdgeLogImages(binary_data_t &buffer,
+                         const std::vector<MemoryMap> &memory_maps);
+
+// Reads the edges from an edge log.
+struct EdgeLogReader {
+  std::istream &stream;
+
+  // The memory maps of the current session. The paths are the ones passed to
+  // the decoder.
+  std::vector<MemoryMap> memory_maps;
+  // The number of the sessions read so far.
+  std::size_t session_num;
+  // Set if the log is broken. A truncated log is not regarded as broken, so
+  // that the log of a decoder still running can be read.
+  bool failed;
+
+  EdgeLogReader(std::istream &stream);
+
+  // Returns the next edge, or std::nullopt at the end of the log.
+  std::optional<Edge> readEdge();
+
+private:
+  binary_data_t block;
+  std::size_t block_offset;
+  std::uint64_t remaining_edge_num;
+  Location prev_location;
+
+  bool readRecord();
+  bool readImages();
+  std::optional<std::uint64_t> readStreamVarint();
+  std::optional<std::uint64_t> readBlockVarint();
+};
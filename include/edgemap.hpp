@@ -0,0 +1,55 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright 2021 Ricerca Security, Inc. All rights reserved. */
+
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "common.hpp"
+#include "disassembler.hpp"
+
+struct Edge {
+  Location from_location;
+  Location to_location;
+
+  Edge(const Location &from_location, const Location &to_location);
+
+  bool operator==(const Edge &right) const;
+};
+
+namespace std {
+template <> struct hash<Edge> {
+  std::size_t operator()(const Edge &key) const;
+};
+} // namespace std
+
+// Assigns a dense and unique bitmap key to each edge, in the spirit of the
+// AFL++ LTO mode. The edges of all direct branches in the memory images are
+// enumerated ahead of time, and the other edges (indirect branches) get a new
+// key on first sight. As long as the bitmap is large enough, no two edges
+// share a bitmap key.
+struct EdgeMap {
+  // The key of the taken edge of the direct branch instruction at each
+  // instruction offset of each memory image. The key of the not-taken edge is
+  // the next one.
+  std::vector<std::vector<std::uint32_t>> direct_edge_keys;
+  std::unordered_map<Edge, std::size_t> dynamic_edge_keys;
+
+  // The number of the edges enumerated ahead of time.
+  std::size_t static_edge_num;
+  // The number of the edges that have been assigned a key so far.
+  std::size_t edge_num;
+
+  EdgeMap(const std::vector<MemoryImage> &memory_images);
+
+  std::size_t getDirectEdgeKey(const BranchInsn &insn, bool is_taken,
+                               std::size_t bitmap_size);
+  std::size_t getDynamicEdgeKey(const Location &from_location,
+                                const Location &to_location,
+                                std::size_t bitmap_size);
+
+private:
+  std::size_t assignEdgeKey(std::size_t bitmap_size);
+};
@@ -12,12 +12,31 @@ extern "C" {
 
 #include <limits.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
 
 /**
     Represents the libcsdec decoder context.
 **/
 typedef void *libcsdec_t;
 
+/**
+    Represents the background decoder of a libcsdec decoder context.
+**/
+typedef void *libcsdec_async_t;
+
+/**
+    Identifies a decoding session submitted to the background decoder.
+**/
+typedef uint64_t libcsdec_ticket_t;
+
+/**
+    Disables the filter of libcsdec_filter_context_edge and
+    libcsdec_filter_context_path.
+**/
+#define LIBCSDEC_CONTEXT_ID_ANY UINT64_MAX
+
 /**
     Represents an executable memory image.
 **/
@@ -35,6 +54,156 @@ struct libcsdec_memory_map {
   char path[PATH_MAX]; /**< Path to the executable. */
 };
 
+/**
+    Defines the width of a single bitmap cell.
+**/
+typedef enum libcsdec_bitmap_cell {
+  LIBCSDEC_BITMAP_CELL_8BIT,  /**< 8-bit counters (AFL compatible). */
+  LIBCSDEC_BITMAP_CELL_16BIT, /**< 16-bit counters. */
+  LIBCSDEC_BITMAP_CELL_32BIT  /**< 32-bit counters. */
+} libcsdec_bitmap_cell_t;
+
+/**
+    Defines how the edges are mapped to the bitmap cells.
+**/
+typedef enum libcsdec_bitmap_key {
+  LIBCSDEC_BITMAP_KEY_HASH, /**< Hash of the edge. */
+  LIBCSDEC_BITMAP_KEY_ID    /**< Collision-free unique key of the edge. */
+} libcsdec_bitmap_key_t;
+
+/**
+    Defines what the decoder caches during decoding.
+**/
+typedef enum libcsdec_cache_mode {
+  LIBCSDEC_CACHE_NONE,   /**< Disassemble the instructions for every atom. */
+  LIBCSDEC_CACHE_BRANCH, /**< Cache the disassembled branch instructions. */
+  LIBCSDEC_CACHE_TRACE   /**< In addition, cache the traces of atoms. */
+} libcsdec_cache_mode_t;
+
+/**
+    Defines the outputs of the edge coverage mode. They can be combined.
+**/
+typedef enum libcsdec_sink {
+  LIBCSDEC_SINK_BITMAP = 1 << 0,        /**< Write the bitmap. */
+  LIBCSDEC_SINK_EDGE_LIST = 1 << 1,     /**< Print the edges to stdout. */
+  LIBCSDEC_SINK_EDGE_CALLBACK = 1 << 2, /**< Pass the edges to the callback. */
+  LIBCSDEC_SINK_EDGE_LOG = 1 << 3,      /**< Write the edges to the edge log. */
+  LIBCSDEC_SINK_PATH_BITMAP = 1 << 4,   /**< Write the path coverage bitmap
+                                             from the same decoding pass. */
+  LIBCSDEC_SINK_EDGE_PROFILE = 1 << 5   /**< Count the edges for
+                                             libcsdec_write_profile_edge. */
+} libcsdec_sink_t;
+
+/**
+    Represents an edge. The location is the offset on the memory image.
+**/
+struct libcsdec_edge {
+  uint64_t src_offset;  /**< Offset of the branch source. */
+  size_t src_image;     /**< Memory image of the branch source. */
+  uint64_t dest_offset; /**< Offset of the branch destination. */
+  size_t dest_image;    /**< Memory image of the branch destination. */
+};
+
+/**
+    Receives the edges in batches. The array is valid only during the call.
+**/
+typedef void (*libcsdec_edge_callback_t)(void *user_data,
+                                         const struct libcsdec_edge *edges,
+                                         size_t edge_num);
+
+/**
+    Represents the options of the decoder. Initialize it with
+    libcsdec_default_options before changing the fields.
+**/
+struct libcsdec_options {
+  libcsdec_bitmap_cell_t cell_type; /**< Width of a bitmap cell. */
+  libcsdec_bitmap_key_t bitmap_key; /**< Bitmap key of the edge coverage. */
+  libcsdec_cache_mode_t cache_mode; /**< Cache of the edge coverage. */
+  size_t max_atom_len; /**< Maximum number of atoms hashed between two
+                            address packets in the path coverage. */
+  unsigned int sinks;  /**< Outputs of the edge coverage, combined from
+                            libcsdec_sink_t. */
+  libcsdec_edge_callback_t edge_callback; /**< Callback of
+                                               LIBCSDEC_SINK_EDGE_CALLBACK. */
+  void *edge_callback_data;      /**< First argument of the callback. */
+  const char *edge_log_filename; /**< File of LIBCSDEC_SINK_EDGE_LOG. */
+  void *path_bitmap_addr;        /**< Bitmap of LIBCSDEC_SINK_PATH_BITMAP. It
+                                      has the cell width of cell_type. */
+  size_t path_bitmap_size;       /**< Number of the path bitmap cells, a
+                                      power of 2. */
+  size_t trace_memo_size;        /**< Memory limit of the trace memo in
+                                      bytes, or 0 to disable it. It needs
+                                      LIBCSDEC_SINK_BITMAP as the only
+                                      output. */
+  int huge_pages;                /**< Non-zero to back the caches with
+                                      transparent huge pages. */
+};
+
+/**
+    Defines the packet types counted by the statistics.
+**/
+typedef enum libcsdec_packet_type {
+  LIBCSDEC_PACKET_EXTENSION,         /**< Extension packet. */
+  LIBCSDEC_PACKET_TRACE_INFO,        /**< Trace Info packet. */
+  LIBCSDEC_PACKET_TIMESTAMP,         /**< Timestamp packet. */
+  LIBCSDEC_PACKET_TRACE_ON,          /**< Trace On packet. */
+  LIBCSDEC_PACKET_EXCEPT,            /**< Exception packet. */
+  LIBCSDEC_PACKET_CTXT,              /**< Context packet. */
+  LIBCSDEC_PACKET_ADDR_S_IS0,        /**< Short Address packet. */
+  LIBCSDEC_PACKET_ADDR_L_64IS0,      /**< Long Address packet. */
+  LIBCSDEC_PACKET_ADDR_CTXT_L_64IS0, /**< Long Address with Context packet. */
+  LIBCSDEC_PACKET_ATOM_F1,           /**< Atom format 1 packet. */
+  LIBCSDEC_PACKET_ATOM_F2,           /**< Atom format 2 packet. */
+  LIBCSDEC_PACKET_ATOM_F3,           /**< Atom format 3 packet. */
+  LIBCSDEC_PACKET_ATOM_F4,           /**< Atom format 4 packet. */
+  LIBCSDEC_PACKET_ATOM_F5,           /**< Atom format 5 packet. */
+  LIBCSDEC_PACKET_ATOM_F6,           /**< Atom format 6 packet. */
+  LIBCSDEC_PACKET_ASYNC,             /**< Async packet. */
+  LIBCSDEC_PACKET_OVERFLOW,          /**< Overflow packet. */
+  LIBCSDEC_PACKET_UNKNOWN,           /**< Unknown packet. */
+  LIBCSDEC_PACKET_TYPE_NUM           /**< The number of the packet types. */
+} libcsdec_packet_type_t;
+
+/**
+    Represents the statistics of the decoder internals. The counters are
+    accumulated over the decoding sessions until they are reset.
+**/
+struct libcsdec_stats {
+  uint64_t packets[LIBCSDEC_PACKET_TYPE_NUM]; /**< Packets of each type. */
+  uint64_t formatted_bytes;     /**< Size of the formatted trace data. */
+  uint64_t deformatted_bytes;   /**< Size of the trace data of the trace ID. */
+  uint64_t atoms;               /**< Atoms processed. */
+  uint64_t unmapped_atoms;      /**< Atoms skipped outside the memory maps or
+                                     the target context. */
+  uint64_t branch_cache_hits;   /**< Branch instruction cache hits. */
+  uint64_t branch_cache_misses; /**< Branch instruction cache misses. */
+  uint64_t block_interval_hits; /**< Branch instruction cache misses resolved
+                                     without disassembling. */
+  uint64_t trace_cache_hits;    /**< Trace cache hits. */
+  uint64_t trace_cache_misses;  /**< Trace cache misses. */
+  uint64_t indirect_target_cache_hits; /**< Indirect target cache hits. */
+  uint64_t indirect_target_cache_misses; /**< Indirect target cache misses. */
+  uint64_t trace_memo_hits;     /**< Sessions restored from the trace memo. */
+  uint64_t trace_memo_misses;   /**< Sessions decoded with the trace memo. */
+  uint64_t trace_memo_segment_hits;   /**< Segments restored from the trace
+                                           memo. */
+  uint64_t trace_memo_segment_misses; /**< Segments decoded with the trace
+                                           memo. */
+  uint64_t disassembled_insns;  /**< Instructions disassembled by Capstone. */
+  uint64_t page_faults;         /**< Times the trace left the memory maps. */
+  uint64_t context_switches;    /**< Times the trace switched to another
+                                     context than the target. */
+  uint64_t context_session_switches; /**< Times the trace switched between
+                                          the context sessions. */
+  uint64_t unknown_packets;     /**< Packets that cannot be decoded. */
+  uint64_t unsynced_bytes;      /**< Bytes skipped to find an A-sync
+                                     packet. */
+  uint64_t deformat_ns;         /**< Time spent deformatting. */
+  uint64_t decode_ns;           /**< Time spent decoding the packets. */
+  uint64_t disassemble_ns;      /**< Time spent disassembling, included in
+                                     decode_ns. */
+};
+
 /**
     Defines libcsdec specific return code.
 **/
@@ -45,39 +214,135 @@ typedef enum libcsdec_result {
                                    */
   LIBCSDEC_ERROR_TRACE_DATA_INCOMPLETE, /**< Failed due to the trace data is
                                            incomplete. */
-  LIBCSDEC_ERROR_PAGE_FAULT /**< Failed due to the invalid address. */
+  LIBCSDEC_ERROR_PAGE_FAULT, /**< Failed due to the invalid address. */
+  LIBCSDEC_PENDING           /**< The decoding session is not finished yet.
+                              */
 } libcsdec_result_t;
 
+void libcsdec_default_options(struct libcsdec_options *options);
+
 libcsdec_t
-libcsdec_init_edge(void *bitmap_addr, int bitmap_size, int memory_image_num,
+libcsdec_init_edge(void *bitmap_addr, size_t bitmap_size, int memory_image_num,
                    const struct libcsdec_memory_image libcsdec_memory_image[]);
 
+libcsdec_t libcsdec_init_edge_ex(
+    void *bitmap_addr, size_t bitmap_size, libcsdec_bitmap_cell_t cell_type,
+    int memory_image_num,
+    const struct libcsdec_memory_image libcsdec_memory_image[]);
+
+size_t libcsdec_count_static_edges(
+    int memory_image_num,
+    const struct libcsdec_memory_image libcsdec_memory_image[]);
+
+libcsdec_t libcsdec_init_edge_id(
+    void *bitmap_addr, size_t bitmap_size, libcsdec_bitmap_cell_t cell_type,
+    int memory_image_num,
+    const struct libcsdec_memory_image libcsdec_memory_image[]);
+
+libcsdec_t libcsdec_init_edge_opts(
+    void *bitmap_addr, size_t bitmap_size, int memory_image_num,
+    const struct libcsdec_memory_image libcsdec_memory_image[],
+    const struct libcsdec_options *options);
+
 libcsdec_result_t
 libcsdec_reset_edge(const libcsdec_t libcsdec, char trace_id,
                     int memory_map_num,
                     const struct libcsdec_memory_map libcsdec_memory_map[]);
 
+libcsdec_result_t libcsdec_filter_context_edge(const libcsdec_t libcsdec,
+                                              uint64_t context_id);
+
+libcsdec_result_t libcsdec_add_context_edge(
+    const libcsdec_t libcsdec, uint64_t context_id, void *bitmap_addr,
+    int memory_map_num, const struct libcsdec_memory_map libcsdec_memory_map[]);
+
 libcsdec_result_t libcsdec_run_edge(const libcsdec_t libcsdec,
                                     const void *trace_data_addr,
                                     const size_t trace_data_size);
 
+libcsdec_result_t libcsdec_runv_edge(const libcsdec_t libcsdec,
+                                     const struct iovec *segments,
+                                     const size_t segment_num);
+
+libcsdec_result_t libcsdec_run_pack_edge(const libcsdec_t libcsdec,
+                                         const void *pack_addr,
+                                         const size_t pack_size);
+
 libcsdec_result_t libcsdec_finish_edge(const libcsdec_t libcsdec);
 
+libcsdec_result_t libcsdec_get_stats_edge(const libcsdec_t libcsdec,
+                                          struct libcsdec_stats *stats);
+
+libcsdec_result_t libcsdec_reset_stats_edge(const libcsdec_t libcsdec);
+
+libcsdec_result_t libcsdec_write_profile_edge(const libcsdec_t libcsdec,
+                                              int memory_image_id,
+                                              const char *filename);
+
+libcsdec_result_t libcsdec_reset_profile_edge(const libcsdec_t libcsdec);
+
+libcsdec_result_t libcsdec_reset_cache_edge(const libcsdec_t libcsdec);
+
 libcsdec_t
-libcsdec_init_path(void *bitmap_addr, int bitmap_size, int memory_image_num,
+libcsdec_init_path(void *bitmap_addr, size_t bitmap_size, int memory_image_num,
                    const struct libcsdec_memory_image libcsdec_memory_image[]);
 
+libcsdec_t libcsdec_init_path_ex(
+    void *bitmap_addr, size_t bitmap_size, libcsdec_bitmap_cell_t cell_type,
+    int memory_image_num,
+    const struct libcsdec_memory_image libcsdec_memory_image[]);
+
+libcsdec_t libcsdec_init_path_opts(
+    void *bitmap_addr, size_t bitmap_size, int memory_image_num,
+    const struct libcsdec_memory_image libcsdec_memory_image[],
+    const struct libcsdec_options *options);
+
 libcsdec_result_t
 libcsdec_reset_path(const libcsdec_t libcsdec, char trace_id,
                     int memory_map_num,
                     const struct libcsdec_memory_map libcsdec_memory_map[]);
 
+libcsdec_result_t libcsdec_filter_context_path(const libcsdec_t libcsdec,
+                                              uint64_t context_id);
+
 libcsdec_result_t libcsdec_run_path(const libcsdec_t libcsdec,
                                     const void *trace_data_addr,
                                     const size_t trace_data_size);
 
+libcsdec_result_t libcsdec_runv_path(const libcsdec_t libcsdec,
+                                     const struct iovec *segments,
+                                     const size_t segment_num);
+
+libcsdec_result_t libcsdec_run_pack_path(const libcsdec_t libcsdec,
+                                         const void *pack_addr,
+                                         const size_t pack_size);
+
 libcsdec_result_t libcsdec_finish_path(const libcsdec_t libcsdec);
 
+libcsdec_result_t libcsdec_get_stats_path(const libcsdec_t libcsdec,
+                                          struct libcsdec_stats *stats);
+
+libcsdec_result_t libcsdec_reset_stats_path(const libcsdec_t libcsdec);
+
+libcsdec_async_t libcsdec_init_async_edge(const libcsdec_t libcsdec);
+
+libcsdec_async_t libcsdec_init_async_path(const libcsdec_t libcsdec);
+
+libcsdec_result_t
+libcsdec_submit_async(const libcsdec_async_t async, char trace_id,
+                      int memory_map_num,
+                      const struct libcsdec_memory_map libcsdec_memory_map[],
+                      const struct iovec *segments, const size_t segment_num,
+                      libcsdec_ticket_t *ticket);
+
+libcsdec_result_t libcsdec_poll_async(const libcsdec_async_t async,
+                                      libcsdec_ticket_t ticket,
+                                      void **bitmap_addr);
+
+libcsdec_result_t libcsdec_wait_async(const libcsdec_async_t async,
+                                      libcsdec_ticket_t ticket,
+                                      void **bitmap_addr);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -3,12 +3,23 @@
 
 #pragma once
 
+#include <array>
 #include <bitset>
+#include <cassert>
+#include <iostream>
+#include <optional>
+#include <sys/uio.h>
+#include <unordered_map>
+#include <utility>
 
+#include "bitmap.hpp"
 #include "cache.hpp"
 #include "common.hpp"
 #include "decoder.hpp"
 #include "deformatter.hpp"
+#include "edgemap.hpp"
+#include "sink.hpp"
+#include "stats.hpp"
 #include "trace.hpp"
 
 enum class ProcessResultType {
@@ -18,11 +29,101 @@ enum class ProcessResultType {
   PROCESS_ERROR_PAGE_FAULT,
 };
 
+// The default maximum number of EN bits hashed between two address packets in
+// the path coverage mode.
+constexpr std::size_t MAX_ATOM_LEN = 4096;
+
+// The size of the segments of the deformatted trace data memoized separately.
+// Decoding a segment takes much longer than comparing the bitmap before and
+// after it, unless the bitmap is very large.
+constexpr std::size_t TRACE_MEMO_SEGMENT_SIZE = 4096;
+
+// The decoder state at the end of a memoized segment, from which the next
+// segment is decoded.
+struct TraceMemoState {
+  std::size_t trace_data_offset = 0;
+  DecodeState decode_state = DecodeState::START;
+  bool is_synced = false;
+  std::uint64_t address_reg = 0;
+  std::optional<std::uint32_t> context_id;
+  std::uint32_t vmid = 0;
+  std::optional<Location> prev_location;
+  bool has_pending_address_packet = false;
+};
+
+// Memoizes the bitmaps of whole decoding sessions. Many inputs of a fuzzer
+// produce the same trace data, e.g. when they are rejected early by a parser,
+// so the bitmap is restored from the non-zero cells without decoding it again.
+//
+// The segments of the trace data are memoized too, keyed by the hash of the
+// trace data up to the end of the segment. The traces of a target usually
+// share a long prefix, e.g. the startup of the dynamic linker and libc, which
+// is restored segment by segment, so only the rest of the trace is decoded.
+struct TraceMemo {
+  struct Entry {
+    // The cells added to the bitmap by the session or the segment.
+    std::vector<BitmapCell> cells;
+    ProcessResultType result;
+    // Only for the segments.
+    TraceMemoState state;
+  };
+
+  // The memory limit in bytes. When an entry does not fit, all entries are
+  // dropped, so that the memo follows the traces of the current inputs.
+  const std::size_t capacity;
+  std::size_t size;
+
+  // Keyed by the hash of the memory maps and the deformatted trace data of
+  // the session, or of the trace data up to the end of the segment.
+  std::unordered_map<std::uint64_t, Entry> entries;
+
+  TraceMemo(std::size_t capacity) : capacity(capacity), size(0) {}
+
+  const Entry *find(std::uint64_t key) const;
+  void add(std::uint64_t key, Entry &&entry);
+};
+
+enum class CacheMode {
+  // Disassemble the instructions for every atom.
+  NONE,
+  // Cache the disassembled branch instructions and the bitmap keys.
+  BRANCH,
+  // In addition, cache the traces of atom packets.
+  TRACE,
+};
+
+struct ProcessOptions {
+  CacheMode cache_mode = CacheMode::TRACE;
+  // The outputs of the edge coverage mode.
+  OutputSinks sinks = SINK_BITMAP;
+  // The stream of SINK_EDGE_LIST.
+  std::ostream *edge_list_stream = &std::cout;
+  // The callback of SINK_EDGE_CALLBACK.
+  EdgeCallback edge_callback = nullptr;
+  void *edge_callback_data = nullptr;
+  // The file of SINK_EDGE_LOG.
+  std::string edge_log_filename;
+  // The bitmap of SINK_PATH_BITMAP.
+  std::optional<Bitmap> path_bitmap;
+  std::size_t max_atom_len = MAX_ATOM_LEN;
+  // The memory limit of the trace memo in bytes, or 0 to disable it. It is
+  // used only when SINK_BITMAP is the only output, since the other outputs
+  // need every edge.
+  std::size_t trace_memo_size = 0;
+};
+
 struct ProcessData {
   std::vector<MemoryImage> memory_images;
 
   const Bitmap bitmap;
   Cache cache;
+  TraceMemo trace_memo;
+
+  // If it is set, bitmap keys are the collision-free edge keys instead of the
+  // hash of the edge.
+  std::optional<EdgeMap> edge_map;
+
+  const ProcessOptions options;
 
   // Handler for accessing Capstone
   csh handle;
@@ -32,9 +133,11 @@ struct ProcessData {
   ProcessData &operator=(const ProcessData &) = delete;
 
   ProcessData(std::vector<MemoryImage> &&memory_images, const Bitmap &bitmap,
-              Cache &&cache)
+              Cache &&cache, std::optional<EdgeMap> &&edge_map,
+              const ProcessOptions &options)
       : memory_images(std::move(memory_images)), bitmap(bitmap),
-        cache(std::move(cache)) {
+        cache(std::move(cache)), trace_memo(options.trace_memo_size),
+        edge_map(std::move(edge_map)), options(options) {
     csh handle;
     disassembleInit(&handle);
     this->handle = handle;
@@ -62,6 +165,60 @@ struct ProcessState {
   }
 };
 
+// Another context decoded from the same trace stream as the target, e.g.
+// another child of a fork server on the same core. It has its own bitmap and
+// memory maps, and shares the memory images and the caches with the target.
+struct ContextSession {
+  std::uint32_t context_id;
+  Bitmap bitmap;
+  std::vector<MemoryMap> memory_maps;
+  // If the memory maps are the same as the target's, the indirect target
+  // cache is kept over the switches.
+  bool has_same_memory_maps;
+
+  ContextSession(std::uint32_t context_id, const Bitmap &bitmap,
+                 std::vector<MemoryMap> &&memory_maps,
+                 bool has_same_memory_maps)
+      : context_id(context_id), bitmap(bitmap),
+        memory_maps(std::move(memory_maps)),
+        has_same_memory_maps(has_same_memory_maps) {}
+};
+
+// Calculates the path coverage from the decoded packets. It is driven by
+// PathProcess, and by Process with SINK_PATH_BITMAP, so that the trace data
+// is deformatted and decoded once for both coverages.
+struct PathCoverage {
+  const Bitmap bitmap;
+
+  // The maximum number of EN bits hashed between two address packets.
+  const std::size_t max_atom_len;
+
+  // The path coverage keeps its own state, since it handles the trace start
+  // and the trace on packet differently from the edge coverage.
+  DecodeState state;
+
+  // The EN bits since the last address packet, packed into 64-bit words. Only
+  // the word being filled is kept, since filled words are mixed into ctx_hash.
+  std::uint64_t ctx_en_word;
+  std::size_t ctx_en_word_len;
+  std::size_t ctx_en_bits_len;
+  std::uint64_t ctx_hash;
+
+  PathCoverage(const Bitmap &bitmap, std::size_t max_atom_len)
+      : bitmap(bitmap), max_atom_len(max_atom_len) {}
+
+  void reset();
+  // Returns true if the trace has left the memory maps at the packet.
+  bool processPacket(const Packet &packet,
+                     const std::vector<MemoryMap> &memory_maps, Stats &stats);
+  void processAtoms(std::uint32_t en_bits, std::size_t en_bits_len);
+  void leaveTracedRegion();
+
+private:
+  void resetContext();
+  void processAddress(const Location &target_location);
+};
+
 struct Process {
   ProcessData data;
   ProcessState state;
@@ -69,21 +226,105 @@ struct Process {
   Deformatter deformatter;
   Decoder decoder;
 
+  // Accumulated over the decoding sessions until it is reset explicitly.
+  Stats stats;
+
+  EdgeListSink edge_list_sink;
+  EdgeCallbackSink edge_callback_sink;
+  EdgeLogSink edge_log_sink;
+  // Accumulated over the decoding sessions until it is reset explicitly.
+  EdgeProfileSink edge_profile_sink;
+
+  // Set with SINK_PATH_BITMAP.
+  std::optional<PathCoverage> path_coverage;
+
+  // The other contexts decoded in the session. The rest of the trace is
+  // decoded into the bitmap and the memory maps of the target, subject to the
+  // context filter of the decoder.
+  std::vector<ContextSession> context_sessions;
+
   Process(std::vector<MemoryImage> &&memory_images, const Bitmap &bitmap,
           Cache &&cache)
-      : data(std::move(memory_images), bitmap, std::move(cache)) {}
+      : Process(std::move(memory_images), bitmap, std::move(cache),
+                std::nullopt) {}
+
+  Process(std::vector<MemoryImage> &&memory_images, const Bitmap &bitmap,
+          Cache &&cache, std::optional<EdgeMap> &&edge_map,
+          const ProcessOptions &options = ProcessOptions())
+      : data(std::move(memory_images), bitmap, std::move(cache),
+             std::move(edge_map), options),
+        decoder(this->data.cache.resource),
+        edge_list_sink(options.edge_list_stream),
+        edge_callback_sink(options.edge_callback, options.edge_callback_data),
+        edge_log_sink((options.sinks & SINK_EDGE_LOG)
+                          ? options.edge_log_filename
+                          : std::string()),
+        bitmap(&this->data.bitmap) {
+    if (options.sinks & SINK_PATH_BITMAP) {
+      assert(options.path_bitmap.has_value() == true);
+      this->path_coverage.emplace(options.path_bitmap.value(),
+                                  options.max_atom_len);
+    }
+  }
 
   void reset(std::vector<MemoryMap> &&memory_maps,
              std::uint8_t target_trace_id);
+  // Decodes the trace of the context into its own bitmap and memory maps
+  // until the next reset. The bitmap must have the same size and cell type as
+  // the bitmap of the target, and SINK_BITMAP must be the only output. Returns
+  // false if the context is already added.
+  bool addContextSession(std::uint32_t context_id, const Bitmap &bitmap,
+                         std::vector<MemoryMap> &&memory_maps);
+  // Drops the caches and the trace data, and releases the memory under them.
+  // It is called between the decoding sessions.
+  void clearCache();
   ProcessResultType final();
   ProcessResultType run(const std::uint8_t *trace_data_addr,
                         std::size_t trace_data_size);
+  // Same as run on the concatenation of the segments.
+  ProcessResultType run(const struct iovec *segments, std::size_t segment_num);
 
 private:
-  AtomTrace processAtomPacket(const Packet &atom_packet);
+  // The bitmap of the context being decoded.
+  const Bitmap *bitmap;
+  // The index of the context session being decoded, or std::nullopt for the
+  // target. Its memory maps are swapped into the state meanwhile.
+  std::optional<std::size_t> active_context_session;
+  // The context ID at the last switch of the context sessions.
+  std::optional<std::uint32_t> routed_context_id;
+
+  bool usesTraceMemo() const;
+  ProcessResultType decodeTraceData();
+  ProcessResultType finalWithTraceMemo();
+  ProcessResultType decodeSegmentsWithTraceMemo();
+  TraceMemoState saveTraceMemoState() const;
+  void restoreTraceMemoState(const TraceMemoState &state);
+  template <CacheMode cache_mode> ProcessResultType decodeTraceData();
+  template <CacheMode cache_mode, OutputSinks sinks>
+  ProcessResultType decodeTraceData();
+  template <CacheMode cache_mode, OutputSinks... sinks>
+  static constexpr std::array<ProcessResultType (Process::*)(),
+                              sizeof...(sinks)>
+  makeDecodeTraceDataTable(std::integer_sequence<OutputSinks, sinks...>);
+  template <CacheMode cache_mode, OutputSinks sinks>
+  void processAtoms(std::uint32_t en_bits, std::size_t en_bits_len);
+  template <OutputSinks sinks> void writeAtomTrace(const AtomTrace &trace);
+  template <OutputSinks sinks>
+  void writeAddressTrace(const AddressTrace &trace);
+  void flushSinks();
+  template <CacheMode cache_mode>
+  AtomTrace processAtomPacket(std::uint32_t en_bits, std::size_t en_bits_len);
   std::optional<AddressTrace>
   processAddressPacket(const Packet &address_packet);
+  std::optional<AddressTrace>
+  processIndirectTargetCache(const Packet &address_packet);
+  void leaveTracedRegion();
+  void switchContext();
+  void activateContextSession(std::optional<std::size_t> index);
   BranchInsn processNextBranchInsn(const Location &base_location);
+  std::size_t processBranchInsnCache(const Location &base_location);
+  std::size_t processSuccessorBranchInsn(std::size_t index, bool is_taken);
+  void calculateBitmapKey(AddressTrace &trace);
 };
 
 struct PathProcess {
@@ -93,18 +334,21 @@ struct PathProcess {
   std::vector<MemoryImage> memory_images;
   std::vector<MemoryMap> memory_maps;
 
-  Bitmap bitmap;
+  // Accumulated over the decoding sessions until it is reset explicitly.
+  Stats stats;
 
-  std::string ctx_en_bits;
-  std::size_t ctx_en_bits_len;
-  std::uint64_t ctx_hash;
+  PathCoverage coverage;
 
-  PathProcess(std::vector<MemoryImage> &&memory_images, const Bitmap &bitmap)
-      : memory_images(std::move(memory_images)), bitmap(bitmap) {}
+  PathProcess(std::vector<MemoryImage> &&memory_images, const Bitmap &bitmap,
+              const ProcessOptions &options = ProcessOptions())
+      : memory_images(std::move(memory_images)),
+        coverage(bitmap, options.max_atom_len) {}
 
   void reset(std::vector<MemoryMap> &&memory_maps,
              std::uint8_t target_trace_id);
   ProcessResultType final();
   ProcessResultType run(const std::uint8_t *trace_data_addr,
                         const size_t trace_data_size);
+  // Same as run on the concatenation of the segments.
+  ProcessResultType run(const struct iovec *segments, std::size_t segment_num);
 };
@@ -0,0 +1,127 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright 2021 Ricerca Security, Inc. All rights reserved. */
+
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "common.hpp"
+#include "edgelog.hpp"
+#include "edgemap.hpp"
+
+// The outputs of the edge coverage mode. They are combined as bit flags, and
+// the decoding loop is specialized for every combination, so that an unused
+// output costs nothing.
+using OutputSinks = unsigned int;
+constexpr OutputSinks SINK_BITMAP = 1 << 0;
+constexpr OutputSinks SINK_EDGE_LIST = 1 << 1;
+constexpr OutputSinks SINK_EDGE_CALLBACK = 1 << 2;
+constexpr OutputSinks SINK_EDGE_LOG = 1 << 3;
+// The path coverage bitmap, calculated from the same packets.
+constexpr OutputSinks SINK_PATH_BITMAP = 1 << 4;
+constexpr OutputSinks SINK_EDGE_PROFILE = 1 << 5;
+constexpr OutputSinks SINK_COMBINATION_NUM = 1 << 6;
+
+using EdgeCallback = void (*)(void *user_data, const Edge *edges,
+                              std::size_t edge_num);
+
+// Writes the edges as text lines. The lines are formatted into a buffer, which
+// is written to the stream when it is full and at the end of each run.
+struct EdgeListSink {
+  static constexpr std::size_t BUFFER_SIZE = 64 * 1024;
+
+  std::ostream *stream;
+  std::string buffer;
+
+  EdgeListSink(std::ostream *stream) : stream(stream) {
+    this->buffer.reserve(BUFFER_SIZE);
+  }
+
+  void addEdge(const Location &src_location, const Location &dest_location) {
+    appendLocation(src_location);
+    this->buffer.append(" -> ");
+    appendLocation(dest_location);
+    this->buffer.push_back('\n');
+    if (this->buffer.size() >= BUFFER_SIZE) {
+      flush();
+    }
+  }
+
+  void flush();
+
+private:
+  void appendLocation(const Location &location);
+};
+
+// Delivers the edges to the callback in batches of BATCH_SIZE edges. The rest
+// is delivered at the end of each run.
+struct EdgeCallbackSink {
+  static constexpr std::size_t BATCH_SIZE = 4096;
+
+  EdgeCallback callback;
+  void *user_data;
+  std::vector<Edge> edges;
+
+  EdgeCallbackSink(EdgeCallback callback, void *user_data)
+      : callback(callback), user_data(user_data) {
+    this->edges.reserve(BATCH_SIZE);
+  }
+
+  void addEdge(const Location &src_location, const Location &dest_location) {
+    this->edges.emplace_back(src_location, dest_location);
+    if (this->edges.size() >= BATCH_SIZE) {
+      flush();
+    }
+  }
+
+  void flush();
+};
+
+// Writes the edges in the edge log format. The edges are encoded into a buffer,
+// which is written to the file as a record when it is full and at the end of
+// each run.
+struct EdgeLogSink {
+  static constexpr std::size_t BUFFER_SIZE = 1024 * 1024;
+
+  std::ofstream stream;
+  binary_data_t buffer;
+  std::uint64_t edge_num;
+  Location prev_location;
+
+  // The file is not opened if the filename is empty.
+  EdgeLogSink(const std::string &filename);
+
+  // Starts a new decoding session with the memory maps.
+  void beginSession(const std::vector<MemoryMap> &memory_maps);
+
+  void addEdge(const Location &src_location, const Location &dest_location) {
+    appendEdge(this->buffer, this->prev_location, src_location, dest_location);
+    ++this->edge_num;
+    if (this->buffer.size() >= BUFFER_SIZE) {
+      flush();
+    }
+  }
+
+  void flush();
+};
+
+// Counts the edges over the decoding sessions for a profile of the program,
+// e.g. for the profile guided optimization. The memory is bounded by the
+// number of the distinct edges, not by the length of the trace.
+struct EdgeProfileSink {
+  std::unordered_map<Edge, std::uint64_t> counts;
+
+  void addEdge(const Location &src_location, const Location &dest_location) {
+    ++this->counts[Edge(src_location, dest_location)];
+  }
+
+  // Writes the profile of the memory image in the unsymbolized profile format
+  // of llvm-profgen. The addresses are the offsets in the image.
+  void write(std::ostream &stream, image_id_t id, const csh &handle,
+             const std::vector<MemoryImage> &memory_images) const;
+};
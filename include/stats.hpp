@@ -0,0 +1,99 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright 2021 Ricerca Security, Inc. All rights reserved. */
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "decoder.hpp"
+
+// The number of packet types counted by the statistics. PKT_INCOMPLETE is not
+// counted, because the packet is decoded again with the next trace data.
+constexpr std::size_t PACKET_TYPE_NUM =
+    static_cast<std::size_t>(PacketType::PKT_INCOMPLETE);
+
+// Counters of the decoder internals. They are plain increments, and the time
+// is measured only once per stage of each run, so they are always enabled.
+struct Stats {
+  std::array<std::uint64_t, PACKET_TYPE_NUM> packets{};
+
+  // The size of the formatted trace data and of the trace data of the target
+  // trace ID.
+  std::uint64_t formatted_bytes = 0;
+  std::uint64_t deformatted_bytes = 0;
+
+  std::uint64_t atoms = 0;
+  // The atoms skipped outside the memory maps or the target context. They are
+  // not counted in atoms.
+  std::uint64_t unmapped_atoms = 0;
+
+  // In the cache mode, following a successor link of the branch instruction
+  // cache is counted as a hit.
+  std::uint64_t branch_cache_hits = 0;
+  std::uint64_t branch_cache_misses = 0;
+  // The branch instruction cache misses resolved by a block interval without
+  // disassembling.
+  std::uint64_t block_interval_hits = 0;
+  std::uint64_t trace_cache_hits = 0;
+  std::uint64_t trace_cache_misses = 0;
+  std::uint64_t indirect_target_cache_hits = 0;
+  std::uint64_t indirect_target_cache_misses = 0;
+  // A hit of the trace memo skips decoding the whole session, so the packets
+  // of the session are not counted.
+  std::uint64_t trace_memo_hits = 0;
+  std::uint64_t trace_memo_misses = 0;
+  // The segments of the sessions missed in the trace memo.
+  std::uint64_t trace_memo_segment_hits = 0;
+  std::uint64_t trace_memo_segment_misses = 0;
+
+  // The number of instructions disassembled with Capstone.
+  std::uint64_t disassembled_insns = 0;
+
+  // The number of times the trace left the memory maps.
+  std::uint64_t page_faults = 0;
+  // The number of times the trace switched to another context than the target.
+  std::uint64_t context_switches = 0;
+  // The number of times the trace switched between the context sessions.
+  std::uint64_t context_session_switches = 0;
+  std::uint64_t unknown_packets = 0;
+  // The number of bytes skipped to find an A-sync packet.
+  std::uint64_t unsynced_bytes = 0;
+
+  // Elapsed time of each stage. decode_ns includes disassemble_ns.
+  std::uint64_t deformat_ns = 0;
+  std::uint64_t decode_ns = 0;
+  std::uint64_t disassemble_ns = 0;
+
+  void reset() { *this = Stats(); }
+
+  void countPacket(const PacketType type) {
+    ++this->packets[static_cast<std::size_t>(type)];
+    if (type == PacketType::PKT_UNKNOWN) {
+      ++this->unknown_packets;
+    }
+  }
+
+  void print(std::ostream &stream) const;
+};
+
+// Adds the elapsed time of the scope to the counter.
+struct StatsTimer {
+  std::uint64_t &ns;
+  const std::chrono::steady_clock::time_point start;
+
+  StatsTimer(std::uint64_t &ns)
+      : ns(ns), start(std::chrono::steady_clock::now()) {}
+
+  ~StatsTimer() {
+    this->ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - this->start)
+                    .count();
+  }
+};
+
+const char *packetTypeToString(PacketType type);
@@ -3,22 +3,26 @@
 
 #pragma once
 
+#include <memory_resource>
+#include <vector>
+
 #include "bitmap.hpp"
 #include "common.hpp"
 
 struct AtomTrace {
-  std::vector<Location> locations;
-  std::vector<std::size_t> bitmap_keys;
+  std::pmr::vector<Location> locations;
+  std::pmr::vector<std::size_t> bitmap_keys;
   bool has_pending_address_packet;
 
   AtomTrace() = default;
-  AtomTrace(const Location &location);
+  AtomTrace(const Location &location, std::pmr::memory_resource *resource =
+                                          std::pmr::get_default_resource());
 
   void addLocation(const Location &location);
+  void addBitmapKey(std::size_t key);
   void calculateBitmapKeys(std::size_t bitmap_size);
   void writeBitmapKeys(const Bitmap &bitmap) const;
   void setPendingAddressPacket();
-  void printTraceLocations(const std::vector<MemoryMap> &memory_map) const;
 };
 
 struct AddressTrace {
@@ -31,5 +35,4 @@ struct AddressTrace {
 
   void calculateBitmapKey(std::size_t bitmap_size);
   void writeBitmapKey(const Bitmap &bitmap) const;
-  void printTraceLocation(const std::vector<MemoryMap> &memory_map) const;
 };
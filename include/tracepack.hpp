@@ -0,0 +1,86 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright 2021 Ricerca Security, Inc. All rights reserved. */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "common.hpp"
+
+// The trace pack is a compressed container of the formatted trace data. The
+// trace data is split into blocks compressed independently, so that any block
+// can be decompressed without the ones before it:
+//
+//   header:  magic, version, block_size
+//   blocks:  the compressed blocks
+//   index:   {offset, size, raw_size} of each block
+//   footer:  block_num, raw_size
+//
+// All integers are little-endian, the version, block_size, size and raw_size
+// are 32 bits and the others are 64 bits. A block is stored uncompressed if
+// the compression does not make it smaller, i.e. if size == raw_size.
+//
+// The blocks are compressed with a byte-oriented LZ77 codec in the format of
+// LZ4 blocks. A sequence is a token, the literals and a match:
+//
+//   token:     literal_len << 4 | (match_len - TRACE_PACK_MIN_MATCH)
+//   literal_len and match_len of 15 or more: followed by bytes of 255 and a
+//              byte of the rest
+//   offset:    16 bits, the distance back to the match
+//
+// The last sequence has the literals only. Formatted trace data consists of
+// frames with the same trace ID bytes and of repeated atom packets, so it
+// usually shrinks to a fraction of its size.
+constexpr char TRACE_PACK_MAGIC[8] = {'C', 'S', 'T', 'R', 'P', 'A', 'C', 'K'};
+constexpr std::uint32_t TRACE_PACK_VERSION = 1;
+
+// A block of 64 KiB is decompressed into the L2 cache while the previous one
+// is decoded, and the match offsets cover the whole block.
+constexpr std::size_t TRACE_PACK_BLOCK_SIZE = 64 * 1024;
+constexpr std::size_t TRACE_PACK_MAX_BLOCK_SIZE = 16 * 1024 * 1024;
+constexpr std::size_t TRACE_PACK_MIN_MATCH = 4;
+
+constexpr std::size_t TRACE_PACK_HEADER_SIZE = 16;
+constexpr std::size_t TRACE_PACK_INDEX_ENTRY_SIZE = 16;
+constexpr std::size_t TRACE_PACK_FOOTER_SIZE = 16;
+
+struct TracePackBlock {
+  std::uint64_t offset;
+  std::uint32_t size;
+  std::uint32_t raw_size;
+};
+
+// Compresses the block and appends it to the buffer.
+void compressTracePackBlock(const std::uint8_t *data, std::size_t size,
+                            binary_data_t &buffer);
+// Decompresses the block into raw_size bytes. Returns false if the block is
+// broken.
+bool decompressTracePackBlock(const std::uint8_t *data, std::size_t size,
+                              std::uint8_t *raw_data, std::size_t raw_size);
+
+// Returns true if the data starts with the magic of the trace pack.
+bool isTracePack(const std::uint8_t *data, std::size_t size);
+binary_data_t packTraceData(const std::uint8_t *data, std::size_t size,
+                            std::size_t block_size = TRACE_PACK_BLOCK_SIZE);
+
+// Reads the blocks of a trace pack in memory, e.g. a mapped file.
+struct TracePackReader {
+  const std::uint8_t *const data;
+  const std::size_t size;
+
+  std::uint32_t block_size;
+  std::uint64_t raw_size;
+  std::vector<TracePackBlock> blocks;
+  // Set if the header or the index is broken.
+  bool failed;
+
+  TracePackReader(const std::uint8_t *data, std::size_t size);
+
+  // Decompresses the block into the buffer. Returns false if it is broken.
+  bool readBlock(std::size_t index, binary_data_t &buffer) const;
+  // Decompresses only the blocks that overlap the range of the trace data.
+  // Returns false if the range is out of the trace data or a block is broken.
+  bool readRange(std::uint64_t offset, std::uint64_t size,
+                 binary_data_t &buffer) const;
+};
@@ -0,0 +1,120 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright 2021 Ricerca Security, Inc. All rights reserved. */
+
+#include <new>
+#include <sys/mman.h>
+
+#include "arena.hpp"
+
+static std::size_t roundUp(std::size_t size, std::size_t alignment);
+
+Arena::Arena(bool use_huge_pages)
+    : use_huge_pages(use_huge_pages), mapped_size(0), chunk_ptr(nullptr),
+      chunk_left(0) {}
+
+Arena::~Arena() { release(); }
+
+void Arena::release() {
+  for (const auto &[addr, size] : this->chunks) {
+    unmap(addr, size);
+  }
+  for (const auto &[addr, size] : this->large_mappings) {
+    unmap(addr, size);
+  }
+  this->chunks.clear();
+  this->large_mappings.clear();
+  this->chunk_ptr = nullptr;
+  this->chunk_left = 0;
+}
+
+void *Arena::map(std::size_t size) {
+  if (not usesHugePages(size)) {
+    void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED) {
+      throw std::bad_alloc();
+    }
+    this->mapped_size += size;
+    return addr;
+  }
+
+  // Map one more huge page and trim both ends, so that the mapping is aligned
+  // to huge pages. Otherwise, the kernel cannot back it with huge pages.
+  const std::size_t aligned_size = roundUp(size, ARENA_CHUNK_SIZE);
+  void *addr = mmap(nullptr, aligned_size + ARENA_CHUNK_SIZE,
+                    PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (addr == MAP_FAILED) {
+    throw std::bad_alloc();
+  }
+  const std::uintptr_t start = reinterpret_cast<std::uintptr_t>(addr);
+  const std::uintptr_t aligned_start = roundUp(start, ARENA_CHUNK_SIZE);
+  if (aligned_start != start) {
+    munmap(addr, aligned_start - start);
+  }
+  munmap(reinterpret_cast<void *>(aligned_start + aligned_size),
+         start + ARENA_CHUNK_SIZE - aligned_start);
+
+  void *aligned_addr = reinterpret_cast<void *>(aligned_start);
+  // Ignore the error, since transparent huge pages may be unavailable.
+  madvise(aligned_addr, aligned_size, MADV_HUGEPAGE);
+  this->mapped_size += aligned_size;
+  return aligned_addr;
+}
+
+void Arena::unmap(void *addr, std::size_t size) {
+  if (usesHugePages(size)) {
+    size = roundUp(size, ARENA_CHUNK_SIZE);
+  }
+  munmap(addr, size);
+  this->mapped_size -= size;
+}
+
+// A mapping smaller than a huge page is not worth padding to one.
+bool Arena::usesHugePages(std::size_t size) const {
+  return this->use_huge_pages and size >= ARENA_CHUNK_SIZE;
+}
+
+void *Arena::do_allocate(std::size_t bytes, std::size_t alignment) {
+  if (bytes > ARENA_LARGE_SIZE) {
+    void *addr = map(bytes);
+    this->large_mappings.emplace(addr, bytes);
+    return addr;
+  }
+
+  std::size_t padding =
+      -reinterpret_cast<std::uintptr_t>(this->chunk_ptr) & (alignment - 1);
+  if (padding + bytes > this->chunk_left) {
+    // The rest of the chunk is wasted, which is less than ARENA_LARGE_SIZE.
+    void *chunk = map(ARENA_CHUNK_SIZE);
+    this->chunks.emplace_back(chunk, ARENA_CHUNK_SIZE);
+    this->chunk_ptr = reinterpret_cast<std::uint8_t *>(chunk);
+    this->chunk_left = ARENA_CHUNK_SIZE;
+    padding = 0;
+  }
+
+  void *addr = this->chunk_ptr + padding;
+  this->chunk_ptr += padding + bytes;
+  this->chunk_left -= padding + bytes;
+  return addr;
+}
+
+void Arena::do_deallocate(void *p, std::size_t bytes,
+                          [[maybe_unused]] std::size_t alignment) {
+  // A small block stays in its chunk until the arena is released.
+  if (bytes > ARENA_LARGE_SIZE) {
+    const auto it = this->large_mappings.find(p);
+    if (it != this->large_mappings.end()) {
+      unmap(it->first, it->second);
+      this->large_mappings.erase(it);
+    }
+  }
+}
+
+bool Arena::do_is_equal(const std::pmr::memory_resource &other) const
+    noexcept {
+  return this == &other;
+}
+
+static std::size_t roundUp(std::size_t size, std::size_t alignment) {
+  return (size + alignment - 1) & ~(alignment - 1);
+}
@@ -0,0 +1,105 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright 2021 Ricerca Security, Inc. All rights reserved. */
+
+#include <cstring>
+
+#include "async.hpp"
+
+AsyncDecoder::AsyncDecoder(const Bitmap &bitmap, SessionRunner &&run_session)
+    : bitmap(bitmap), run_session(std::move(run_session)),
+      submitted_ticket(0), finished_ticket(0), stopping(false) {
+  for (Slot &slot : this->slots) {
+    slot.bitmap.resize(this->bitmap.byteSize());
+  }
+  this->worker = std::thread(&AsyncDecoder::work, this);
+}
+
+// The sessions not started yet are discarded.
+AsyncDecoder::~AsyncDecoder() {
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->stopping = true;
+  }
+  this->submitted.notify_one();
+  this->worker.join();
+}
+
+std::optional<std::uint64_t>
+AsyncDecoder::submit(std::uint8_t trace_id,
+                     std::vector<MemoryMap> &&memory_maps,
+                     std::vector<struct iovec> &&segments) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+
+  // Ticket 0 is never used, so that it can be regarded as invalid.
+  const std::uint64_t ticket = this->submitted_ticket + 1;
+  Slot &slot = this->slots[ticket % ASYNC_SLOT_NUM];
+  if (not slot.collected) {
+    return std::nullopt;
+  }
+  slot.ticket = ticket;
+  slot.collected = false;
+
+  this->submitted_ticket = ticket;
+  this->sessions.push_back(AsyncSession{ticket, trace_id,
+                                        std::move(memory_maps),
+                                        std::move(segments)});
+  this->submitted.notify_one();
+  return ticket;
+}
+
+bool AsyncDecoder::hasTicket(std::uint64_t ticket) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return ticket != 0 and this->slots[ticket % ASYNC_SLOT_NUM].ticket == ticket;
+}
+
+std::optional<ProcessResultType> AsyncDecoder::poll(std::uint64_t ticket) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  if (this->finished_ticket < ticket) {
+    return std::nullopt;
+  }
+
+  Slot &slot = this->slots[ticket % ASYNC_SLOT_NUM];
+  slot.collected = true;
+  return slot.result;
+}
+
+ProcessResultType AsyncDecoder::wait(std::uint64_t ticket) {
+  std::unique_lock<std::mutex> lock(this->mutex);
+  this->finished.wait(lock,
+                      [&] { return this->finished_ticket >= ticket; });
+
+  Slot &slot = this->slots[ticket % ASYNC_SLOT_NUM];
+  slot.collected = true;
+  return slot.result;
+}
+
+std::uint8_t *AsyncDecoder::getBitmap(std::uint64_t ticket) {
+  return this->slots[ticket % ASYNC_SLOT_NUM].bitmap.data();
+}
+
+void AsyncDecoder::work() {
+  std::unique_lock<std::mutex> lock(this->mutex);
+  while (true) {
+    this->submitted.wait(
+        lock, [this] { return this->stopping or not this->sessions.empty(); });
+    if (this->stopping) {
+      return;
+    }
+
+    AsyncSession session = std::move(this->sessions.front());
+    this->sessions.pop_front();
+
+    // The caller does not touch the process while sessions are submitted, nor
+    // the slot of the ticket until the session is finished, so the session is
+    // decoded without holding the lock.
+    lock.unlock();
+    const ProcessResultType result = this->run_session(session);
+    Slot &slot = this->slots[session.ticket % ASYNC_SLOT_NUM];
+    std::memcpy(slot.bitmap.data(), this->bitmap.data, slot.bitmap.size());
+    lock.lock();
+
+    slot.result = result;
+    this->finished_ticket = session.ticket;
+    this->finished.notify_all();
+  }
+}
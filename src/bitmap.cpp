@@ -2,6 +2,7 @@
 /* Copyright 2021 Ricerca Security, Inc. All rights reserved. */
 
 #include <algorithm>
+#include <cstring>
 #include <iostream>
 #include <string>
 #include <vector>
@@ -9,11 +10,127 @@
 #include "bitmap.hpp"
 #include "trace.hpp"
 
-Bitmap::Bitmap(std::uint8_t *data, std::size_t size) : data(data), size(size) {}
+Bitmap::Bitmap(std::uint8_t *data, std::size_t size, BitmapCellType cell_type)
+    : data(data), size(size), cell_type(cell_type) {}
 
 void Bitmap::reset() const {
   // Fill the bitmap with zeros.
-  std::fill(this->data, this->data + this->size, 0);
+  std::fill(this->data, this->data + this->byteSize(), 0);
+}
+
+std::size_t Bitmap::byteSize() const {
+  return this->size * getBitmapCellSize(this->cell_type);
+}
+
+// Appends the cells that differ from the previous data. Without the previous
+// data, the non-zero cells are appended.
+template <typename T>
+static void readBitmapDelta(const std::uint8_t *data,
+                            const std::uint8_t *prev_data,
+                            const std::size_t size,
+                            std::vector<BitmapCell> &cells) {
+  const T *const bitmap_cells = reinterpret_cast<const T *>(data);
+  const T *const prev_cells = reinterpret_cast<const T *>(prev_data);
+
+  // Most of the cells are unchanged, so they are skipped a 64-bit word at a
+  // time.
+  constexpr std::size_t CELLS_PER_WORD = sizeof(std::uint64_t) / sizeof(T);
+  std::size_t index = 0;
+  for (; index < size; index += CELLS_PER_WORD) {
+    const std::size_t end = std::min(index + CELLS_PER_WORD, size);
+    if (end - index == CELLS_PER_WORD) {
+      std::uint64_t word;
+      std::uint64_t prev_word = 0;
+      std::memcpy(&word, bitmap_cells + index, sizeof(word));
+      if (prev_data != nullptr) {
+        std::memcpy(&prev_word, prev_cells + index, sizeof(prev_word));
+      }
+      if (word == prev_word) {
+        continue;
+      }
+    }
+    for (std::size_t i = index; i < end; ++i) {
+      const T count = static_cast<T>(
+          bitmap_cells[i] - (prev_data != nullptr ? prev_cells[i] : 0));
+      if (count != 0) {
+        cells.push_back({static_cast<std::uint32_t>(i), count});
+      }
+    }
+  }
+}
+
+template <typename T>
+static void addBitmapCells(std::uint8_t *data,
+                           const std::vector<BitmapCell> &cells) {
+  T *const bitmap_cells = reinterpret_cast<T *>(data);
+  for (const BitmapCell &cell : cells) {
+    bitmap_cells[cell.index] += static_cast<T>(cell.count);
+  }
+}
+
+void Bitmap::readCells(std::vector<BitmapCell> &cells) const {
+  switch (this->cell_type) {
+  case BitmapCellType::U8:
+    readBitmapDelta<std::uint8_t>(this->data, nullptr, this->size, cells);
+    break;
+  case BitmapCellType::U16:
+    readBitmapDelta<std::uint16_t>(this->data, nullptr, this->size, cells);
+    break;
+  case BitmapCellType::U32:
+    readBitmapDelta<std::uint32_t>(this->data, nullptr, this->size, cells);
+    break;
+  default:
+    __builtin_unreachable();
+  }
+}
+
+void Bitmap::readDelta(const std::vector<std::uint8_t> &prev_data,
+                       std::vector<BitmapCell> &cells) const {
+  switch (this->cell_type) {
+  case BitmapCellType::U8:
+    readBitmapDelta<std::uint8_t>(this->data, prev_data.data(), this->size,
+                                  cells);
+    break;
+  case BitmapCellType::U16:
+    readBitmapDelta<std::uint16_t>(this->data, prev_data.data(), this->size,
+                                   cells);
+    break;
+  case BitmapCellType::U32:
+    readBitmapDelta<std::uint32_t>(this->data, prev_data.data(), this->size,
+                                   cells);
+    break;
+  default:
+    __builtin_unreachable();
+  }
+}
+
+void Bitmap::addCells(const std::vector<BitmapCell> &cells) const {
+  switch (this->cell_type) {
+  case BitmapCellType::U8:
+    addBitmapCells<std::uint8_t>(this->data, cells);
+    break;
+  case BitmapCellType::U16:
+    addBitmapCells<std::uint16_t>(this->data, cells);
+    break;
+  case BitmapCellType::U32:
+    addBitmapCells<std::uint32_t>(this->data, cells);
+    break;
+  default:
+    __builtin_unreachable();
+  }
+}
+
+std::size_t getBitmapCellSize(const BitmapCellType cell_type) {
+  switch (cell_type) {
+  case BitmapCellType::U8:
+    return sizeof(std::uint8_t);
+  case BitmapCellType::U16:
+    return sizeof(std::uint16_t);
+  case BitmapCellType::U32:
+    return sizeof(std::uint32_t);
+  default:
+    __builtin_unreachable();
+  }
 }
 
 std::uint64_t generateBitmapKey(const Location &from_location,
@@ -20,27 +20,105 @@ std::size_t std::hash<TraceKey>::operator()(const TraceKey &key) const {
   return h1 ^ h2 ^ h3;
 }
 
-BranchInsn Cache::getBranchInsnCache(const Location &key) const {
-  return this->branch_insn_cache.at(key);
+BranchInsnCacheEntry::BranchInsnCacheEntry(const BranchInsn &insn,
+                                           std::size_t taken_bitmap_key,
+                                           std::size_t not_taken_bitmap_key)
+    : insn(insn), taken_bitmap_key(taken_bitmap_key),
+      not_taken_bitmap_key(not_taken_bitmap_key), taken_index(NO_INDEX),
+      not_taken_index(NO_INDEX) {}
+
+// The entries are in the generation 0, which is never valid. The pool keeps
+// the blocks up to the size mapped separately by the arena, so that no freed
+// block is left unused in the chunks.
+Cache::Cache(bool use_huge_pages)
+    : arena(std::make_unique<Arena>(use_huge_pages)),
+      pool(std::make_unique<std::pmr::unsynchronized_pool_resource>(
+          std::pmr::pool_options{0, ARENA_LARGE_SIZE}, this->arena.get())),
+      resource(this->pool.get()), branch_insns(this->resource),
+      branch_insn_cache(this->resource), trace_cache(this->resource),
+      block_intervals(this->resource),
+      indirect_targets(std::size_t(1) << INDIRECT_TARGET_CACHE_BITS,
+                       this->resource),
+      indirect_target_generation(1) {}
+
+Cache::Cache(std::pmr::memory_resource *resource)
+    : resource(resource), branch_insns(resource), branch_insn_cache(resource),
+      trace_cache(resource), block_intervals(resource),
+      indirect_targets(std::size_t(1) << INDIRECT_TARGET_CACHE_BITS, resource),
+      indirect_target_generation(1) {}
+
+void Cache::clear() {
+  // The entries are destroyed before the memory under them is released.
+  this->branch_insns = decltype(this->branch_insns)(this->resource);
+  this->branch_insn_cache = decltype(this->branch_insn_cache)(this->resource);
+  this->trace_cache = decltype(this->trace_cache)(this->resource);
+  this->block_intervals = decltype(this->block_intervals)(this->resource);
+  this->indirect_targets = decltype(this->indirect_targets)(this->resource);
+
+  if (this->arena != nullptr) {
+    this->pool->release();
+    this->arena->release();
+  }
+  this->indirect_targets.resize(std::size_t(1) << INDIRECT_TARGET_CACHE_BITS);
 }
 
-void Cache::addBranchInsnCache(const Location &key,
-                               const BranchInsn &branch_insn) {
-  this->branch_insn_cache.emplace(key, branch_insn);
+std::optional<std::size_t>
+Cache::findBranchInsnCache(const Location &key) const {
+  const auto it = this->branch_insn_cache.find(key);
+  if (it == this->branch_insn_cache.end()) {
+    return std::nullopt;
+  }
+  return it->second;
+}
+
+std::size_t Cache::addBranchInsnCache(const Location &key,
+                                      const BranchInsnCacheEntry &entry) {
+  const std::size_t index = this->branch_insns.size();
+  this->branch_insns.emplace_back(entry);
+  this->branch_insn_cache.emplace(key, index);
+  return index;
+}
+
+std::optional<BranchInsn>
+Cache::findBlockInterval(const Location &location) const {
+  const auto it = this->block_intervals.find(location.id);
+  if (it == this->block_intervals.end()) {
+    return std::nullopt;
+  }
+
+  // The first interval that ends at or after the offset.
+  const auto interval = it->second.lower_bound(location.offset);
+  if (interval == it->second.end() or
+      interval->second.start_offset > location.offset or
+      (location.offset - interval->second.start_offset) % A64_INSN_SIZE != 0) {
+    return std::nullopt;
+  }
+  return interval->second.insn;
 }
 
-bool Cache::isCachedBranchInsn(const Location &key) const {
-  return this->branch_insn_cache.count(key) > 0;
+void Cache::addBlockInterval(const Location &location, const BranchInsn &insn) {
+  std::pmr::map<addr_t, BlockInterval> &intervals =
+      this->block_intervals[location.id];
+  const auto [it, inserted] =
+      intervals.emplace(insn.offset, BlockInterval{location.offset, insn});
+  // A scan from an earlier offset extends the interval.
+  if (not inserted and location.offset < it->second.start_offset) {
+    it->second.start_offset = location.offset;
+  }
 }
 
-AtomTrace Cache::getTraceCache(const TraceKey &key) const {
-  return this->trace_cache.at(key);
+const AtomTrace *Cache::findTraceCache(const TraceKey &key) const {
+  const auto it = this->trace_cache.find(key);
+  if (it == this->trace_cache.end()) {
+    return nullptr;
+  }
+  return &it->second;
 }
 
-void Cache::addTraceCache(const TraceKey &key, const AtomTrace &trace) {
-  this->trace_cache.emplace(key, trace);
+void Cache::addTraceCache(const TraceKey &key, AtomTrace &&trace) {
+  this->trace_cache.emplace(key, std::move(trace));
 }
 
-bool Cache::isCachedTrace(const TraceKey &key) const {
-  return this->trace_cache.count(key) > 0;
+void Cache::invalidateIndirectTargetCache() {
+  ++this->indirect_target_generation;
 }
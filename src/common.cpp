@@ -14,8 +14,10 @@ MemoryImage::MemoryImage(std::uint8_t *data, std::size_t data_size,
 MemoryImage::MemoryImage(binary_data_t &&data, image_id_t id)
     : data(std::move(data)), id(id) {}
 
-MemoryMap::MemoryMap(addr_t start_address, addr_t end_address, image_id_t id)
-    : start_address(start_address), end_address(end_address), id(id) {}
+MemoryMap::MemoryMap(addr_t start_address, addr_t end_address, image_id_t id,
+                     const std::string &path)
+    : start_address(start_address), end_address(end_address), id(id),
+      path(path) {}
 
 Location::Location(addr_t offset, image_id_t id) : offset(offset), id(id) {}
 
@@ -32,7 +34,7 @@ std::size_t std::hash<Location>::operator()(const Location &key) const {
 
 std::optional<image_id_t> getImageId(const std::vector<MemoryMap> &memory_maps,
                                      const addr_t address) {
-  for (const MemoryMap memory_map : memory_maps) {
+  for (const MemoryMap &memory_map : memory_maps) {
     if (memory_map.start_address <= address and
         address < memory_map.end_address) {
       return memory_map.id;
@@ -2,6 +2,7 @@
 /* Copyright 2021 Ricerca Security, Inc. All rights reserved. */
 
 #include <cassert>
+#include <cstring>
 #include <iostream>
 #include <optional>
 #include <sstream>
@@ -61,44 +62,9 @@ Packet Decoder::decodePacket() {
     result = this->decodeAddressLong64IS0Packet();
     break;
 
-  // Atom 6 packet header:  0b11000000 - 0b11010100
-  case 0b11000000 ... 0b11010100:
-    result = this->decodeAtomF6Packet();
-    break;
-
-  // Atom 5 packet header: 0b11010101 - 0b11010111
-  case 0b11010101 ... 0b11010111:
-    result = this->decodeAtomF5Packet();
-    break;
-
-  // Atom 2 packet header: 0b110110xx
-  case 0b11011000 ... 0b11011011:
-    result = this->decodeAtomF2Packet();
-    break;
-
-  // Atom 4 packet header: 0b110111xx
-  case 0b11011100 ... 0b11011111:
-    result = this->decodeAtomF4Packet();
-    break;
-
-  // Atom 6 packet header: 0b11100000 - 0b11110100
-  case 0b11100000 ... 0b11110100:
-    result = this->decodeAtomF6Packet();
-    break;
-
-  // Atom 5 packet header: 0b11110101
-  case 0b11110101:
-    result = this->decodeAtomF5Packet();
-    break;
-
-  // Atom 1 packet header: 0b1111011x
-  case 0b11110110 ... 0b11110111:
-    result = this->decodeAtomF1Packet();
-    break;
-
-  // Atom 3 packet header: 0b11111xxx
-  case 0b11111000 ... 0b11111111:
-    result = this->decodeAtomF3Packet();
+  // Atom packet header: 0b11xxxxxx
+  case 0b11000000 ... 0b11111111:
+    result = this->decodeAtomPacket();
     break;
 
   default:
@@ -106,13 +72,49 @@ Packet Decoder::decodePacket() {
     break;
   }
 
+  if (result.type == PacketType::PKT_UNKNOWN) {
+    this->is_synced = false;
+  }
   return result;
 }
 
+bool Decoder::sync() {
+  static constexpr std::uint8_t zeros[ASYNC_PACKET_SIZE - 1] = {};
+
+  // The last byte 0x80 is rare in the run of zeros, so memchr finds the
+  // candidates, and the zeros before them are compared.
+  const std::uint8_t *data = this->trace_data.data();
+  const std::size_t size = this->trace_data.size();
+  std::size_t offset = this->trace_data_offset + ASYNC_PACKET_SIZE - 1;
+  while (offset < size) {
+    const void *found = std::memchr(data + offset, 0x80, size - offset);
+    if (found == nullptr) {
+      break;
+    }
+    offset = static_cast<const std::uint8_t *>(found) - data;
+    if (std::memcmp(data + offset - (ASYNC_PACKET_SIZE - 1), zeros,
+                    sizeof(zeros)) == 0) {
+      this->trace_data_offset = offset - (ASYNC_PACKET_SIZE - 1);
+      this->is_synced = true;
+      return true;
+    }
+    ++offset;
+  }
+
+  if (size >= this->trace_data_offset + ASYNC_PACKET_SIZE) {
+    this->trace_data_offset = size - (ASYNC_PACKET_SIZE - 1);
+  }
+  return false;
+}
+
 void Decoder::reset() {
-  this->trace_data = std::vector<std::uint8_t>();
+  this->trace_data =
+      decltype(this->trace_data)(this->trace_data.get_allocator());
   this->trace_data_offset = 0;
   this->state = DecodeState::START;
+  this->is_synced = false;
+  this->context_id = std::nullopt;
+  this->vmid = 0;
 }
 
 Packet Decoder::decodeExtensionPacket() {
@@ -130,24 +132,25 @@ Packet Decoder::decodeExtensionPacket() {
   }
 
   // Header is correct, but packet size is incomplete.
-  if (rest_data_size < 12) {
+  if (rest_data_size < ASYNC_PACKET_SIZE) {
     return Packet{PacketType::PKT_INCOMPLETE, rest_data_size, 0, 0, 0};
   }
 
   // Check Async packet
   bool is_async = true;
-  for (std::size_t i = 0; i <= 10; i++) {
+  for (std::size_t i = 0; i < ASYNC_PACKET_SIZE - 1; i++) {
     if (this->trace_data[this->trace_data_offset + i] != 0) {
       is_async = false;
     }
   }
-  if (this->trace_data[this->trace_data_offset + 11] != 0x80) {
+  if (this->trace_data[this->trace_data_offset + ASYNC_PACKET_SIZE - 1] !=
+      0x80) {
     is_async = false;
   }
 
   const PacketType type =
       is_async ? PacketType::ETM4_PKT_I_ASYNC : PacketType::PKT_UNKNOWN;
-  const std::size_t size = is_async ? 12 : 1;
+  const std::size_t size = is_async ? ASYNC_PACKET_SIZE : 1;
 
   Packet packet = {type, size, 0, 0, 0};
   return packet;
@@ -233,6 +236,8 @@ Packet Decoder::decodeContextPacket() {
     return Packet{PacketType::PKT_INCOMPLETE, rest_data_size, 0, 0, 0};
   }
 
+  decodeContextSections(this->trace_data_offset + 1);
+
   const Packet packet = {
       PacketType::ETM4_PKT_I_CTXT, packet_size, 0, 0, 0,
   };
@@ -364,129 +369,42 @@ Packet Decoder::decodeAddressLong64IS0WithContextPacket() {
   }
 
   address_reg = address;
+  decodeContextSections(this->trace_data_offset + 9);
 
   const Packet packet = {PacketType::ETM4_PKT_I_ADDR_CTXT_L_64IS0,
                          9 + context_packet_size, 0, 0, address};
   return packet;
 }
 
-Packet Decoder::decodeAtomF1Packet() {
-  const std::uint8_t data = this->trace_data[this->trace_data_offset];
-
-  const std::uint32_t en_bits = data & 0b1; // 1x (E or N)
-  const std::size_t en_bits_len = 1;
-
-  Packet packet = {PacketType::ETM4_PKT_I_ATOM_F1, 1, en_bits, en_bits_len, 0};
-  return packet;
-}
-
-Packet Decoder::decodeAtomF2Packet() {
-  const std::uint8_t data = this->trace_data[this->trace_data_offset];
-
-  const std::uint32_t en_bits = data & 0b11; // 2x (E or N)
-  const std::size_t en_bits_len = 2;
-
-  Packet packet = {
-      PacketType::ETM4_PKT_I_ATOM_F2, 1, en_bits, en_bits_len, 0,
-  };
-  return packet;
-}
-
-Packet Decoder::decodeAtomF3Packet() {
-  const std::uint8_t data = this->trace_data[this->trace_data_offset];
-
-  const std::uint32_t en_bits = data & 0b111; // 3x (E or N)
-  const std::size_t en_bits_len = 3;
+// Reads the VMID and Context ID sections following the information byte of a
+// context payload. The sections that are not present keep their values.
+void Decoder::decodeContextSections(std::size_t info_offset) {
+  const std::uint8_t info = this->trace_data[info_offset];
+  std::size_t offset = info_offset + 1;
 
-  Packet packet = {
-      PacketType::ETM4_PKT_I_ATOM_F3, 1, en_bits, en_bits_len, 0,
-  };
-  return packet;
-}
-
-Packet Decoder::decodeAtomF4Packet() {
-  const std::uint8_t data = this->trace_data[this->trace_data_offset];
-
-  static const std::uint32_t f4_patterns[] = {
-      0b1110, // EEEN
-      0b0000, // NNNN
-      0b1010, // ENEN
-      0b0101  // NENE
-  };
-
-  const std::uint32_t en_bits = f4_patterns[data & 0b11]; // 4 atom pattern
-  const std::size_t en_bits_len = 4;
-
-  Packet packet = {
-      PacketType::ETM4_PKT_I_ATOM_F4, 1, en_bits, en_bits_len, 0,
+  const auto read32 = [&]() {
+    std::uint32_t value = 0;
+    for (std::size_t i = 0; i < 4; ++i) {
+      value |= (std::uint32_t)this->trace_data[offset + i] << (i * 8);
+    }
+    offset += 4;
+    return value;
   };
-  return packet;
-}
-
-Packet Decoder::decodeAtomF5Packet() {
-  const std::uint8_t data = this->trace_data[this->trace_data_offset];
-  const std::uint8_t pattern_idx = ((data & 0b00100000) >> 3) | (data & 0b11);
 
-  std::uint32_t en_bits = 0;
-  std::size_t en_bits_len = 0;
-  PacketType type = PacketType::ETM4_PKT_I_ATOM_F5;
-
-  switch (pattern_idx) {
-  case 0b101:
-    // 5 atom pattern EEEEN
-    en_bits = 0b11110;
-    en_bits_len = 5;
-    break;
-
-  case 0b001:
-    // 5 atom pattern NNNNN
-    en_bits = 0;
-    en_bits_len = 5;
-    break;
-
-  case 0b010:
-    // 5 atom pattern NENEN
-    en_bits = 0b01010;
-    en_bits_len = 5;
-    break;
-
-  case 0b011:
-    // 5 atom pattern ENENE
-    en_bits = 0b10101;
-    en_bits_len = 5;
-    break;
-
-  default:
-    type = PacketType::PKT_UNKNOWN;
-    en_bits = 0;
-    en_bits_len = 0;
-    break;
+  if (info & 0b01000000) {
+    this->vmid = read32();
   }
-
-  Packet packet = {
-      type, 1, en_bits, en_bits_len, 0,
-  };
-
-  return packet;
-}
-
-Packet Decoder::decodeAtomF6Packet() {
-  const std::uint8_t data = this->trace_data[trace_data_offset];
-
-  std::size_t e_cnt = (data & 0b11111) + 3; // count of E's
-  std::uint32_t en_bits =
-      ((std::uint32_t)0x1 << e_cnt) - 1; // set pattern to string of E's
-
-  // Check if the last branch is E.
-  if ((data & 0b100000) == 0x00) {
-    en_bits |= ((std::uint32_t)0x1 << e_cnt);
+  if (info & 0b10000000) {
+    this->context_id = read32();
   }
+}
 
-  const std::size_t en_bits_len = e_cnt + 1;
-  assert(4 <= en_bits_len and en_bits_len <= 24);
+Packet Decoder::decodeAtomPacket() {
+  const AtomFormat &atom =
+      ATOM_FORMATS[this->trace_data[this->trace_data_offset]];
 
   Packet packet = {
-      PacketType::ETM4_PKT_I_ATOM_F6, 1, en_bits, en_bits_len, 0,
+      atom.type, 1, atom.en_bits, atom.en_bits_len, 0,
   };
   return packet;
 }
@@ -20,6 +20,7 @@ cs_insn *disassembleNextBranchInsn(const csh *handle,
                                    const std::uint64_t offset);
 std::uint64_t getAddressFromInsn(const cs_insn *insn);
 BranchType decodeInstOpecode(const cs_insn *insn);
+BranchInsn createBranchInsn(const cs_insn *insn, const image_id_t id);
 
 // According to the Arm Embedded Trace Macrocell Architecture Specification
 // ETMv4.0 to ETMv4.6 F.1 Branch instructions, a list of branch instructions is
@@ -79,6 +80,46 @@ BranchInsn getNextBranchInsn(const csh &handle, const Location &location,
   cs_insn *insn = disassembleNextBranchInsn(
       &handle, memory_images[location.id].data, location.offset);
 
+  const BranchInsn branch_insn = createBranchInsn(insn, location.id);
+
+  // release the cache memory when done
+  cs_free(insn, 1);
+
+  return branch_insn;
+}
+
+// Disassemble the whole memory image linearly and collect all branch
+// instructions. Bytes that cannot be disassembled are skipped one instruction
+// at a time, since an image also contains headers and data.
+std::vector<BranchInsn> getBranchInsns(const csh &handle,
+                                       const MemoryImage &memory_image) {
+  std::vector<BranchInsn> branch_insns;
+
+  const std::uint8_t *code_ptr = memory_image.data.data();
+  std::size_t code_size = memory_image.data.size();
+  std::uint64_t address = 0;
+
+  cs_insn *insn = cs_malloc(handle);
+
+  while (code_size >= A64_INSN_SIZE) {
+    if (not cs_disasm_iter(handle, &code_ptr, &code_size, &address, insn)) {
+      code_ptr += A64_INSN_SIZE;
+      code_size -= A64_INSN_SIZE;
+      address += A64_INSN_SIZE;
+      continue;
+    }
+
+    if (decodeInstOpecode(insn) != BranchType::NOT_BRANCH) {
+      branch_insns.emplace_back(createBranchInsn(insn, memory_image.id));
+    }
+  }
+
+  cs_free(insn, 1);
+
+  return branch_insns;
+}
+
+BranchInsn createBranchInsn(const cs_insn *insn, const image_id_t id) {
   const BranchType type = decodeInstOpecode(insn);
   const addr_t offset = insn->address;
 
@@ -90,12 +131,8 @@ BranchInsn getNextBranchInsn(const csh &handle, const Location &location,
       (type == BranchType::DIRECT_BRANCH) ? offset + insn->size : 0;
 
   const BranchInsn branch_insn{
-      type, offset, taken_offset, not_taken_offset, location.id,
+      type, offset, taken_offset, not_taken_offset, id,
   };
-
-  // release the cache memory when done
-  cs_free(insn, 1);
-
   return branch_insn;
 }
 
@@ -163,7 +200,7 @@ std::uint64_t getAddressFromInsn(const cs_insn *insn) {
   address_index++;
 
   const std::uint64_t address =
-      std::stol(insn->op_str + address_index, nullptr, 16);
+      std::stoul(insn->op_str + address_index, nullptr, 16);
   return address;
 }
 
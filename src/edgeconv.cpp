@@ -0,0 +1,150 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright 2021 Ricerca Security, Inc. All rights reserved. */
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <linux/limits.h>
+#include <vector>
+
+#include "bitmap.hpp"
+#include "common.hpp"
+#include "edgelog.hpp"
+#include "sink.hpp"
+#include "utils.hpp"
+
+void usage(const char *argv0) {
+  std::cerr << "Usage: " << argv0 << " [edge_log_filename] [OPTIONS]"
+            << std::endl
+            << "OPTIONS:" << std::endl
+            << "\t--format={text,bitmap,info} : Specify the output. text "
+               "prints the edges in the same format as --print-edge-cov of "
+               "the processor, bitmap rebuilds the bitmap of all sessions and "
+               "info prints the images and the number of the edges of each "
+               "session. The default is text."
+            << std::endl
+            << "\t--bitmap-size=size        : Specify the bitmap size in "
+               "hexadecimal. The default size is 0x10000."
+            << std::endl
+            << "\t--bitmap-filename=name    : Specify the file name to save "
+               "the bitmap. The default name is edge_coverage_bitmap.out"
+            << std::endl
+            << "\t--bitmap-cell-width={8,16,32} : Specify the width of a "
+               "bitmap cell in bits. The default width is 8."
+            << std::endl
+            << std::endl;
+}
+
+void printSession(const std::size_t session_num,
+                  const std::vector<MemoryMap> &memory_maps,
+                  const std::uint64_t edge_num) {
+  std::cout << std::dec << "session " << session_num << ": " << edge_num
+            << " edges" << std::endl;
+  for (const MemoryMap &memory_map : memory_maps) {
+    std::cout << std::hex << "  [" << memory_map.id << "] 0x"
+              << memory_map.start_address << "-0x" << memory_map.end_address
+              << " " << memory_map.path << std::endl;
+  }
+}
+
+int main(int argc, char const *argv[]) {
+  if (argc < 2) {
+    usage(argv[0]);
+    std::exit(EXIT_FAILURE);
+  }
+
+  const std::string edge_log_filename = argv[1];
+  std::string format = "text";
+  std::uint64_t bitmap_size = BITMAP_SIZE;
+  std::string bitmap_filename = BITMAP_FILENAME;
+  BitmapCellType bitmap_cell_type = BitmapCellType::U8;
+  for (int i = 2; i < argc; ++i) {
+    std::uint64_t size = 0;
+    int width = 0;
+    char buf[PATH_MAX];
+    if (sscanf(argv[i], "--format=%s", buf) == 1) {
+      format = std::string(buf);
+    } else if (sscanf(argv[i], "--bitmap-size=%lx", &size) == 1) {
+      // Check if the size is a power of two.
+      if (!(size && (size & (size - 1)) == 0)) {
+        std::cerr << "The size of the bitmap must be a power of 2."
+                  << std::endl;
+        std::exit(1);
+      }
+      bitmap_size = size;
+    } else if (sscanf(argv[i], "--bitmap-filename=%s", buf) == 1) {
+      bitmap_filename = std::string(buf);
+    } else if (sscanf(argv[i], "--bitmap-cell-width=%d", &width) == 1) {
+      if (width == 8) {
+        bitmap_cell_type = BitmapCellType::U8;
+      } else if (width == 16) {
+        bitmap_cell_type = BitmapCellType::U16;
+      } else if (width == 32) {
+        bitmap_cell_type = BitmapCellType::U32;
+      } else {
+        std::cerr << "The width of a bitmap cell must be 8, 16 or 32."
+                  << std::endl;
+        std::exit(1);
+      }
+    } else {
+      std::cerr << "Invalid option: " << argv[i] << std::endl;
+      std::exit(1);
+    }
+  }
+
+  std::ifstream stream(edge_log_filename, std::ios::in | std::ios::binary);
+  if (not stream) {
+    std::cerr << "Failed to open the edge log: " << edge_log_filename
+              << std::endl;
+    std::exit(1);
+  }
+  EdgeLogReader reader(stream);
+
+  if (format == "text") {
+    EdgeListSink sink(&std::cout);
+    while (const std::optional<Edge> edge = reader.readEdge()) {
+      sink.addEdge(edge->from_location, edge->to_location);
+    }
+    sink.flush();
+  } else if (format == "bitmap") {
+    // The edges of all sessions are accumulated into a single bitmap.
+    std::vector<std::uint8_t> data(bitmap_size *
+                                   getBitmapCellSize(bitmap_cell_type));
+    const Bitmap bitmap(data.data(), bitmap_size, bitmap_cell_type);
+    while (const std::optional<Edge> edge = reader.readEdge()) {
+      bitmap.writeKey(generateBitmapKey(edge->from_location,
+                                        edge->to_location, bitmap_size));
+    }
+    writeBinaryFile(data, bitmap_filename);
+  } else if (format == "info") {
+    // The sessions without edges are not printed.
+    std::size_t session_num = 0;
+    std::vector<MemoryMap> memory_maps;
+    std::uint64_t edge_num = 0;
+    while (reader.readEdge().has_value()) {
+      if (reader.session_num != session_num) {
+        if (session_num != 0) {
+          printSession(session_num, memory_maps, edge_num);
+        }
+        session_num = reader.session_num;
+        memory_maps = std::vector<MemoryMap>(reader.memory_maps);
+        edge_num = 0;
+      }
+      ++edge_num;
+    }
+    if (session_num != 0) {
+      printSession(session_num, memory_maps, edge_num);
+    }
+  } else {
+    std::cerr << "Invalid format: " << format << std::endl;
+    std::exit(1);
+  }
+
+  if (reader.failed) {
+    std::cerr << "The edge log is broken." << std::endl;
+    std::exit(1);
+  }
+
+  return 0;
+}
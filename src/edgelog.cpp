@@ -0,0 +1,189 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright 2021 Ricerca Security, Inc. All rights reserved. */
+
+#include <cstring>
+#include <iostream>
+
+#include "edgelog.hpp"
+
+void appendEdgeLogHeader(binary_data_t &buffer) {
+  buffer.insert(buffer.end(), EDGE_LOG_MAGIC,
+                EDGE_LOG_MAGIC + sizeof(EDGE_LOG_MAGIC));
+  appendVarint(buffer, EDGE_LOG_VERSION);
+}
+
+void appendEdgeLogImages(binary_data_t &buffer,
+                         const std::vector<MemoryMap> &memory_maps) {
+  buffer.push_back(static_cast<std::uint8_t>(EdgeLogRecordType::IMAGES));
+  appendVarint(buffer, memory_maps.size());
+  for (const MemoryMap &memory_map : memory_maps) {
+    appendVarint(buffer, memory_map.start_address);
+    appendVarint(buffer, memory_map.end_address);
+    appendVarint(buffer, memory_map.path.size());
+    buffer.insert(buffer.end(), memory_map.path.begin(),
+                  memory_map.path.end());
+  }
+}
+
+EdgeLogReader::EdgeLogReader(std::istream &stream)
+    : stream(stream), session_num(0), failed(false), block_offset(0),
+      remaining_edge_num(0), prev_location(0, 0) {
+  char magic[sizeof(EDGE_LOG_MAGIC)];
+  if (not this->stream.read(magic, sizeof(magic)) or
+      std::memcmp(magic, EDGE_LOG_MAGIC, sizeof(magic)) != 0) {
+    std::cerr << "Not an edge log." << std::endl;
+    this->failed = true;
+    return;
+  }
+
+  const std::optional<std::uint64_t> version = readStreamVarint();
+  if (version != EDGE_LOG_VERSION) {
+    std::cerr << "Unsupported edge log version." << std::endl;
+    this->failed = true;
+  }
+}
+
+std::optional<Edge> EdgeLogReader::readEdge() {
+  while (this->remaining_edge_num == 0) {
+    if (this->failed or not readRecord()) {
+      return std::nullopt;
+    }
+  }
+
+  const std::optional<std::uint64_t> head = readBlockVarint();
+  if (not head.has_value()) {
+    return std::nullopt;
+  }
+
+  Location src_location(decodeZigzag(this->prev_location.offset, *head >> 2),
+                        this->prev_location.id);
+  if (*head & 2) {
+    const std::optional<std::uint64_t> id = readBlockVarint();
+    if (not id.has_value()) {
+      return std::nullopt;
+    }
+    src_location.id = *id;
+  }
+
+  const std::optional<std::uint64_t> dest = readBlockVarint();
+  if (not dest.has_value()) {
+    return std::nullopt;
+  }
+  Location dest_location(decodeZigzag(src_location.offset, *dest),
+                         src_location.id);
+  if (*head & 1) {
+    const std::optional<std::uint64_t> id = readBlockVarint();
+    if (not id.has_value()) {
+      return std::nullopt;
+    }
+    dest_location.id = *id;
+  }
+
+  --this->remaining_edge_num;
+  this->prev_location = dest_location;
+  return Edge(src_location, dest_location);
+}
+
+bool EdgeLogReader::readRecord() {
+  const int type = this->stream.get();
+  if (type == std::char_traits<char>::eof()) {
+    return false;
+  }
+
+  switch (static_cast<EdgeLogRecordType>(type)) {
+  case EdgeLogRecordType::IMAGES:
+    return readImages();
+
+  case EdgeLogRecordType::EDGES: {
+    const std::optional<std::uint64_t> edge_num = readStreamVarint();
+    const std::optional<std::uint64_t> byte_size = readStreamVarint();
+    if (not edge_num.has_value() or not byte_size.has_value()) {
+      return false;
+    }
+    if (this->memory_maps.empty()) {
+      std::cerr << "The edge log has edges before the images." << std::endl;
+      this->failed = true;
+      return false;
+    }
+
+    this->block.resize(*byte_size);
+    if (not this->stream.read(reinterpret_cast<char *>(this->block.data()),
+                              *byte_size)) {
+      return false;
+    }
+    this->block_offset = 0;
+    this->remaining_edge_num = *edge_num;
+    return true;
+  }
+
+  default:
+    std::cerr << "Unknown edge log record: " << type << std::endl;
+    this->failed = true;
+    return false;
+  }
+}
+
+bool EdgeLogReader::readImages() {
+  const std::optional<std::uint64_t> image_num = readStreamVarint();
+  if (not image_num.has_value()) {
+    return false;
+  }
+
+  std::vector<MemoryMap> memory_maps;
+  for (std::uint64_t id = 0; id < *image_num; ++id) {
+    const std::optional<std::uint64_t> start_address = readStreamVarint();
+    const std::optional<std::uint64_t> end_address = readStreamVarint();
+    const std::optional<std::uint64_t> path_len = readStreamVarint();
+    if (not start_address.has_value() or not end_address.has_value() or
+        not path_len.has_value()) {
+      return false;
+    }
+
+    std::string path(*path_len, '\0');
+    if (not this->stream.read(path.data(), *path_len)) {
+      return false;
+    }
+    memory_maps.emplace_back(*start_address, *end_address, id, path);
+  }
+
+  this->memory_maps = std::move(memory_maps);
+  this->prev_location = Location(0, 0);
+  ++this->session_num;
+  return true;
+}
+
+std::optional<std::uint64_t> EdgeLogReader::readStreamVarint() {
+  std::uint64_t value = 0;
+  for (std::size_t i = 0; i < MAX_VARINT_SIZE; ++i) {
+    const int byte = this->stream.get();
+    if (byte == std::char_traits<char>::eof()) {
+      return std::nullopt;
+    }
+    value |= static_cast<std::uint64_t>(byte & 0x7f) << (7 * i);
+    if ((byte & 0x80) == 0) {
+      return value;
+    }
+  }
+
+  std::cerr << "Invalid varint in the edge log." << std::endl;
+  this->failed = true;
+  return std::nullopt;
+}
+
+std::optional<std::uint64_t> EdgeLogReader::readBlockVarint() {
+  std::uint64_t value = 0;
+  for (std::size_t i = 0; i < MAX_VARINT_SIZE; ++i) {
+    if (this->block_offset >= this->block.size()) {
+      break;
+    }
+    const std::uint8_t byte = this->block[this->block_offset++];
+    value |= static_cast<std::uint64_t>(byte & 0x7f) << (7 * i);
+    if ((byte & 0x80) == 0) {
+      return value;
+    }
+  }
+
+  std::cerr << "Invalid edge in the edge log." << std::endl;
+  this->failed = true;
+  return std::nullopt;
+}
@@ -0,0 +1,103 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright 2021 Ricerca Security, Inc. All rights reserved. */
+
+#include <cassert>
+#include <limits>
+
+#include "disassembler.hpp"
+#include "edgemap.hpp"
+
+// Instructions are 4-byte aligned, so the table is indexed by offset / 4.
+static const std::size_t INSN_OFFSET_SHIFT = 2;
+static const std::uint32_t NO_EDGE_KEY =
+    std::numeric_limits<std::uint32_t>::max();
+
+Edge::Edge(const Location &from_location, const Location &to_location)
+    : from_location(from_location), to_location(to_location) {}
+
+bool Edge::operator==(const Edge &right) const {
+  return this->from_location == right.from_location and
+         this->to_location == right.to_location;
+}
+
+std::size_t std::hash<Edge>::operator()(const Edge &key) const {
+  const std::size_t h1 = std::hash<Location>()(key.from_location);
+  const std::size_t h2 = std::hash<Location>()(key.to_location);
+
+  return h1 ^ (h2 << 1U);
+}
+
+EdgeMap::EdgeMap(const std::vector<MemoryImage> &memory_images)
+    : static_edge_num(0), edge_num(0) {
+  csh handle;
+  disassembleInit(&handle);
+
+  for (const MemoryImage &memory_image : memory_images) {
+    std::vector<std::uint32_t> keys(
+        (memory_image.data.size() >> INSN_OFFSET_SHIFT) + 1, NO_EDGE_KEY);
+
+    // Each direct branch instruction has two outgoing edges, taken and
+    // not-taken.
+    for (const BranchInsn &insn : getBranchInsns(handle, memory_image)) {
+      if (insn.type == BranchType::INDIRECT_BRANCH) {
+        continue;
+      }
+      keys[insn.offset >> INSN_OFFSET_SHIFT] = this->edge_num;
+      this->edge_num += 2;
+    }
+
+    this->direct_edge_keys.emplace_back(std::move(keys));
+  }
+
+  this->static_edge_num = this->edge_num;
+
+  disassembleDelete(&handle);
+}
+
+std::size_t EdgeMap::getDirectEdgeKey(const BranchInsn &insn,
+                                      const bool is_taken,
+                                      const std::size_t bitmap_size) {
+  const std::uint32_t key =
+      this->direct_edge_keys[insn.id][insn.offset >> INSN_OFFSET_SHIFT];
+
+  // The branch instruction was not found by the linear disassembly, e.g. when
+  // the instruction is not aligned. Fall back to a key assigned on first
+  // sight.
+  if (key == NO_EDGE_KEY) {
+    const Location from_location(insn.offset, insn.id);
+    const Location to_location(
+        is_taken ? insn.taken_offset : insn.not_taken_offset, insn.id);
+    return getDynamicEdgeKey(from_location, to_location, bitmap_size);
+  }
+
+  return is_taken ? key : key + 1;
+}
+
+std::size_t EdgeMap::getDynamicEdgeKey(const Location &from_location,
+                                       const Location &to_location,
+                                       const std::size_t bitmap_size) {
+  const Edge edge(from_location, to_location);
+
+  const auto it = this->dynamic_edge_keys.find(edge);
+  if (it != this->dynamic_edge_keys.end()) {
+    return it->second;
+  }
+
+  const std::size_t key = assignEdgeKey(bitmap_size);
+  this->dynamic_edge_keys.emplace(edge, key);
+  return key;
+}
+
+std::size_t EdgeMap::assignEdgeKey(const std::size_t bitmap_size) {
+  assert(this->static_edge_num < bitmap_size);
+
+  const std::size_t key = this->edge_num++;
+  if (key < bitmap_size) {
+    return key;
+  }
+
+  // The bitmap is full. The edges found from now on share the keys that are
+  // not used by the direct edges.
+  return this->static_edge_num +
+         (key - this->static_edge_num) % (bitmap_size - this->static_edge_num);
+}
@@ -5,29 +5,92 @@
 /* Copyright 2021 Ricerca Security, Inc. All rights reserved. */
 
 #include <cassert>
+#include <cstddef>
 #include <cstdint>
 #include <cstring>
+#include <fstream>
 #include <iostream>
 #include <memory>
+#include <optional>
 #include <unordered_map>
 #include <vector>
 
+#include "async.hpp"
 #include "bitmap.hpp"
 #include "cache.hpp"
 #include "common.hpp"
 #include "decoder.hpp"
 #include "deformatter.hpp"
 #include "disassembler.hpp"
+#include "edgemap.hpp"
 #include "process.hpp"
+#include "sink.hpp"
+#include "stats.hpp"
+#include "tracepack.hpp"
 #include "utils.hpp"
 
 #include "libcsdec.h"
 
 libcsdec_result_t covert_result_type(ProcessResultType result);
+BitmapCellType convert_bitmap_cell_type(libcsdec_bitmap_cell_t cell_type);
+ProcessOptions convert_options(const struct libcsdec_options *options);
+std::vector<MemoryImage> create_memory_images(
+    int memory_image_num,
+    const struct libcsdec_memory_image libcsdec_memory_image[]);
+std::vector<MemoryMap>
+create_memory_maps(int memory_map_num,
+                   const struct libcsdec_memory_map libcsdec_memory_map[]);
+void convert_stats(const Stats &stats, struct libcsdec_stats *libcsdec_stats);
+libcsdec_result_t set_context_filter(Decoder &decoder, uint64_t context_id);
+template <typename P>
+libcsdec_result_t run_trace_pack(P *process, const void *pack_addr,
+                                 size_t pack_size);
+
+static_assert(LIBCSDEC_PACKET_TYPE_NUM == PACKET_TYPE_NUM,
+              "libcsdec_packet_type_t must match PacketType.");
+static_assert(LIBCSDEC_SINK_BITMAP == SINK_BITMAP and
+                  LIBCSDEC_SINK_EDGE_LIST == SINK_EDGE_LIST and
+                  LIBCSDEC_SINK_EDGE_CALLBACK == SINK_EDGE_CALLBACK and
+                  LIBCSDEC_SINK_EDGE_LOG == SINK_EDGE_LOG and
+                  LIBCSDEC_SINK_PATH_BITMAP == SINK_PATH_BITMAP and
+                  LIBCSDEC_SINK_EDGE_PROFILE == SINK_EDGE_PROFILE,
+              "libcsdec_sink_t must match OutputSinks.");
+static_assert(sizeof(struct libcsdec_edge) == sizeof(Edge) and
+                  offsetof(struct libcsdec_edge, src_offset) ==
+                      offsetof(Edge, from_location.offset) and
+                  offsetof(struct libcsdec_edge, src_image) ==
+                      offsetof(Edge, from_location.id) and
+                  offsetof(struct libcsdec_edge, dest_offset) ==
+                      offsetof(Edge, to_location.offset) and
+                  offsetof(struct libcsdec_edge, dest_image) ==
+                      offsetof(Edge, to_location.id),
+              "struct libcsdec_edge must match Edge.");
+
+/**
+    Fills the options with the default values: 8-bit bitmap cells, hashed
+    bitmap keys, the trace cache, 4096 atoms, the bitmap as the only output,
+    no trace memo and no huge pages.
+
+    @param  options                                 The options to initialize.
+**/
+void libcsdec_default_options(struct libcsdec_options *options) {
+  options->cell_type = LIBCSDEC_BITMAP_CELL_8BIT;
+  options->bitmap_key = LIBCSDEC_BITMAP_KEY_HASH;
+  options->cache_mode = LIBCSDEC_CACHE_TRACE;
+  options->max_atom_len = MAX_ATOM_LEN;
+  options->sinks = LIBCSDEC_SINK_BITMAP;
+  options->edge_callback = nullptr;
+  options->edge_callback_data = nullptr;
+  options->edge_log_filename = nullptr;
+  options->path_bitmap_addr = nullptr;
+  options->path_bitmap_size = 0;
+  options->trace_memo_size = 0;
+  options->huge_pages = 0;
+}
 
 /**
     Initializes persistent objects for edge coverage mode and returns the
-    pointer.
+    pointer. The bitmap consists of 8-bit counters.
 
     @param  bitmap_addr                             The bitmap address.
     @param  bitmap_size                             The size of the bitmap.
@@ -40,27 +103,180 @@ libcsdec_result_t covert_result_type(ProcessResultType result);
                                                     used by libcsdec.
 **/
 libcsdec_t
-libcsdec_init_edge(void *bitmap_addr, const int bitmap_size,
+libcsdec_init_edge(void *bitmap_addr, const size_t bitmap_size,
                    int memory_image_num,
                    const struct libcsdec_memory_image libcsdec_memory_image[]) {
+  return libcsdec_init_edge_ex(bitmap_addr, bitmap_size,
+                               LIBCSDEC_BITMAP_CELL_8BIT, memory_image_num,
+                               libcsdec_memory_image);
+}
+
+/**
+    Initializes persistent objects for edge coverage mode with the specified
+    bitmap cell width and returns the pointer.
+
+    @param  bitmap_addr                             The bitmap address.
+    @param  bitmap_size                             The number of the bitmap
+                                                    cells. The bitmap must be
+                                                    bitmap_size * cell width
+                                                    bytes long.
+    @param  cell_type                               The width of a bitmap cell.
+    @param  memory_image_num                        The number of the memory
+                                                    image entries.
+    @param  libcsdec_memory_image                   The array of all traced
+                                                    memory image data.
+
+    @return                                         The pointer to the object
+                                                    used by libcsdec.
+**/
+libcsdec_t libcsdec_init_edge_ex(
+    void *bitmap_addr, const size_t bitmap_size,
+    const libcsdec_bitmap_cell_t cell_type, int memory_image_num,
+    const struct libcsdec_memory_image libcsdec_memory_image[]) {
+  struct libcsdec_options options;
+  libcsdec_default_options(&options);
+  options.cell_type = cell_type;
+  return libcsdec_init_edge_opts(bitmap_addr, bitmap_size, memory_image_num,
+                                 libcsdec_memory_image, &options);
+}
+
+/**
+    Counts the edges of all direct branches in the memory images. The bitmap
+    passed to libcsdec_init_edge_id must be larger than this number. Note that
+    this function disassembles all memory images.
+
+    @param  memory_image_num                        The number of the memory
+                                                    image entries.
+    @param  libcsdec_memory_image                   The array of all traced
+                                                    memory image data.
+
+    @return                                         The number of the edges.
+**/
+size_t libcsdec_count_static_edges(
+    int memory_image_num,
+    const struct libcsdec_memory_image libcsdec_memory_image[]) {
   checkCapstoneVersion();
 
-  std::vector<MemoryImage> memory_images;
-  {
-    for (int id = 0; id < memory_image_num; ++id) {
-      std::vector<std::uint8_t> data(
-          reinterpret_cast<std::uint8_t *>(libcsdec_memory_image[id].data) + 0,
-          reinterpret_cast<std::uint8_t *>(libcsdec_memory_image[id].data) +
-              libcsdec_memory_image[id].size);
-      memory_images.emplace_back(MemoryImage(std::move(data), id));
+  const std::vector<MemoryImage> memory_images =
+      create_memory_images(memory_image_num, libcsdec_memory_image);
+
+  return EdgeMap(memory_images).static_edge_num;
+}
+
+/**
+    Initializes persistent objects for edge coverage mode with collision-free
+    bitmap keys and returns the pointer. The edges of all direct branches are
+    assigned unique keys ahead of time, and the edges of indirect branches are
+    assigned unique keys on first sight. The bitmap size need not be a power
+    of 2.
+
+    @param  bitmap_addr                             The bitmap address.
+    @param  bitmap_size                             The number of the bitmap
+                                                    cells. It must be larger
+                                                    than the number of the
+                                                    static edges. The remaining
+                                                    cells are used for the
+                                                    indirect edges.
+    @param  cell_type                               The width of a bitmap cell.
+    @param  memory_image_num                        The number of the memory
+                                                    image entries.
+    @param  libcsdec_memory_image                   The array of all traced
+                                                    memory image data.
+
+    @return                                         The pointer to the object
+                                                    used by libcsdec, or NULL
+                                                    if the bitmap is too small.
+**/
+libcsdec_t libcsdec_init_edge_id(
+    void *bitmap_addr, const size_t bitmap_size,
+    const libcsdec_bitmap_cell_t cell_type, int memory_image_num,
+    const struct libcsdec_memory_image libcsdec_memory_image[]) {
+  struct libcsdec_options options;
+  libcsdec_default_options(&options);
+  options.cell_type = cell_type;
+  options.bitmap_key = LIBCSDEC_BITMAP_KEY_ID;
+  return libcsdec_init_edge_opts(bitmap_addr, bitmap_size, memory_image_num,
+                                 libcsdec_memory_image, &options);
+}
+
+/**
+    Initializes persistent objects for edge coverage mode with the specified
+    options and returns the pointer. The decoding loop is specialized for the
+    cache mode and the outputs, so the options cost no throughput. With
+    LIBCSDEC_SINK_PATH_BITMAP, the path coverage is calculated in the same
+    pass, and the trace data is deformatted and decoded once for both bitmaps.
+
+    @param  bitmap_addr                             The bitmap address.
+    @param  bitmap_size                             The number of the bitmap
+                                                    cells. With the unique
+                                                    bitmap keys, it must be
+                                                    larger than the number of
+                                                    the static edges.
+    @param  memory_image_num                        The number of the memory
+                                                    image entries.
+    @param  libcsdec_memory_image                   The array of all traced
+                                                    memory image data.
+    @param  options                                 The decoder options.
+
+    @return                                         The pointer to the object
+                                                    used by libcsdec, or NULL
+                                                    if the bitmap is too small,
+                                                    the outputs are invalid,
+                                                    the path coverage bitmap is
+                                                    missing, the trace memo is
+                                                    used with other outputs or
+                                                    the edge log cannot be
+                                                    opened.
+**/
+libcsdec_t libcsdec_init_edge_opts(
+    void *bitmap_addr, const size_t bitmap_size, int memory_image_num,
+    const struct libcsdec_memory_image libcsdec_memory_image[],
+    const struct libcsdec_options *options) {
+  checkCapstoneVersion();
+
+  if (options->sinks >= SINK_COMBINATION_NUM) {
+    std::cerr << "Invalid outputs: " << options->sinks << std::endl;
+    return nullptr;
+  }
+  if ((options->sinks & LIBCSDEC_SINK_PATH_BITMAP) and
+      options->path_bitmap_addr == nullptr) {
+    std::cerr << "The path coverage bitmap is not specified." << std::endl;
+    return nullptr;
+  }
+  if (options->trace_memo_size != 0 and
+      options->sinks != LIBCSDEC_SINK_BITMAP) {
+    std::cerr << "The trace memo needs the bitmap as the only output."
+              << std::endl;
+    return nullptr;
+  }
+
+  std::vector<MemoryImage> memory_images =
+      create_memory_images(memory_image_num, libcsdec_memory_image);
+
+  std::optional<EdgeMap> edge_map;
+  if (options->bitmap_key == LIBCSDEC_BITMAP_KEY_ID) {
+    edge_map.emplace(memory_images);
+    if (bitmap_size <= edge_map->static_edge_num) {
+      std::cerr
+          << "The bitmap must be larger than the number of static edges: "
+          << edge_map->static_edge_num << std::endl;
+      return nullptr;
     }
   }
 
   std::unique_ptr<Process> process = std::make_unique<Process>(
       std::move(memory_images),
       Bitmap(reinterpret_cast<std::uint8_t *>(bitmap_addr),
-             static_cast<std::size_t>(bitmap_size)),
-      Cache());
+             static_cast<std::size_t>(bitmap_size),
+             convert_bitmap_cell_type(options->cell_type)),
+      Cache(options->huge_pages != 0), std::move(edge_map),
+      convert_options(options));
+
+  if ((options->sinks & LIBCSDEC_SINK_EDGE_LOG) and
+      not process->edge_log_sink.stream.is_open()) {
+    std::cerr << "Failed to open the edge log." << std::endl;
+    return nullptr;
+  }
 
   // Release ownership and pass it to the C API side.
   // Therefore, do not free it here.
@@ -94,15 +310,94 @@ libcsdec_reset_edge(const libcsdec_t libcsdec, const char trace_id,
 
   auto process = reinterpret_cast<Process *>(libcsdec);
 
-  std::vector<MemoryMap> memory_maps;
-  {
-    for (int id = 0; id < memory_map_num; id++) {
-      memory_maps.emplace_back(MemoryMap(libcsdec_memory_map[id].start,
-                                         libcsdec_memory_map[id].end, id));
-    }
+  process->reset(create_memory_maps(memory_map_num, libcsdec_memory_map),
+                 trace_id);
+  return LIBCSDEC_SUCCESS;
+}
+
+/**
+    Filters the trace by the context ID for edge coverage mode. Only the trace
+    of the context ID, e.g. the PID of the target in a CPU-wide trace, is
+    decoded, and the trace of the other contexts is skipped without
+    disassembling. The trace unit must trace the context IDs. The filter is
+    kept over the decoding sessions, and must not be changed while the
+    sessions submitted to the background decoder are running.
+
+    @param  libcsdec                                The decoding session
+                                                    context.
+    @param  context_id                              The context ID, or
+                                                    LIBCSDEC_CONTEXT_ID_ANY to
+                                                    decode all contexts.
+
+    @retval LIBCSDEC_SUCCESS                        Succeeded.
+    @retval LIBCSDEC_ERROR                          Invalid context ID.
+**/
+libcsdec_result_t libcsdec_filter_context_edge(const libcsdec_t libcsdec,
+                                              const uint64_t context_id) {
+  auto process = reinterpret_cast<Process *>(libcsdec);
+
+  return set_context_filter(process->decoder, context_id);
+}
+
+/**
+    Adds a context decoded into its own bitmap for edge coverage mode. When
+    several targets share the trace stream of a core, e.g. the children of a
+    fork server, one decoding pass calculates the coverage of each of them.
+    The trace of the context ID is decoded with the memory maps into the
+    bitmap, and the rest of the trace is decoded for the target given to
+    libcsdec_reset_edge, subject to libcsdec_filter_context_edge. The memory
+    images and the caches are shared. The bitmap has the same size and cell
+    type as the bitmap of the target, and is cleared here. The contexts are
+    dropped by the next libcsdec_reset_edge, so they are added after it in
+    each decoding session. The bitmap must be the only output, and the trace
+    memo is not used for the session.
+
+    @param  libcsdec                                The decoding session
+                                                    context.
+    @param  context_id                              The context ID.
+    @param  bitmap_addr                             The bitmap address of the
+                                                    context.
+    @param  memory_map_num                          The number of the memory map
+                                                    entries.
+    @param  libcsdec_memory_map                     The array of all traced
+                                                    memory map infomation of
+                                                    the context.
+
+    @retval LIBCSDEC_SUCCESS                        Succeeded.
+    @retval LIBCSDEC_ERROR                          Invalid context ID, memory
+                                                    map or outputs, or the
+                                                    context is already added.
+**/
+libcsdec_result_t libcsdec_add_context_edge(
+    const libcsdec_t libcsdec, const uint64_t context_id, void *bitmap_addr,
+    const int memory_map_num,
+    const struct libcsdec_memory_map libcsdec_memory_map[]) {
+  auto process = reinterpret_cast<Process *>(libcsdec);
+
+  if (process->data.options.sinks != SINK_BITMAP) {
+    std::cerr << "The contexts need the bitmap as the only output."
+              << std::endl;
+    return LIBCSDEC_ERROR;
+  }
+  if (context_id > UINT32_MAX) {
+    std::cerr << "The context ID must fit in 32 bits." << std::endl;
+    return LIBCSDEC_ERROR;
+  }
+  if (memory_map_num <= 0) {
+    std::cerr << "Specify 1 or more for the number of memory maps" << std::endl;
+    return LIBCSDEC_ERROR;
   }
 
-  process->reset(std::move(memory_maps), trace_id);
+  const Bitmap bitmap(reinterpret_cast<std::uint8_t *>(bitmap_addr),
+                      process->data.bitmap.size,
+                      process->data.bitmap.cell_type);
+  if (not process->addContextSession(
+          context_id, bitmap,
+          create_memory_maps(memory_map_num, libcsdec_memory_map))) {
+    std::cerr << "The context is already added: " << std::hex << context_id
+              << std::endl;
+    return LIBCSDEC_ERROR;
+  }
   return LIBCSDEC_SUCCESS;
 }
 
@@ -120,9 +415,6 @@ libcsdec_reset_edge(const libcsdec_t libcsdec, const char trace_id,
     @retval LIBCSDEC_ERROR                          Decode failed.
     @retval LIBCSDEC_ERROR_TRACE_DATA_INCOMPLETE    Decode failed due to the
                                                     trace data is incomplete.
-    @retval LIBCSDEC_ERROR_PAGE_FAULT               Decode failed due to the
-                                                    address does not exist in
-                                                    the memory map.
 **/
 libcsdec_result_t libcsdec_run_edge(const libcsdec_t libcsdec,
                                     const void *trace_data_addr,
@@ -134,10 +426,64 @@ libcsdec_result_t libcsdec_run_edge(const libcsdec_t libcsdec,
   return covert_result_type(result);
 }
 
+/**
+    Decodes given trace data split into segments and generates the edge
+    coverage bitmap. The result is the same as libcsdec_run_edge on the
+    concatenation of the segments, e.g. the two halves of a wrapped ring
+    buffer. Frames and packets may cross the segment boundaries, so the
+    segments need not be copied into a contiguous buffer.
+
+    @param  libcsdec                                The decoding session
+                                                    context.
+    @param  segments                                The segments of the trace
+                                                    data in order.
+    @param  segment_num                             The number of the segments.
+
+    @retval LIBCSDEC_SUCCESS                        Decode succeeded.
+    @retval LIBCSDEC_ERROR                          Decode failed.
+    @retval LIBCSDEC_ERROR_TRACE_DATA_INCOMPLETE    Decode failed due to the
+                                                    trace data is incomplete.
+**/
+libcsdec_result_t libcsdec_runv_edge(const libcsdec_t libcsdec,
+                                     const struct iovec *segments,
+                                     const size_t segment_num) {
+  auto process = reinterpret_cast<Process *>(libcsdec);
+
+  ProcessResultType result = process->run(segments, segment_num);
+  return covert_result_type(result);
+}
+
+/**
+    Decodes the trace data compressed in a trace pack and generates the edge
+    coverage bitmap. The blocks of the trace pack are decompressed one at a
+    time into a buffer of the block size and decoded as libcsdec_run_edge does,
+    so the whole trace data is never decompressed into memory.
+
+    @param  libcsdec                                The decoding session
+                                                    context.
+    @param  pack_addr                               The trace pack address.
+    @param  pack_size                               The size of the trace pack.
+
+    @retval LIBCSDEC_SUCCESS                        Decode succeeded.
+    @retval LIBCSDEC_ERROR                          Decode failed, or the trace
+                                                    pack is broken.
+    @retval LIBCSDEC_ERROR_TRACE_DATA_INCOMPLETE    Decode failed due to the
+                                                    trace data is incomplete.
+**/
+libcsdec_result_t libcsdec_run_pack_edge(const libcsdec_t libcsdec,
+                                         const void *pack_addr,
+                                         const size_t pack_size) {
+  auto process = reinterpret_cast<Process *>(libcsdec);
+
+  return run_trace_pack(process, pack_addr, pack_size);
+}
+
 /**
     Finalizes the deocding session for the edge coverage mode. This function
     should be called after the end of each decoding session. It checks if the
-    decoder is not in invalid state.
+    decoder is not in invalid state. With the trace memo, the trace data of the
+    session is decoded or restored from the memo here, so the decoding errors
+    are returned by this function instead of libcsdec_run_edge.
 
     @param  libcsdec                                The decoding session
                                                     context.
@@ -154,9 +500,125 @@ libcsdec_result_t libcsdec_finish_edge(const libcsdec_t libcsdec) {
   return covert_result_type(result);
 }
 
+/**
+    Gets the statistics of the decoder internals for the edge coverage mode.
+    The statistics are accumulated over the decoding sessions.
+
+    @param  libcsdec                                The decoding session
+                                                    context.
+    @param  stats                                   The statistics to be
+                                                    filled.
+
+    @retval LIBCSDEC_SUCCESS                        Succeeded.
+**/
+libcsdec_result_t libcsdec_get_stats_edge(const libcsdec_t libcsdec,
+                                          struct libcsdec_stats *stats) {
+  auto process = reinterpret_cast<Process *>(libcsdec);
+
+  convert_stats(process->stats, stats);
+  return LIBCSDEC_SUCCESS;
+}
+
+/**
+    Resets the statistics of the decoder internals for the edge coverage mode.
+
+    @param  libcsdec                                The decoding session
+                                                    context.
+
+    @retval LIBCSDEC_SUCCESS                        Succeeded.
+**/
+libcsdec_result_t libcsdec_reset_stats_edge(const libcsdec_t libcsdec) {
+  auto process = reinterpret_cast<Process *>(libcsdec);
+
+  process->stats.reset();
+  return LIBCSDEC_SUCCESS;
+}
+
+/**
+    Writes the edge counts of LIBCSDEC_SINK_EDGE_PROFILE to the file as the
+    profile of the memory image, e.g. for the profile guided optimization. The
+    file is in the unsymbolized profile format of llvm-profgen: the execution
+    counts of the address ranges of the basic blocks, followed by the counts of
+    the taken branches within the image. The addresses are the offsets in the
+    memory image, which are the virtual addresses for a PIE. The counts are
+    accumulated over the decoding sessions.
+
+    @param  libcsdec                                The decoding session
+                                                    context.
+    @param  memory_image_id                         The index of the memory
+                                                    image.
+    @param  filename                                The file to write.
+
+    @retval LIBCSDEC_SUCCESS                        Succeeded.
+    @retval LIBCSDEC_ERROR                          The edges are not counted,
+                                                    invalid memory image or
+                                                    failed to write the file.
+**/
+libcsdec_result_t libcsdec_write_profile_edge(const libcsdec_t libcsdec,
+                                              const int memory_image_id,
+                                              const char *filename) {
+  auto process = reinterpret_cast<Process *>(libcsdec);
+
+  if (not(process->data.options.sinks & SINK_EDGE_PROFILE)) {
+    std::cerr << "The edges are not counted without LIBCSDEC_SINK_EDGE_PROFILE."
+              << std::endl;
+    return LIBCSDEC_ERROR;
+  }
+  if (memory_image_id < 0 or
+      static_cast<std::size_t>(memory_image_id) >=
+          process->data.memory_images.size()) {
+    std::cerr << "Invalid memory image: " << memory_image_id << std::endl;
+    return LIBCSDEC_ERROR;
+  }
+
+  std::ofstream stream(filename);
+  process->edge_profile_sink.write(stream, memory_image_id,
+                                   process->data.handle,
+                                   process->data.memory_images);
+  stream.close();
+  if (stream.fail()) {
+    std::cerr << "Failed to write the profile: " << filename << std::endl;
+    return LIBCSDEC_ERROR;
+  }
+  return LIBCSDEC_SUCCESS;
+}
+
+/**
+    Resets the edge counts of LIBCSDEC_SINK_EDGE_PROFILE.
+
+    @param  libcsdec                                The decoding session
+                                                    context.
+
+    @retval LIBCSDEC_SUCCESS                        Succeeded.
+**/
+libcsdec_result_t libcsdec_reset_profile_edge(const libcsdec_t libcsdec) {
+  auto process = reinterpret_cast<Process *>(libcsdec);
+
+  process->edge_profile_sink.counts.clear();
+  return LIBCSDEC_SUCCESS;
+}
+
+/**
+    Drops the caches of edge coverage mode, and returns the memory under them
+    to the system at once. The caches are built again in the next decoding
+    sessions. It must be called between the decoding sessions, e.g. when the
+    caches of a long fuzzing campaign have grown too large.
+
+    @param  libcsdec                                The decoding session
+                                                    context.
+
+    @retval LIBCSDEC_SUCCESS                        Succeeded.
+**/
+libcsdec_result_t libcsdec_reset_cache_edge(const libcsdec_t libcsdec) {
+  auto process = reinterpret_cast<Process *>(libcsdec);
+
+  process->clearCache();
+  return LIBCSDEC_SUCCESS;
+}
+
 /**
     Initializes persistent objects for path coverage mode and returns the
-    pointer.
+    pointer. The bitmap consists of 8-bit counters.
 
     @param  bitmap_addr                             The bitmap address.
     @param  bitmap_size                             The size of the bitmap.
@@ -165,26 +627,69 @@ libcsdec_result_t libcsdec_finish_edge(const libcsdec_t libcsdec) {
                                                     used by libcsdec.
 **/
 libcsdec_t
-libcsdec_init_path(void *bitmap_addr, const int bitmap_size,
+libcsdec_init_path(void *bitmap_addr, const size_t bitmap_size,
                    int memory_image_num,
                    const struct libcsdec_memory_image libcsdec_memory_image[]) {
+  return libcsdec_init_path_ex(bitmap_addr, bitmap_size,
+                               LIBCSDEC_BITMAP_CELL_8BIT, memory_image_num,
+                               libcsdec_memory_image);
+}
+
+/**
+    Initializes persistent objects for path coverage mode with the specified
+    bitmap cell width and returns the pointer.
+
+    @param  bitmap_addr                             The bitmap address.
+    @param  bitmap_size                             The number of the bitmap
+                                                    cells.
+    @param  cell_type                               The width of a bitmap cell.
+
+    @return                                         The pointer to the object
+                                                    used by libcsdec.
+**/
+libcsdec_t libcsdec_init_path_ex(
+    void *bitmap_addr, const size_t bitmap_size,
+    const libcsdec_bitmap_cell_t cell_type, int memory_image_num,
+    const struct libcsdec_memory_image libcsdec_memory_image[]) {
+  struct libcsdec_options options;
+  libcsdec_default_options(&options);
+  options.cell_type = cell_type;
+  return libcsdec_init_path_opts(bitmap_addr, bitmap_size, memory_image_num,
+                                 libcsdec_memory_image, &options);
+}
+
+/**
+    Initializes persistent objects for path coverage mode with the specified
+    options and returns the pointer. Only cell_type and max_atom_len are used
+    in this mode.
+
+    @param  bitmap_addr                             The bitmap address.
+    @param  bitmap_size                             The number of the bitmap
+                                                    cells.
+    @param  memory_image_num                        The number of the memory
+                                                    image entries.
+    @param  libcsdec_memory_image                   The array of all traced
+                                                    memory image data.
+    @param  options                                 The decoder options.
+
+    @return                                         The pointer to the object
+                                                    used by libcsdec.
+**/
+libcsdec_t libcsdec_init_path_opts(
+    void *bitmap_addr, const size_t bitmap_size, int memory_image_num,
+    const struct libcsdec_memory_image libcsdec_memory_image[],
+    const struct libcsdec_options *options) {
   checkCapstoneVersion();
 
-  std::vector<MemoryImage> memory_images;
-  {
-    for (int id = 0; id < memory_image_num; ++id) {
-      std::vector<std::uint8_t> data(
-          reinterpret_cast<std::uint8_t *>(libcsdec_memory_image[id].data) + 0,
-          reinterpret_cast<std::uint8_t *>(libcsdec_memory_image[id].data) +
-              libcsdec_memory_image[id].size);
-      memory_images.emplace_back(MemoryImage(std::move(data), id));
-    }
-  }
+  std::vector<MemoryImage> memory_images =
+      create_memory_images(memory_image_num, libcsdec_memory_image);
 
   std::unique_ptr<PathProcess> process = std::make_unique<PathProcess>(
       std::move(memory_images),
       Bitmap(reinterpret_cast<std::uint8_t *>(bitmap_addr),
-             static_cast<std::size_t>(bitmap_size)));
+             static_cast<std::size_t>(bitmap_size),
+             convert_bitmap_cell_type(options->cell_type)),
+      convert_options(options));
 
   // Release ownership and pass it to the C API side.
   // Therefore, do not free it here.
@@ -218,18 +723,35 @@ libcsdec_reset_path(const libcsdec_t libcsdec, const char trace_id,
 
   auto process = reinterpret_cast<PathProcess *>(libcsdec);
 
-  std::vector<MemoryMap> memory_maps;
-  {
-    for (int id = 0; id < memory_map_num; id++) {
-      memory_maps.emplace_back(MemoryMap(libcsdec_memory_map[id].start,
-                                         libcsdec_memory_map[id].end, id));
-    }
-  }
-
-  process->reset(std::move(memory_maps), trace_id);
+  process->reset(create_memory_maps(memory_map_num, libcsdec_memory_map),
+                 trace_id);
   return LIBCSDEC_SUCCESS;
 }
 
+/**
+    Filters the trace by the context ID for path coverage mode. Only the trace
+    of the context ID, e.g. the PID of the target in a CPU-wide trace, is
+    decoded, and the trace of the other contexts is skipped without
+    disassembling. The trace unit must trace the context IDs. The filter is
+    kept over the decoding sessions, and must not be changed while the
+    sessions submitted to the background decoder are running.
+
+    @param  libcsdec                                The decoding session
+                                                    context.
+    @param  context_id                              The context ID, or
+                                                    LIBCSDEC_CONTEXT_ID_ANY to
+                                                    decode all contexts.
+
+    @retval LIBCSDEC_SUCCESS                        Succeeded.
+    @retval LIBCSDEC_ERROR                          Invalid context ID.
+**/
+libcsdec_result_t libcsdec_filter_context_path(const libcsdec_t libcsdec,
+                                              const uint64_t context_id) {
+  auto process = reinterpret_cast<PathProcess *>(libcsdec);
+
+  return set_context_filter(process->decoder, context_id);
+}
+
 /**
     Decodes given trace data and generates the path coverage bitmap. The trace
     data can be fragment as the deocder can process afterwards using the
@@ -244,9 +766,6 @@ libcsdec_reset_path(const libcsdec_t libcsdec, const char trace_id,
     @retval LIBCSDEC_ERROR                          Decode failed.
     @retval LIBCSDEC_ERROR_TRACE_DATA_INCOMPLETE    Decode failed due to the
                                                     trace data is incomplete.
-    @retval LIBCSDEC_ERROR_PAGE_FAULT               Decode failed due to the
-                                                    address does not exist in
-                                                    the memory map.
 **/
 libcsdec_result_t libcsdec_run_path(const libcsdec_t libcsdec,
                                     const void *trace_data_addr,
@@ -258,6 +777,58 @@ libcsdec_result_t libcsdec_run_path(const libcsdec_t libcsdec,
   return covert_result_type(result);
 }
 
+/**
+    Decodes given trace data split into segments and generates the path
+    coverage bitmap. The result is the same as libcsdec_run_path on the
+    concatenation of the segments, e.g. the two halves of a wrapped ring
+    buffer. Frames and packets may cross the segment boundaries, so the
+    segments need not be copied into a contiguous buffer.
+
+    @param  libcsdec                                The decoding session
+                                                    context.
+    @param  segments                                The segments of the trace
+                                                    data in order.
+    @param  segment_num                             The number of the segments.
+
+    @retval LIBCSDEC_SUCCESS                        Decode succeeded.
+    @retval LIBCSDEC_ERROR                          Decode failed.
+    @retval LIBCSDEC_ERROR_TRACE_DATA_INCOMPLETE    Decode failed due to the
+                                                    trace data is incomplete.
+**/
+libcsdec_result_t libcsdec_runv_path(const libcsdec_t libcsdec,
+                                     const struct iovec *segments,
+                                     const size_t segment_num) {
+  auto process = reinterpret_cast<PathProcess *>(libcsdec);
+
+  ProcessResultType result = process->run(segments, segment_num);
+  return covert_result_type(result);
+}
+
+/**
+    Decodes the trace data compressed in a trace pack and generates the path
+    coverage bitmap. The blocks of the trace pack are decompressed one at a
+    time into a buffer of the block size and decoded as libcsdec_run_path does,
+    so the whole trace data is never decompressed into memory.
+
+    @param  libcsdec                                The decoding session
+                                                    context.
+    @param  pack_addr                               The trace pack address.
+    @param  pack_size                               The size of the trace pack.
+
+    @retval LIBCSDEC_SUCCESS                        Decode succeeded.
+    @retval LIBCSDEC_ERROR                          Decode failed, or the trace
+                                                    pack is broken.
+    @retval LIBCSDEC_ERROR_TRACE_DATA_INCOMPLETE    Decode failed due to the
+                                                    trace data is incomplete.
+**/
+libcsdec_result_t libcsdec_run_pack_path(const libcsdec_t libcsdec,
+                                         const void *pack_addr,
+                                         const size_t pack_size) {
+  auto process = reinterpret_cast<PathProcess *>(libcsdec);
+
+  return run_trace_pack(process, pack_addr, pack_size);
+}
+
 /**
     Finalizes the deocding session for the path coverage mode. This function
     should be called after the end of each decoding session. It checks if the
@@ -278,6 +849,243 @@ libcsdec_result_t libcsdec_finish_path(const libcsdec_t libcsdec) {
   return covert_result_type(result);
 }
 
+/**
+    Gets the statistics of the decoder internals for the path coverage mode.
+    The statistics are accumulated over the decoding sessions.
+
+    @param  libcsdec                                The decoding session
+                                                    context.
+    @param  stats                                   The statistics to be
+                                                    filled.
+
+    @retval LIBCSDEC_SUCCESS                        Succeeded.
+**/
+libcsdec_result_t libcsdec_get_stats_path(const libcsdec_t libcsdec,
+                                          struct libcsdec_stats *stats) {
+  auto process = reinterpret_cast<PathProcess *>(libcsdec);
+
+  convert_stats(process->stats, stats);
+  return LIBCSDEC_SUCCESS;
+}
+
+/**
+    Resets the statistics of the decoder internals for the path coverage mode.
+
+    @param  libcsdec                                The decoding session
+                                                    context.
+
+    @retval LIBCSDEC_SUCCESS                        Succeeded.
+**/
+libcsdec_result_t libcsdec_reset_stats_path(const libcsdec_t libcsdec) {
+  auto process = reinterpret_cast<PathProcess *>(libcsdec);
+
+  process->stats.reset();
+  return LIBCSDEC_SUCCESS;
+}
+
+// Runs a decoding session of the background decoder in the same way as the
+// reset, runv and finish functions.
+template <typename P>
+static ProcessResultType run_async_session(P *process, AsyncSession &session) {
+  process->reset(std::move(session.memory_maps), session.trace_id);
+  const ProcessResultType result =
+      process->run(session.segments.data(), session.segments.size());
+  if (result != ProcessResultType::PROCESS_SUCCESS) {
+    return result;
+  }
+  return process->final();
+}
+
+/**
+    Starts the background decoder of the context for edge coverage mode and
+    returns the pointer. The decoding sessions submitted to it run on a
+    background thread, so that the target can run while the previous trace
+    data is decoded. The bitmap of each session is copied into one of the two
+    result bitmaps owned by the background decoder, which have the same size
+    and cell width as the bitmap of the context. The edge callback is called on
+    the background thread. Do not call the other functions of the context
+    after this function.
+
+    @param  libcsdec                                The decoding session
+                                                    context.
+
+    @return                                         The pointer to the object
+                                                    used by libcsdec, or NULL
+                                                    if the context writes the
+                                                    path coverage bitmap.
+**/
+libcsdec_async_t libcsdec_init_async_edge(const libcsdec_t libcsdec) {
+  auto process = reinterpret_cast<Process *>(libcsdec);
+
+  // Only the bitmap of the edge coverage is kept for each session.
+  if (process->path_coverage.has_value()) {
+    std::cerr << "The background decoder does not support the path coverage "
+                 "bitmap output."
+              << std::endl;
+    return nullptr;
+  }
+
+  std::unique_ptr<AsyncDecoder> async = std::make_unique<AsyncDecoder>(
+      process->data.bitmap, [process](AsyncSession &session) {
+        return run_async_session(process, session);
+      });
+
+  // Release ownership and pass it to the C API side.
+  // Therefore, do not free it here.
+  return reinterpret_cast<AsyncDecoder *>(async.release());
+}
+
+/**
+    Starts the background decoder of the context for path coverage mode and
+    returns the pointer. Refer to libcsdec_init_async_edge for the details. Do
+    not call the other functions of the context after this function.
+
+    @param  libcsdec                                The decoding session
+                                                    context.
+
+    @return                                         The pointer to the object
+                                                    used by libcsdec.
+**/
+libcsdec_async_t libcsdec_init_async_path(const libcsdec_t libcsdec) {
+  auto process = reinterpret_cast<PathProcess *>(libcsdec);
+
+  std::unique_ptr<AsyncDecoder> async = std::make_unique<AsyncDecoder>(
+      process->coverage.bitmap, [process](AsyncSession &session) {
+        return run_async_session(process, session);
+      });
+
+  // Release ownership and pass it to the C API side.
+  // Therefore, do not free it here.
+  return reinterpret_cast<AsyncDecoder *>(async.release());
+}
+
+/**
+    Submits a decoding session to the background decoder and returns without
+    waiting for it. The session resets the decoder with the memory maps,
+    decodes the segments and finalizes the decoder. The sessions are decoded
+    in the submitted order. The segments are not copied, so keep the trace
+    data until the result of the session is returned.
+
+    The results of the last two sessions are kept. Therefore, the result of
+    the session two tickets earlier must be returned by libcsdec_poll_async or
+    libcsdec_wait_async before submitting a session.
+
+    @param  async                                   The background decoder.
+    @param  trace_id                                The trace ID.
+    @param  memory_map_num                          The number of the memory map
+                                                    entries.
+    @param  libcsdec_memory_map                     The array of all traced
+                                                    memory map infomation.
+    @param  segments                                The segments of the trace
+                                                    data in order.
+    @param  segment_num                             The number of the segments.
+    @param  ticket                                  The ticket of the session
+                                                    to be filled.
+
+    @retval LIBCSDEC_SUCCESS                        Submit succeeded.
+    @retval LIBCSDEC_ERROR                          Submit failed. Invalid
+                                                    memory map, or the result
+                                                    of the session two tickets
+                                                    earlier is not returned.
+**/
+libcsdec_result_t
+libcsdec_submit_async(const libcsdec_async_t async, const char trace_id,
+                      const int memory_map_num,
+                      const struct libcsdec_memory_map libcsdec_memory_map[],
+                      const struct iovec *segments, const size_t segment_num,
+                      libcsdec_ticket_t *ticket) {
+  if (memory_map_num <= 0) {
+    std::cerr << "Specify 1 or more for the number of memory maps" << std::endl;
+    return LIBCSDEC_ERROR;
+  }
+
+  auto decoder = reinterpret_cast<AsyncDecoder *>(async);
+
+  const std::optional<std::uint64_t> submitted_ticket = decoder->submit(
+      trace_id, create_memory_maps(memory_map_num, libcsdec_memory_map),
+      std::vector<struct iovec>(segments, segments + segment_num));
+  if (not submitted_ticket.has_value()) {
+    std::cerr << "The result of the session two tickets earlier is not "
+                 "returned."
+              << std::endl;
+    return LIBCSDEC_ERROR;
+  }
+
+  *ticket = submitted_ticket.value();
+  return LIBCSDEC_SUCCESS;
+}
+
+/**
+    Returns the result of a decoding session if it is finished, without
+    waiting for it. The bitmap of the session is valid until the session two
+    tickets later is submitted, and the caller may modify it.
+
+    @param  async                                   The background decoder.
+    @param  ticket                                  The ticket of the session.
+    @param  bitmap_addr                             The bitmap address of the
+                                                    session to be filled when
+                                                    the session is finished.
+
+    @retval LIBCSDEC_PENDING                        The session is not finished
+                                                    yet.
+    @retval LIBCSDEC_ERROR                          The ticket is invalid, or
+                                                    the result is no longer
+                                                    kept.
+    @retval others                                  The result of the session
+                                                    as libcsdec_runv_edge or
+                                                    libcsdec_finish_edge.
+**/
+libcsdec_result_t libcsdec_poll_async(const libcsdec_async_t async,
+                                      const libcsdec_ticket_t ticket,
+                                      void **bitmap_addr) {
+  auto decoder = reinterpret_cast<AsyncDecoder *>(async);
+
+  if (not decoder->hasTicket(ticket)) {
+    std::cerr << "Invalid ticket: " << ticket << std::endl;
+    return LIBCSDEC_ERROR;
+  }
+
+  const std::optional<ProcessResultType> result = decoder->poll(ticket);
+  if (not result.has_value()) {
+    return LIBCSDEC_PENDING;
+  }
+
+  *bitmap_addr = decoder->getBitmap(ticket);
+  return covert_result_type(result.value());
+}
+
+/**
+    Waits for a decoding session to finish and returns the result. The bitmap
+    of the session is valid until the session two tickets later is submitted,
+    and the caller may modify it.
+
+    @param  async                                   The background decoder.
+    @param  ticket                                  The ticket of the session.
+    @param  bitmap_addr                             The bitmap address of the
+                                                    session to be filled.
+
+    @retval LIBCSDEC_ERROR                          The ticket is invalid, or
+                                                    the result is no longer
+                                                    kept.
+    @retval others                                  The result of the session
+                                                    as libcsdec_runv_edge or
+                                                    libcsdec_finish_edge.
+**/
+libcsdec_result_t libcsdec_wait_async(const libcsdec_async_t async,
+                                      const libcsdec_ticket_t ticket,
+                                      void **bitmap_addr) {
+  auto decoder = reinterpret_cast<AsyncDecoder *>(async);
+
+  if (not decoder->hasTicket(ticket)) {
+    std::cerr << "Invalid ticket: " << ticket << std::endl;
+    return LIBCSDEC_ERROR;
+  }
+
+  const ProcessResultType result = decoder->wait(ticket);
+  *bitmap_addr = decoder->getBitmap(ticket);
+  return covert_result_type(result);
+}
+
 libcsdec_result_t covert_result_type(ProcessResultType result) {
   switch (result) {
   case ProcessResultType::PROCESS_SUCCESS:
@@ -294,3 +1102,151 @@ libcsdec_result_t covert_result_type(ProcessResultType result) {
 
   return LIBCSDEC_ERROR;
 }
+
+BitmapCellType convert_bitmap_cell_type(libcsdec_bitmap_cell_t cell_type) {
+  switch (cell_type) {
+  case LIBCSDEC_BITMAP_CELL_8BIT:
+    return BitmapCellType::U8;
+  case LIBCSDEC_BITMAP_CELL_16BIT:
+    return BitmapCellType::U16;
+  case LIBCSDEC_BITMAP_CELL_32BIT:
+    return BitmapCellType::U32;
+  default:
+    __builtin_unreachable();
+  }
+
+  return BitmapCellType::U8;
+}
+
+ProcessOptions convert_options(const struct libcsdec_options *options) {
+  ProcessOptions process_options;
+  switch (options->cache_mode) {
+  case LIBCSDEC_CACHE_NONE:
+    process_options.cache_mode = CacheMode::NONE;
+    break;
+  case LIBCSDEC_CACHE_BRANCH:
+    process_options.cache_mode = CacheMode::BRANCH;
+    break;
+  case LIBCSDEC_CACHE_TRACE:
+    process_options.cache_mode = CacheMode::TRACE;
+    break;
+  default:
+    __builtin_unreachable();
+  }
+  process_options.sinks = options->sinks;
+  // struct libcsdec_edge has the same layout as Edge, so the edges are passed
+  // to the callback without copying them.
+  process_options.edge_callback =
+      reinterpret_cast<EdgeCallback>(options->edge_callback);
+  process_options.edge_callback_data = options->edge_callback_data;
+  if (options->edge_log_filename != nullptr) {
+    process_options.edge_log_filename = options->edge_log_filename;
+  }
+  if (options->path_bitmap_addr != nullptr) {
+    process_options.path_bitmap.emplace(
+        reinterpret_cast<std::uint8_t *>(options->path_bitmap_addr),
+        static_cast<std::size_t>(options->path_bitmap_size),
+        convert_bitmap_cell_type(options->cell_type));
+  }
+  process_options.max_atom_len = options->max_atom_len;
+  process_options.trace_memo_size = options->trace_memo_size;
+  return process_options;
+}
+
+std::vector<MemoryImage> create_memory_images(
+    int memory_image_num,
+    const struct libcsdec_memory_image libcsdec_memory_image[]) {
+  std::vector<MemoryImage> memory_images;
+  for (int id = 0; id < memory_image_num; ++id) {
+    std::vector<std::uint8_t> data(
+        reinterpret_cast<std::uint8_t *>(libcsdec_memory_image[id].data) + 0,
+        reinterpret_cast<std::uint8_t *>(libcsdec_memory_image[id].data) +
+            libcsdec_memory_image[id].size);
+    memory_images.emplace_back(MemoryImage(std::move(data), id));
+  }
+  return memory_images;
+}
+
+std::vector<MemoryMap>
+create_memory_maps(int memory_map_num,
+                   const struct libcsdec_memory_map libcsdec_memory_map[]) {
+  std::vector<MemoryMap> memory_maps;
+  for (int id = 0; id < memory_map_num; id++) {
+    // The path is recorded in the edge log.
+    const char *path = libcsdec_memory_map[id].path;
+    memory_maps.emplace_back(MemoryMap(
+        libcsdec_memory_map[id].start, libcsdec_memory_map[id].end, id,
+        std::string(path, strnlen(path, PATH_MAX))));
+  }
+  return memory_maps;
+}
+
+libcsdec_result_t set_context_filter(Decoder &decoder,
+                                     const uint64_t context_id) {
+  if (context_id == LIBCSDEC_CONTEXT_ID_ANY) {
+    decoder.target_context_id = std::nullopt;
+    return LIBCSDEC_SUCCESS;
+  }
+  if (context_id > UINT32_MAX) {
+    std::cerr << "The context ID must fit in 32 bits." << std::endl;
+    return LIBCSDEC_ERROR;
+  }
+  decoder.target_context_id = context_id;
+  return LIBCSDEC_SUCCESS;
+}
+
+template <typename P>
+libcsdec_result_t run_trace_pack(P *process, const void *pack_addr,
+                                 const size_t pack_size) {
+  const TracePackReader reader(
+      reinterpret_cast<const std::uint8_t *>(pack_addr), pack_size);
+  if (reader.failed) {
+    return LIBCSDEC_ERROR;
+  }
+
+  std::vector<std::uint8_t> block;
+  for (std::size_t i = 0; i < reader.blocks.size(); ++i) {
+    if (not reader.readBlock(i, block)) {
+      std::cerr << "Failed to decompress the block " << std::dec << i
+                << " of the trace pack." << std::endl;
+      return LIBCSDEC_ERROR;
+    }
+    const ProcessResultType result = process->run(block.data(), block.size());
+    if (result != ProcessResultType::PROCESS_SUCCESS) {
+      return covert_result_type(result);
+    }
+  }
+  return LIBCSDEC_SUCCESS;
+}
+
+void convert_stats(const Stats &stats, struct libcsdec_stats *libcsdec_stats) {
+  for (std::size_t i = 0; i < PACKET_TYPE_NUM; ++i) {
+    libcsdec_stats->packets[i] = stats.packets[i];
+  }
+  libcsdec_stats->formatted_bytes = stats.formatted_bytes;
+  libcsdec_stats->deformatted_bytes = stats.deformatted_bytes;
+  libcsdec_stats->atoms = stats.atoms;
+  libcsdec_stats->unmapped_atoms = stats.unmapped_atoms;
+  libcsdec_stats->branch_cache_hits = stats.branch_cache_hits;
+  libcsdec_stats->branch_cache_misses = stats.branch_cache_misses;
+  libcsdec_stats->block_interval_hits = stats.block_interval_hits;
+  libcsdec_stats->trace_cache_hits = stats.trace_cache_hits;
+  libcsdec_stats->trace_cache_misses = stats.trace_cache_misses;
+  libcsdec_stats->indirect_target_cache_hits =
+      stats.indirect_target_cache_hits;
+  libcsdec_stats->indirect_target_cache_misses =
+      stats.indirect_target_cache_misses;
+  libcsdec_stats->trace_memo_hits = stats.trace_memo_hits;
+  libcsdec_stats->trace_memo_misses = stats.trace_memo_misses;
+  libcsdec_stats->trace_memo_segment_hits = stats.trace_memo_segment_hits;
+  libcsdec_stats->trace_memo_segment_misses = stats.trace_memo_segment_misses;
+  libcsdec_stats->disassembled_insns = stats.disassembled_insns;
+  libcsdec_stats->page_faults = stats.page_faults;
+  libcsdec_stats->context_switches = stats.context_switches;
+  libcsdec_stats->context_session_switches = stats.context_session_switches;
+  libcsdec_stats->unknown_packets = stats.unknown_packets;
+  libcsdec_stats->unsynced_bytes = stats.unsynced_bytes;
+  libcsdec_stats->deformat_ns = stats.deformat_ns;
+  libcsdec_stats->decode_ns = stats.decode_ns;
+  libcsdec_stats->disassemble_ns = stats.disassemble_ns;
+}
@@ -0,0 +1,138 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright 2021 Ricerca Security, Inc. All rights reserved. */
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <linux/limits.h>
+#include <vector>
+
+#include "common.hpp"
+#include "tracepack.hpp"
+#include "utils.hpp"
+
+void usage(const char *argv0) {
+  std::cerr << "Usage: " << argv0 << " [input_filename] [OPTIONS]"
+            << std::endl
+            << "OPTIONS:" << std::endl
+            << "\t--output=name             : Specify the file name to save "
+               "the output. The default name is the input file name with "
+               ".pack appended, or with .pack replaced by .raw with "
+               "--decompress."
+            << std::endl
+            << "\t--decompress              : Decompress the trace pack into "
+               "the trace data."
+            << std::endl
+            << "\t--range=offset,size       : Decompress only the range of "
+               "the trace data in hexadecimal. Only the blocks that overlap it "
+               "are decompressed."
+            << std::endl
+            << "\t--block-size=size         : Specify the size of the blocks "
+               "of the trace data in hexadecimal. The default size is 0x10000."
+            << std::endl
+            << "\t--info                    : Print the sizes of the trace "
+               "pack and its blocks."
+            << std::endl
+            << std::endl;
+}
+
+void printInfo(const TracePackReader &reader) {
+  std::cout << std::dec << "block_size: " << reader.block_size << std::endl
+            << "blocks: " << reader.blocks.size() << std::endl
+            << "size: " << reader.size << std::endl
+            << "raw_size: " << reader.raw_size << std::endl;
+  for (std::size_t i = 0; i < reader.blocks.size(); ++i) {
+    const TracePackBlock &block = reader.blocks[i];
+    std::cout << "block " << i << ": 0x" << std::hex << block.offset << " "
+              << std::dec << block.size << "/" << block.raw_size << std::endl;
+  }
+}
+
+int main(int argc, char const *argv[]) {
+  if (argc < 2) {
+    usage(argv[0]);
+    std::exit(EXIT_FAILURE);
+  }
+
+  const std::string input_filename = argv[1];
+  std::string output_filename;
+  bool decompress = false;
+  bool print_info = false;
+  bool has_range = false;
+  std::uint64_t range_offset = 0;
+  std::uint64_t range_size = 0;
+  std::uint64_t block_size = TRACE_PACK_BLOCK_SIZE;
+  for (int i = 2; i < argc; ++i) {
+    std::uint64_t size = 0;
+    char buf[PATH_MAX];
+    if (sscanf(argv[i], "--output=%s", buf) == 1) {
+      output_filename = std::string(buf);
+    } else if (strcmp(argv[i], "--decompress") == 0) {
+      decompress = true;
+    } else if (sscanf(argv[i], "--range=%lx,%lx", &range_offset,
+                      &range_size) == 2) {
+      decompress = true;
+      has_range = true;
+    } else if (sscanf(argv[i], "--block-size=%lx", &size) == 1) {
+      if (size == 0 or size > TRACE_PACK_MAX_BLOCK_SIZE) {
+        std::cerr << "The block size must be between 1 and 0x" << std::hex
+                  << TRACE_PACK_MAX_BLOCK_SIZE << "." << std::endl;
+        std::exit(1);
+      }
+      block_size = size;
+    } else if (strcmp(argv[i], "--info") == 0) {
+      print_info = true;
+    } else {
+      std::cerr << "Invalid option: " << argv[i] << std::endl;
+      std::exit(1);
+    }
+  }
+
+  const std::vector<std::uint8_t> data = readBinaryFile(input_filename);
+
+  if (not decompress and not print_info) {
+    if (output_filename.empty()) {
+      output_filename = input_filename + ".pack";
+    }
+    writeBinaryFile(packTraceData(data.data(), data.size(), block_size),
+                    output_filename);
+    return 0;
+  }
+
+  const TracePackReader reader(data.data(), data.size());
+  if (reader.failed) {
+    std::exit(1);
+  }
+
+  if (print_info) {
+    printInfo(reader);
+    if (not decompress) {
+      return 0;
+    }
+  }
+
+  if (not has_range) {
+    range_size = reader.raw_size;
+  }
+  std::vector<std::uint8_t> raw_data;
+  if (not reader.readRange(range_offset, range_size, raw_data)) {
+    std::cerr << "Failed to decompress the trace pack: " << input_filename
+              << std::endl;
+    std::exit(1);
+  }
+
+  if (output_filename.empty()) {
+    const std::string suffix = ".pack";
+    if (input_filename.size() > suffix.size() and
+        input_filename.compare(input_filename.size() - suffix.size(),
+                               suffix.size(), suffix) == 0) {
+      output_filename =
+          input_filename.substr(0, input_filename.size() - suffix.size()) +
+          ".raw";
+    } else {
+      output_filename = input_filename + ".raw";
+    }
+  }
+  writeBinaryFile(raw_data, output_filename);
+  return 0;
+}
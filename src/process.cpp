@@ -3,7 +3,9 @@
 
 #include <cassert>
 #include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <sys/uio.h>
 #include <vector>
 
 #include "cache.hpp"
@@ -15,15 +17,88 @@
 #include "trace.hpp"
 #include "utils.hpp"
 
+static bool isSameMemoryMaps(const std::vector<MemoryMap> &memory_maps1,
+                             const std::vector<MemoryMap> &memory_maps2) {
+  if (memory_maps1.size() != memory_maps2.size()) {
+    return false;
+  }
+  for (std::size_t i = 0; i < memory_maps1.size(); ++i) {
+    if (memory_maps1[i].start_address != memory_maps2[i].start_address or
+        memory_maps1[i].end_address != memory_maps2[i].end_address) {
+      return false;
+    }
+  }
+  return true;
+}
+
 void Process::reset(std::vector<MemoryMap> &&memory_maps,
                     const std::uint8_t target_trace_id) {
+  // Switch back to the target before its memory maps are compared.
+  activateContextSession(std::nullopt);
+  this->context_sessions.clear();
+  this->routed_context_id = std::nullopt;
+
+  // The indirect target cache holds the locations of the target addresses.
+  // It is kept as long as the memory maps are the same, which is usually the
+  // case when the same program is traced repeatedly.
+  if (not isSameMemoryMaps(this->state.memory_maps, memory_maps)) {
+    this->data.cache.invalidateIndirectTargetCache();
+  }
+
   this->data.bitmap.reset();
   this->deformatter.reset(target_trace_id);
   this->decoder.reset();
   this->state.reset(std::move(memory_maps));
+  if (this->path_coverage.has_value()) {
+    this->path_coverage->reset();
+  }
+  if (this->data.options.sinks & SINK_EDGE_LOG) {
+    this->edge_log_sink.beginSession(this->state.memory_maps);
+  }
+}
+
+bool Process::addContextSession(const std::uint32_t context_id,
+                                const Bitmap &bitmap,
+                                std::vector<MemoryMap> &&memory_maps) {
+  assert(this->data.options.sinks == SINK_BITMAP);
+  assert(bitmap.size == this->data.bitmap.size and
+         bitmap.cell_type == this->data.bitmap.cell_type);
+
+  for (const ContextSession &session : this->context_sessions) {
+    if (session.context_id == context_id) {
+      return false;
+    }
+  }
+
+  // The target's memory maps are in the state unless a context session is
+  // being decoded, and the session is switched out while it is added.
+  const std::optional<std::size_t> index = this->active_context_session;
+  activateContextSession(std::nullopt);
+
+  bitmap.reset();
+  const bool has_same_memory_maps =
+      isSameMemoryMaps(this->state.memory_maps, memory_maps);
+  this->context_sessions.emplace_back(context_id, bitmap,
+                                      std::move(memory_maps),
+                                      has_same_memory_maps);
+
+  activateContextSession(index);
+  return true;
+}
+
+void Process::clearCache() {
+  // The trace data is on the same memory resource as the caches.
+  this->decoder.trace_data =
+      decltype(this->decoder.trace_data)(this->data.cache.resource);
+  this->decoder.trace_data_offset = 0;
+  this->data.cache.clear();
 }
 
 ProcessResultType Process::final() {
+  if (usesTraceMemo()) {
+    return finalWithTraceMemo();
+  }
+
   // If the area to be traced is limited on the tracer side, this condition may
   // not be satisfied. if (state.has_pending_address_packet) {
   //     // This trace data is incomplete. There is no Address packet following
@@ -34,14 +109,143 @@ ProcessResultType Process::final() {
   return ProcessResultType::PROCESS_SUCCESS;
 }
 
+// Deformats the segments into the trace data of the decoder. Frames and
+// packets may cross the segment boundaries, since the deformatter keeps the
+// split frame and the decoder waits for the rest of the packet.
+static void deformatSegments(Deformatter &deformatter, Decoder &decoder,
+                             Stats &stats, const struct iovec *segments,
+                             const std::size_t segment_num) {
+  const StatsTimer timer(stats.deformat_ns);
+  const std::size_t prev_size = decoder.trace_data.size();
+  for (std::size_t i = 0; i < segment_num; ++i) {
+    deformatter.deformatTraceData(
+        static_cast<const std::uint8_t *>(segments[i].iov_base),
+        segments[i].iov_len, decoder.trace_data);
+    stats.formatted_bytes += segments[i].iov_len;
+  }
+  stats.deformatted_bytes += decoder.trace_data.size() - prev_size;
+}
+
+// Moves the decoder to the next A-sync packet if the packet boundaries are
+// lost. Returns false if more trace data is needed to find it.
+static bool syncDecoder(Decoder &decoder, Stats &stats) {
+  const std::size_t offset = decoder.trace_data_offset;
+  const bool is_synced = decoder.sync();
+  stats.unsynced_bytes += decoder.trace_data_offset - offset;
+  return is_synced;
+}
+
 ProcessResultType Process::run(const std::uint8_t *trace_data_addr,
                                const std::size_t trace_data_size) {
+  const struct iovec segment = {const_cast<std::uint8_t *>(trace_data_addr),
+                                trace_data_size};
+  return run(&segment, 1);
+}
+
+ProcessResultType Process::run(const struct iovec *segments,
+                               const std::size_t segment_num) {
   // Read trace data and deformat trace data.
-  this->deformatter.deformatTraceData(trace_data_addr, trace_data_size,
-                                      decoder.trace_data);
+  deformatSegments(this->deformatter, this->decoder, this->stats, segments,
+                   segment_num);
+
+  // With the trace memo, the trace data is decoded by final once the whole
+  // trace data of the session is known.
+  if (usesTraceMemo()) {
+    return ProcessResultType::PROCESS_SUCCESS;
+  }
+
+  const ProcessResultType result = decodeTraceData();
+
+  // The buffered edges are delivered at the end of each run, so that the
+  // caller sees all edges of the trace data passed so far.
+  flushSinks();
+  return result;
+}
+
+bool Process::usesTraceMemo() const {
+  return this->data.trace_memo.capacity != 0 and
+         this->data.options.sinks == SINK_BITMAP and
+         this->context_sessions.empty();
+}
+
+ProcessResultType Process::decodeTraceData() {
+  // Every combination of the options has its own specialization of the
+  // decoding loop, so that the options are not checked for each packet.
+  switch (this->data.options.cache_mode) {
+  case CacheMode::NONE:
+    return this->decodeTraceData<CacheMode::NONE>();
+  case CacheMode::BRANCH:
+    return this->decodeTraceData<CacheMode::BRANCH>();
+  case CacheMode::TRACE:
+    return this->decodeTraceData<CacheMode::TRACE>();
+  default:
+    __builtin_unreachable();
+  }
+}
+
+template <CacheMode cache_mode, OutputSinks... sinks>
+constexpr std::array<ProcessResultType (Process::*)(), sizeof...(sinks)>
+Process::makeDecodeTraceDataTable(
+    std::integer_sequence<OutputSinks, sinks...>) {
+  return {&Process::decodeTraceData<cache_mode, sinks>...};
+}
 
+template <CacheMode cache_mode> ProcessResultType Process::decodeTraceData() {
+  // The table of the specializations for every combination of the outputs.
+  static constexpr auto table = makeDecodeTraceDataTable<cache_mode>(
+      std::make_integer_sequence<OutputSinks, SINK_COMBINATION_NUM>());
+
+  assert(this->data.options.sinks < SINK_COMBINATION_NUM);
+  return (this->*table[this->data.options.sinks])();
+}
+
+template <CacheMode cache_mode, OutputSinks sinks>
+ProcessResultType Process::decodeTraceData() {
+  const StatsTimer timer(this->stats.decode_ns);
+  const std::uint8_t *trace_data = this->decoder.trace_data.data();
   const std::size_t size = this->decoder.trace_data.size();
   while (this->decoder.trace_data_offset < size) {
+    // Most of the trace data in the TRACE state is atom packets. They are
+    // decoded from the header byte and processed in place, without building a
+    // Packet and dispatching it twice. The other packets take the generic path
+    // below.
+    if (this->decoder.state == DecodeState::TRACE) {
+      const AtomFormat &atom =
+          ATOM_FORMATS[trace_data[this->decoder.trace_data_offset]];
+      if (atom.en_bits_len != 0) {
+        DEBUG("%s\n",
+              (Packet{atom.type, 1, atom.en_bits, atom.en_bits_len, 0})
+                  .toString()
+                  .c_str());
+        ++this->decoder.trace_data_offset;
+        this->stats.countPacket(atom.type);
+        if constexpr (sinks & SINK_PATH_BITMAP) {
+          this->path_coverage->processAtoms(atom.en_bits, atom.en_bits_len);
+        }
+        this->processAtoms<cache_mode, sinks>(atom.en_bits, atom.en_bits_len);
+        continue;
+      }
+    } else if (this->decoder.state == DecodeState::UNMAPPED) {
+      // Outside the memory maps or the target context, the atom packets are
+      // skipped in place. The path coverage is outside too, so it ignores
+      // them.
+      const AtomFormat &atom =
+          ATOM_FORMATS[trace_data[this->decoder.trace_data_offset]];
+      if (atom.en_bits_len != 0) {
+        ++this->decoder.trace_data_offset;
+        this->stats.countPacket(atom.type);
+        this->stats.unmapped_atoms += atom.en_bits_len;
+        continue;
+      }
+    }
+
+    // Not in the fast path above, since the decoder is in the START state
+    // until it is synchronized.
+    if (not this->decoder.is_synced and
+        not syncDecoder(this->decoder, this->stats)) {
+      return ProcessResultType::PROCESS_SUCCESS;
+    }
+
     const Packet packet = this->decoder.decodePacket();
     DEBUG("%s\n", packet.toString().c_str());
 
@@ -53,6 +257,51 @@ ProcessResultType Process::run(const std::uint8_t *trace_data_addr,
     }
 
     this->decoder.trace_data_offset += packet.size;
+    this->stats.countPacket(packet.type);
+
+    // The decoder has lost the packet boundaries at an unknown packet. The
+    // trace starts again at the first address packet after the next A-sync
+    // packet, so the bytes in between are not decoded as bogus packets.
+    if (packet.type == PacketType::PKT_UNKNOWN) {
+      leaveTracedRegion();
+      this->decoder.state = DecodeState::START;
+      if constexpr (sinks & SINK_PATH_BITMAP) {
+        this->path_coverage->leaveTracedRegion();
+      }
+      continue;
+    }
+
+    // The context sessions take the trace of their contexts, whichever the
+    // context filter is.
+    if (not this->context_sessions.empty() and
+        this->decoder.context_id != this->routed_context_id) {
+      switchContext();
+    }
+
+    // The packets of other contexts are skipped before they reach the
+    // coverages. The trace leaves at the context packet of another context,
+    // and comes back at an address packet in the target context. Until the
+    // first context packet, the context is unknown and skipped too.
+    if (not this->active_context_session.has_value() and
+        not this->decoder.isTargetContext()) {
+      if (this->decoder.state != DecodeState::UNMAPPED) {
+        if (this->decoder.context_id.has_value()) {
+          ++this->stats.context_switches;
+        }
+        leaveTracedRegion();
+        if constexpr (sinks & SINK_PATH_BITMAP) {
+          this->path_coverage->leaveTracedRegion();
+        }
+      }
+      continue;
+    }
+
+    // The page faults are counted by the edge coverage, so the path coverage
+    // leaving the memory maps is not counted again.
+    if constexpr (sinks & SINK_PATH_BITMAP) {
+      this->path_coverage->processPacket(packet, this->state.memory_maps,
+                                         this->stats);
+    }
 
     switch (this->decoder.state) {
     case DecodeState::START:
@@ -74,28 +323,21 @@ ProcessResultType Process::run(const std::uint8_t *trace_data_addr,
       case PacketType::ETM4_PKT_I_ADDR_S_IS0:
       case PacketType::ETM4_PKT_I_ADDR_L_64IS0:
       case PacketType::ETM4_PKT_I_ADDR_CTXT_L_64IS0: {
-        const std::optional<Location> optional_start_location =
-            getLocation(this->state.memory_maps, packet.addr);
-
-        // The trace is starting from an address that is not on the memory map.
-        if (not optional_start_location.has_value()) {
-          return ProcessResultType::PROCESS_ERROR_PAGE_FAULT;
-        }
-
         const std::optional<AddressTrace> optional_trace =
             processAddressPacket(packet);
 
         if (optional_trace.has_value()) {
           AddressTrace trace = optional_trace.value();
 
-          trace.calculateBitmapKey(this->data.bitmap.size);
-          trace.writeBitmapKey(this->data.bitmap);
-#if defined(PRINT_EDGE_COV)
-          trace.printTraceLocation(state.memory_maps);
-#endif
+          calculateBitmapKey(trace);
+          this->writeAddressTrace<sinks>(trace);
         }
 
-        this->decoder.state = DecodeState::TRACE;
+        // If the trace starts from an address that is not on the memory maps,
+        // processAddressPacket has moved to the UNMAPPED state.
+        if (this->state.prev_location.has_value()) {
+          this->decoder.state = DecodeState::TRACE;
+        }
         break;
       }
 
@@ -106,60 +348,8 @@ ProcessResultType Process::run(const std::uint8_t *trace_data_addr,
     }
 
     case DecodeState::TRACE: {
+      // The atom packets are processed above.
       switch (packet.type) {
-      case PacketType::ETM4_PKT_I_ATOM_F1:
-      case PacketType::ETM4_PKT_I_ATOM_F2:
-      case PacketType::ETM4_PKT_I_ATOM_F3:
-      case PacketType::ETM4_PKT_I_ATOM_F4:
-      case PacketType::ETM4_PKT_I_ATOM_F5:
-      case PacketType::ETM4_PKT_I_ATOM_F6: {
-        // When processing an atom packet, there is an unprocessed indirect
-        // branch instruction. If there is an unprocessed indirect branch
-        // instruction, there must be an address packet, not an atom packet.
-        // When this error occurs, there is probably a bug in this program
-        // itself.
-        assert(this->state.has_pending_address_packet == false);
-        assert(this->state.prev_location.has_value() == true);
-
-#if defined(CACHE_MODE)
-        const TraceKey trace_key(this->state.prev_location.value(),
-                                 packet.en_bits, packet.en_bits_len);
-
-        // Check for edge coverage in the cache, calculated from the same trace
-        // data and starting address. If it exists, we can skip the decoding
-        // process of a atom packet.
-        if (this->data.cache.isCachedTrace(trace_key)) {
-          AtomTrace trace = this->data.cache.getTraceCache(trace_key);
-
-          this->state.prev_location = trace.locations.back();
-          this->state.has_pending_address_packet =
-              trace.has_pending_address_packet;
-
-          trace.writeBitmapKeys(this->data.bitmap);
-#if defined(PRINT_EDGE_COV)
-          trace.printTraceLocations(this->state.memory_maps);
-#endif
-        } else {
-          AtomTrace trace = processAtomPacket(packet);
-
-          trace.writeBitmapKeys(this->data.bitmap);
-#if defined(PRINT_EDGE_COV)
-          trace.printTraceLocations(this->state.memory_maps);
-#endif
-
-          this->data.cache.addTraceCache(trace_key, trace);
-        }
-#else
-        AtomTrace trace = processAtomPacket(packet);
-        // Write bitmap
-        trace.writeBitmapKeys(this->data.bitmap);
-#if defined(PRINT_EDGE_COV)
-        trace.printTraceLocations(state.memory_maps);
-#endif
-#endif
-        break;
-      }
-
       case PacketType::ETM4_PKT_I_ADDR_S_IS0:
       case PacketType::ETM4_PKT_I_ADDR_L_64IS0:
       case PacketType::ETM4_PKT_I_ADDR_CTXT_L_64IS0: {
@@ -178,19 +368,24 @@ ProcessResultType Process::run(const std::uint8_t *trace_data_addr,
         // In the case of b, there is no need to decode it, so ignore it.
 
         if (state.has_pending_address_packet) {
-          // Check if the destination address jumped by the indirect branch is
-          // on the memory map.
-          const std::optional<AddressTrace> optional_trace =
-              processAddressPacket(packet);
-
-          if (optional_trace.has_value()) {
-            AddressTrace trace = optional_trace.value();
-
-            trace.calculateBitmapKey(this->data.bitmap.size);
-            trace.writeBitmapKey(this->data.bitmap);
-#if defined(PRINT_EDGE_COV)
-            trace.printTraceLocation(state.memory_maps);
-#endif
+          if constexpr (cache_mode != CacheMode::NONE) {
+            const std::optional<AddressTrace> optional_trace =
+                processIndirectTargetCache(packet);
+            if (optional_trace.has_value()) {
+              this->writeAddressTrace<sinks>(optional_trace.value());
+            }
+          } else {
+            // Check if the destination address jumped by the indirect branch
+            // is on the memory map.
+            const std::optional<AddressTrace> optional_trace =
+                processAddressPacket(packet);
+
+            if (optional_trace.has_value()) {
+              AddressTrace trace = optional_trace.value();
+
+              calculateBitmapKey(trace);
+              this->writeAddressTrace<sinks>(trace);
+            }
           }
         }
         break;
@@ -228,6 +423,30 @@ ProcessResultType Process::run(const std::uint8_t *trace_data_addr,
       break;
     }
 
+    case DecodeState::UNMAPPED: {
+      // The atom packets are skipped above. Only an address packet on the
+      // memory maps brings the trace back, since the exceptions and the trace
+      // on packets in the unmapped code are followed by address packets too.
+      // No edge is added from the unmapped code.
+      switch (packet.type) {
+      case PacketType::ETM4_PKT_I_ADDR_S_IS0:
+      case PacketType::ETM4_PKT_I_ADDR_L_64IS0:
+      case PacketType::ETM4_PKT_I_ADDR_CTXT_L_64IS0: {
+        const std::optional<Location> optional_location =
+            getLocation(this->state.memory_maps, packet.addr);
+        if (optional_location.has_value()) {
+          this->state.prev_location = optional_location;
+          this->decoder.state = DecodeState::TRACE;
+        }
+        break;
+      }
+
+      default:
+        break;
+      }
+      break;
+    }
+
     case DecodeState::EXCEPTION_ADDR1: {
       if (packet.type == PacketType::ETM4_PKT_I_ADDR_L_64IS0) {
         this->decoder.state = DecodeState::EXCEPTION_ADDR2;
@@ -250,46 +469,195 @@ ProcessResultType Process::run(const std::uint8_t *trace_data_addr,
   return ProcessResultType::PROCESS_SUCCESS;
 }
 
-AtomTrace Process::processAtomPacket(const Packet &atom_packet) {
-  assert(state.prev_location.has_value() == true);
+template <CacheMode cache_mode, OutputSinks sinks>
+void Process::processAtoms(const std::uint32_t en_bits,
+                           const std::size_t en_bits_len) {
+  // When processing an atom packet, there is an unprocessed indirect branch
+  // instruction. If there is an unprocessed indirect branch instruction, there
+  // must be an address packet, not an atom packet. When this error occurs,
+  // there is probably a bug in this program itself.
+  assert(this->state.has_pending_address_packet == false);
+  assert(this->state.prev_location.has_value() == true);
+  this->stats.atoms += en_bits_len;
+
+  if constexpr (cache_mode == CacheMode::TRACE) {
+    const TraceKey trace_key(this->state.prev_location.value(), en_bits,
+                             en_bits_len);
+
+    // Check for edge coverage in the cache, calculated from the same trace
+    // data and starting address. If it exists, we can skip the decoding
+    // process of a atom packet.
+    const AtomTrace *cached_trace = this->data.cache.findTraceCache(trace_key);
+    if (cached_trace != nullptr) {
+      ++this->stats.trace_cache_hits;
+
+      this->state.prev_location = cached_trace->locations.back();
+      this->state.has_pending_address_packet =
+          cached_trace->has_pending_address_packet;
+
+      this->writeAtomTrace<sinks>(*cached_trace);
+    } else {
+      ++this->stats.trace_cache_misses;
+      AtomTrace trace = processAtomPacket<cache_mode>(en_bits, en_bits_len);
 
-  AtomTrace trace = AtomTrace(state.prev_location.value());
+      this->writeAtomTrace<sinks>(trace);
 
-  for (std::size_t i = 0; i < atom_packet.en_bits_len; ++i) {
-    const Location base_location = state.prev_location.value();
+      this->data.cache.addTraceCache(trace_key, std::move(trace));
+    }
+  } else {
+    AtomTrace trace = processAtomPacket<cache_mode>(en_bits, en_bits_len);
+    this->writeAtomTrace<sinks>(trace);
+  }
+}
 
-    const BranchInsn insn = processNextBranchInsn(base_location);
+template <OutputSinks sinks>
+void Process::writeAtomTrace(const AtomTrace &trace) {
+  if constexpr (sinks & SINK_BITMAP) {
+    trace.writeBitmapKeys(*this->bitmap);
+  }
+  if constexpr (sinks & (SINK_EDGE_LIST | SINK_EDGE_CALLBACK | SINK_EDGE_LOG |
+                         SINK_EDGE_PROFILE)) {
+    for (std::size_t i = 0, len = trace.locations.size() - 1; i < len; ++i) {
+      if constexpr (sinks & SINK_EDGE_LIST) {
+        this->edge_list_sink.addEdge(trace.locations[i],
+                                     trace.locations[i + 1]);
+      }
+      if constexpr (sinks & SINK_EDGE_CALLBACK) {
+        this->edge_callback_sink.addEdge(trace.locations[i],
+                                         trace.locations[i + 1]);
+      }
+      if constexpr (sinks & SINK_EDGE_LOG) {
+        this->edge_log_sink.addEdge(trace.locations[i],
+                                    trace.locations[i + 1]);
+      }
+      if constexpr (sinks & SINK_EDGE_PROFILE) {
+        this->edge_profile_sink.addEdge(trace.locations[i],
+                                        trace.locations[i + 1]);
+      }
+    }
+  }
+}
 
-    bool is_taken = atom_packet.en_bits & (1 << i);
+template <OutputSinks sinks>
+void Process::writeAddressTrace(const AddressTrace &trace) {
+  if constexpr (sinks & SINK_BITMAP) {
+    trace.writeBitmapKey(*this->bitmap);
+  }
+  if constexpr (sinks & SINK_EDGE_LIST) {
+    this->edge_list_sink.addEdge(trace.src_location, trace.dest_location);
+  }
+  if constexpr (sinks & SINK_EDGE_CALLBACK) {
+    this->edge_callback_sink.addEdge(trace.src_location, trace.dest_location);
+  }
+  if constexpr (sinks & SINK_EDGE_LOG) {
+    this->edge_log_sink.addEdge(trace.src_location, trace.dest_location);
+  }
+  if constexpr (sinks & SINK_EDGE_PROFILE) {
+    this->edge_profile_sink.addEdge(trace.src_location, trace.dest_location);
+  }
+}
 
-    // In the case of an indirect branch instruction, an atom packet (E) and an
-    // address packet are generated. Therefore, after consuming the atom packet,
-    // the address packet is processed.
-    if (insn.type == BranchType::INDIRECT_BRANCH) {
-      // The atom packet generated by an indirect branch instruction is E
-      assert(is_taken == true);
-      // The next packet generated after the atom packet is an address packet.
-      // Therefore, this is the end of the atom packet.
-      assert(i == atom_packet.en_bits_len - 1);
+void Process::flushSinks() {
+  if (this->data.options.sinks & SINK_EDGE_LIST) {
+    this->edge_list_sink.flush();
+  }
+  if (this->data.options.sinks & SINK_EDGE_CALLBACK) {
+    this->edge_callback_sink.flush();
+  }
+  if (this->data.options.sinks & SINK_EDGE_LOG) {
+    this->edge_log_sink.flush();
+  }
+}
 
-      // Next, it is expected that an address packet, which indicates the jump
-      // destination address of the indirect branch, will be processed.
-      this->state.has_pending_address_packet = true;
-      trace.setPendingAddressPacket();
-    } else {
-      const addr_t next_offset =
-          (is_taken) ? insn.taken_offset : insn.not_taken_offset;
-      const addr_t next_id = insn.id;
-      const Location next_location = Location(next_offset, next_id);
+template <CacheMode cache_mode>
+AtomTrace Process::processAtomPacket(const std::uint32_t en_bits,
+                                     const std::size_t en_bits_len) {
+  assert(state.prev_location.has_value() == true);
 
-      // Add branch destination address by direct branch
-      trace.addLocation(next_location);
-      this->state.prev_location = next_location;
+  AtomTrace trace =
+      AtomTrace(state.prev_location.value(), this->data.cache.resource);
+
+  if constexpr (cache_mode != CacheMode::NONE) {
+    // The branch instruction cache holds the bitmap keys of both outgoing edges
+    // and the indices of both successor blocks. Therefore, once the blocks are
+    // cached, the atoms are decoded just by walking the table.
+    std::size_t index = processBranchInsnCache(state.prev_location.value());
+
+    for (std::size_t i = 0; i < en_bits_len; ++i) {
+      const BranchInsnCacheEntry &entry = this->data.cache.branch_insns[index];
+      const BranchInsn &insn = entry.insn;
+
+      bool is_taken = en_bits & (1 << i);
+
+      if (insn.type == BranchType::INDIRECT_BRANCH) {
+        // See below for the indirect branch instruction.
+        assert(is_taken == true);
+        assert(i == en_bits_len - 1);
+
+        this->state.has_pending_address_packet = true;
+        trace.setPendingAddressPacket();
+      } else {
+        const addr_t next_offset =
+            (is_taken) ? insn.taken_offset : insn.not_taken_offset;
+        const Location next_location = Location(next_offset, insn.id);
+
+        trace.addLocation(next_location);
+        trace.addBitmapKey(is_taken ? entry.taken_bitmap_key
+                                    : entry.not_taken_bitmap_key);
+        this->state.prev_location = next_location;
+
+        // The successor block is needed only if there are more atoms. Note
+        // that this may add a new entry to the cache and invalidate the
+        // reference to the current entry.
+        if (i + 1 < en_bits_len) {
+          index = processSuccessorBranchInsn(index, is_taken);
+        }
+      }
+    }
+  } else {
+    for (std::size_t i = 0; i < en_bits_len; ++i) {
+      const Location base_location = state.prev_location.value();
+
+      const BranchInsn insn = processNextBranchInsn(base_location);
+
+      bool is_taken = en_bits & (1 << i);
+
+      // In the case of an indirect branch instruction, an atom packet (E) and
+      // an address packet are generated. Therefore, after consuming the atom
+      // packet, the address packet is processed.
+      if (insn.type == BranchType::INDIRECT_BRANCH) {
+        // The atom packet generated by an indirect branch instruction is E
+        assert(is_taken == true);
+        // The next packet generated after the atom packet is an address
+        // packet. Therefore, this is the end of the atom packet.
+        assert(i == en_bits_len - 1);
+
+        // Next, it is expected that an address packet, which indicates the
+        // jump destination address of the indirect branch, will be processed.
+        this->state.has_pending_address_packet = true;
+        trace.setPendingAddressPacket();
+      } else {
+        const addr_t next_offset =
+            (is_taken) ? insn.taken_offset : insn.not_taken_offset;
+        const addr_t next_id = insn.id;
+        const Location next_location = Location(next_offset, next_id);
+
+        // Add branch destination address by direct branch
+        trace.addLocation(next_location);
+        this->state.prev_location = next_location;
+
+        if (this->data.edge_map.has_value()) {
+          trace.addBitmapKey(this->data.edge_map->getDirectEdgeKey(
+              insn, is_taken, this->data.bitmap.size));
+        }
+      }
     }
-  }
 
-  // Create bitmap keys from the trace generated by the Direct Branch
-  trace.calculateBitmapKeys(this->data.bitmap.size);
+    // Create bitmap keys from the trace generated by the Direct Branch
+    if (not this->data.edge_map.has_value()) {
+      trace.calculateBitmapKeys(this->data.bitmap.size);
+    }
+  }
 
   return trace;
 }
@@ -299,10 +667,11 @@ Process::processAddressPacket(const Packet &address_packet) {
   const std::optional<Location> optional_dest_location =
       getLocation(state.memory_maps, address_packet.addr);
 
-  // The memory image corresponding to the target address does not exist.
+  // The memory image corresponding to the target address does not exist. The
+  // trace has left the memory maps, e.g. into a library left out of them.
   if (not optional_dest_location.has_value()) {
-    this->state.prev_location = std::nullopt;
-    this->state.has_pending_address_packet = false;
+    ++this->stats.page_faults;
+    leaveTracedRegion();
     return std::nullopt;
   }
 
@@ -328,52 +697,223 @@ Process::processAddressPacket(const Packet &address_packet) {
   }
 }
 
+void Process::leaveTracedRegion() {
+  this->state.prev_location = std::nullopt;
+  this->state.has_pending_address_packet = false;
+  this->decoder.state = DecodeState::UNMAPPED;
+}
+
+// Switches to the context session of the current context ID, or to the
+// target. The trace of the new context resumes at its next address packet, as
+// after a trace on packet.
+void Process::switchContext() {
+  this->routed_context_id = this->decoder.context_id;
+
+  std::optional<std::size_t> index;
+  if (this->decoder.context_id.has_value()) {
+    for (std::size_t i = 0; i < this->context_sessions.size(); ++i) {
+      if (this->context_sessions[i].context_id ==
+          this->decoder.context_id.value()) {
+        index = i;
+        break;
+      }
+    }
+  }
+  if (index == this->active_context_session) {
+    return;
+  }
+
+  activateContextSession(index);
+  ++this->stats.context_session_switches;
+  if (this->decoder.state != DecodeState::UNMAPPED) {
+    leaveTracedRegion();
+  }
+}
+
+void Process::activateContextSession(const std::optional<std::size_t> index) {
+  if (index == this->active_context_session) {
+    return;
+  }
+
+  // The memory maps of the active session are swapped with the target's, so
+  // swapping them again switches back to the target.
+  bool has_same_memory_maps = true;
+  if (this->active_context_session.has_value()) {
+    ContextSession &session =
+        this->context_sessions[this->active_context_session.value()];
+    std::swap(this->state.memory_maps, session.memory_maps);
+    has_same_memory_maps = session.has_same_memory_maps;
+  }
+  this->bitmap = &this->data.bitmap;
+
+  if (index.has_value()) {
+    ContextSession &session = this->context_sessions[index.value()];
+    std::swap(this->state.memory_maps, session.memory_maps);
+    has_same_memory_maps =
+        has_same_memory_maps and session.has_same_memory_maps;
+    this->bitmap = &session.bitmap;
+  }
+  this->active_context_session = index;
+
+  // The locations of the target addresses depend on the memory maps.
+  if (not has_same_memory_maps) {
+    this->data.cache.invalidateIndirectTargetCache();
+  }
+}
+
+std::optional<AddressTrace>
+Process::processIndirectTargetCache(const Packet &address_packet) {
+  assert(this->state.prev_location.has_value() == true);
+
+  const Location src_location = this->state.prev_location.value();
+  IndirectTargetCacheEntry &entry = this->data.cache.getIndirectTargetCache(
+      src_location, address_packet.addr);
+
+  // The same indirect branch jumps to the same target, e.g. a return to the
+  // same call site, so the location and the bitmap key are looked up at once.
+  if (entry.matches(src_location, address_packet.addr,
+                    this->data.cache.indirect_target_generation)) {
+    ++this->stats.indirect_target_cache_hits;
+    this->state.prev_location = entry.dest_location;
+    this->state.has_pending_address_packet = false;
+
+    AddressTrace trace(src_location, entry.dest_location);
+    trace.bitmap_key = entry.bitmap_key;
+    return trace;
+  }
+  ++this->stats.indirect_target_cache_misses;
+
+  std::optional<AddressTrace> optional_trace =
+      processAddressPacket(address_packet);
+  if (optional_trace.has_value()) {
+    AddressTrace &trace = optional_trace.value();
+    calculateBitmapKey(trace);
+
+    entry.src_location = src_location;
+    entry.target_address = address_packet.addr;
+    entry.dest_location = trace.dest_location;
+    entry.bitmap_key = trace.bitmap_key;
+    entry.generation = this->data.cache.indirect_target_generation;
+  }
+  return optional_trace;
+}
+
 BranchInsn Process::processNextBranchInsn(const Location &base_location) {
-  // Find the next branch instruction.
-  BranchInsn insn{};
-  {
-#if defined(CACHE_MODE)
-    // Create a key to access the cache.
-    const Location insn_key(base_location.offset, base_location.id);
-
-    // Access the cache and check if the same offset of the same memory image
-    // has already been disassembled.
-    //  If the data exists in the cache, there is no need to disassemble it.
-    if (this->data.cache.isCachedBranchInsn(insn_key)) {
-      // Since the results of the disassembly are already in the cache, read the
-      // data from the cache.
-      insn = this->data.cache.getBranchInsnCache(insn_key);
+  const StatsTimer timer(this->stats.disassemble_ns);
+
+  // Disassemble the instruction sequence and find a branch instruction.
+  const BranchInsn insn = getNextBranchInsn(this->data.handle, base_location,
+                                            this->data.memory_images);
+
+  // The instructions are disassembled one by one up to the branch instruction.
+  this->stats.disassembled_insns +=
+      (insn.offset - base_location.offset) / A64_INSN_SIZE + 1;
+  return insn;
+}
+
+std::size_t Process::processBranchInsnCache(const Location &base_location) {
+  // Access the cache and check if the same offset of the same memory image
+  // has already been disassembled.
+  //  If the data exists in the cache, there is no need to disassemble it.
+  const std::optional<std::size_t> optional_index =
+      this->data.cache.findBranchInsnCache(base_location);
+  if (optional_index.has_value()) {
+    ++this->stats.branch_cache_hits;
+    return optional_index.value();
+  }
+  ++this->stats.branch_cache_misses;
+
+  // A location in the middle of a block already disassembled, e.g. the return
+  // address after a call, reaches the same branch instruction. Only the bitmap
+  // keys differ, since they depend on the start of the block.
+  std::optional<BranchInsn> optional_insn =
+      this->data.cache.findBlockInterval(base_location);
+  if (optional_insn.has_value()) {
+    ++this->stats.block_interval_hits;
+  } else {
+    optional_insn = processNextBranchInsn(base_location);
+    this->data.cache.addBlockInterval(base_location, optional_insn.value());
+  }
+  const BranchInsn &insn = optional_insn.value();
+
+  // Calculate the bitmap keys of both outgoing edges from the block, so that
+  // they are never calculated again.
+  std::size_t taken_bitmap_key = 0;
+  std::size_t not_taken_bitmap_key = 0;
+  if (insn.type != BranchType::INDIRECT_BRANCH) {
+    if (this->data.edge_map.has_value()) {
+      taken_bitmap_key = this->data.edge_map->getDirectEdgeKey(
+          insn, true, this->data.bitmap.size);
+      not_taken_bitmap_key = this->data.edge_map->getDirectEdgeKey(
+          insn, false, this->data.bitmap.size);
     } else {
-      // Disassemble the instruction sequence and find a branch instruction.
-      insn = getNextBranchInsn(this->data.handle, base_location,
-                               this->data.memory_images);
-      // Add the result of disassembling the branch instruction to the cache
-      this->data.cache.addBranchInsnCache(insn_key, insn);
-    }
-#else
-    // Disassemble the instruction sequence and find a branch instruction.
-    insn = getNextBranchInsn(this->data.handle, base_location,
-                             this->data.memory_images);
-#endif
+      taken_bitmap_key =
+          generateBitmapKey(base_location, Location(insn.taken_offset, insn.id),
+                            this->data.bitmap.size);
+      not_taken_bitmap_key = generateBitmapKey(
+          base_location, Location(insn.not_taken_offset, insn.id),
+          this->data.bitmap.size);
+    }
   }
-  return insn;
+
+  // Add the result of disassembling the branch instruction to the cache
+  const BranchInsnCacheEntry entry(insn, taken_bitmap_key,
+                                   not_taken_bitmap_key);
+  return this->data.cache.addBranchInsnCache(base_location, entry);
+}
+
+std::size_t Process::processSuccessorBranchInsn(const std::size_t index,
+                                                const bool is_taken) {
+  const BranchInsnCacheEntry &entry = this->data.cache.branch_insns[index];
+
+  const std::size_t successor_index =
+      is_taken ? entry.taken_index : entry.not_taken_index;
+  if (successor_index != BranchInsnCacheEntry::NO_INDEX) {
+    ++this->stats.branch_cache_hits;
+    return successor_index;
+  }
+
+  const addr_t next_offset =
+      is_taken ? entry.insn.taken_offset : entry.insn.not_taken_offset;
+  const Location next_location(next_offset, entry.insn.id);
+
+  // Link the successor block to the current entry. The current entry must be
+  // accessed by the index again, because the cache may have been grown.
+  const std::size_t next_index = processBranchInsnCache(next_location);
+  if (is_taken) {
+    this->data.cache.branch_insns[index].taken_index = next_index;
+  } else {
+    this->data.cache.branch_insns[index].not_taken_index = next_index;
+  }
+
+  return next_index;
 }
 
-// SDBM Hash Function ref: http://www.cse.yorku.ca/~oz/hash.html
-std::uint64_t hashBuffer(std::uint64_t hash, char *buf, std::size_t size) {
-  for (std::size_t i = 0; i < size; i++) {
-    hash = (std::uint64_t)buf[i] + (hash << 6) + (hash << 16) - hash;
+void Process::calculateBitmapKey(AddressTrace &trace) {
+  if (this->data.edge_map.has_value()) {
+    trace.bitmap_key = this->data.edge_map->getDynamicEdgeKey(
+        trace.src_location, trace.dest_location, this->data.bitmap.size);
+  } else {
+    trace.calculateBitmapKey(this->data.bitmap.size);
   }
-  return hash;
 }
 
-std::uint64_t hashString(std::uint64_t hash, std::string &str) {
-  return hashBuffer(hash, (char *)str.c_str(), str.size());
+// Mix a 64-bit word into the hash. This is the body step of MurmurHash3
+// (x64 variant), which consumes a whole word at a time instead of a byte.
+// ref: https://github.com/aappleby/smhasher/blob/master/src/MurmurHash3.cpp
+std::uint64_t hashWord(std::uint64_t hash, std::uint64_t word) {
+  word *= 0x87c37b91114253d5ULL;
+  word = (word << 31U) | (word >> 33U);
+  word *= 0x4cf5ad432745937fULL;
+
+  hash ^= word;
+  hash = (hash << 27U) | (hash >> 37U);
+  return hash * 5 + 0x52dce729;
 }
 
 std::uint64_t hashLocation(std::uint64_t hash, const Location &loc) {
-  hash = hashBuffer(hash, (char *)&loc.offset, sizeof(loc.offset));
-  hash = hashBuffer(hash, (char *)&loc.id, sizeof(loc.id));
+  hash = hashWord(hash, loc.offset);
+  hash = hashWord(hash, loc.id);
   return hash;
 }
 
@@ -400,14 +940,196 @@ std::uint64_t mapHash(std::uint64_t hash, std::size_t bitmap_size) {
   return x & (bitmap_size - 1);
 }
 
+const TraceMemo::Entry *TraceMemo::find(const std::uint64_t key) const {
+  const auto it = this->entries.find(key);
+  if (it == this->entries.end()) {
+    return nullptr;
+  }
+  return &it->second;
+}
+
+void TraceMemo::add(const std::uint64_t key, Entry &&entry) {
+  const std::size_t entry_size =
+      sizeof(std::pair<const std::uint64_t, Entry>) +
+      entry.cells.size() * sizeof(BitmapCell);
+  if (entry_size > this->capacity) {
+    return;
+  }
+  if (this->size + entry_size > this->capacity) {
+    this->entries.clear();
+    this->size = 0;
+  }
+
+  this->entries.emplace(key, std::move(entry));
+  this->size += entry_size;
+}
+
+// The memory maps are hashed together with the trace data, since the bitmap
+// keys depend on where the images are mapped.
+static std::uint64_t hashMemoryMaps(std::uint64_t hash,
+                                    const std::vector<MemoryMap> &memory_maps) {
+  for (const MemoryMap &memory_map : memory_maps) {
+    hash = hashWord(hash, memory_map.start_address);
+    hash = hashWord(hash, memory_map.end_address);
+  }
+  return hash;
+}
+
+// The seed of the keys of a session. The context ID filter decides which part
+// of the trace data is decoded, so it is hashed too.
+static std::uint64_t
+hashSession(const std::vector<MemoryMap> &memory_maps,
+            const std::optional<std::uint32_t> &target_context_id) {
+  const std::uint64_t hash = hashMemoryMaps(0, memory_maps);
+  return hashWord(hash, target_context_id.has_value()
+                            ? (std::uint64_t(1) << 32) | *target_context_id
+                            : 0);
+}
+
+static std::uint64_t hashTraceData(std::uint64_t hash,
+                                   const std::uint8_t *trace_data,
+                                   const std::size_t size) {
+  std::size_t offset = 0;
+  for (; offset + sizeof(std::uint64_t) <= size;
+       offset += sizeof(std::uint64_t)) {
+    std::uint64_t word;
+    std::memcpy(&word, trace_data + offset, sizeof(word));
+    hash = hashWord(hash, word);
+  }
+  if (offset < size) {
+    std::uint64_t word = 0;
+    std::memcpy(&word, trace_data + offset, size - offset);
+    hash = hashWord(hash, word);
+  }
+  return hash;
+}
+
+// Restores the bitmap of the same session from the trace memo, or decodes the
+// trace data and adds the non-zero cells of the bitmap to the trace memo. The
+// bitmap is cleared by reset, so it holds only the cells of the session.
+ProcessResultType Process::finalWithTraceMemo() {
+  const std::pmr::vector<std::uint8_t> &trace_data = this->decoder.trace_data;
+  const std::uint64_t key = hashTraceData(
+      hashWord(hashSession(this->state.memory_maps,
+                           this->decoder.target_context_id),
+               trace_data.size()),
+      trace_data.data(), trace_data.size());
+  if (const TraceMemo::Entry *entry = this->data.trace_memo.find(key)) {
+    ++this->stats.trace_memo_hits;
+    this->data.bitmap.addCells(entry->cells);
+    return entry->result;
+  }
+  ++this->stats.trace_memo_misses;
+
+  const ProcessResultType result = decodeSegmentsWithTraceMemo();
+  TraceMemo::Entry entry{{}, result, TraceMemoState()};
+  this->data.bitmap.readCells(entry.cells);
+  this->data.trace_memo.add(key, std::move(entry));
+  return result;
+}
+
+// Decodes the trace data of the session a segment at a time. The segments are
+// passed to the decoder as if they were passed to run one by one, so decoding
+// a segment stops before the packet crossing its end, and the state depends
+// only on the trace data up to the end. The segments of the prefix shared with
+// the previous sessions are restored from the trace memo until the first miss.
+ProcessResultType Process::decodeSegmentsWithTraceMemo() {
+  const std::pmr::vector<std::uint8_t> trace_data =
+      std::move(this->decoder.trace_data);
+  this->decoder.trace_data = decltype(this->decoder.trace_data)(
+      trace_data.get_allocator());
+  this->decoder.trace_data.reserve(trace_data.size());
+
+  std::uint64_t key =
+      hashSession(this->state.memory_maps, this->decoder.target_context_id);
+  bool is_prefix = true;
+  std::vector<std::uint8_t> prev_bitmap;
+  std::size_t offset = 0;
+  for (; offset + TRACE_MEMO_SEGMENT_SIZE <= trace_data.size();
+       offset += TRACE_MEMO_SEGMENT_SIZE) {
+    const std::uint8_t *segment = trace_data.data() + offset;
+    key = hashTraceData(key, segment, TRACE_MEMO_SEGMENT_SIZE);
+    this->decoder.trace_data.insert(this->decoder.trace_data.end(), segment,
+                                    segment + TRACE_MEMO_SEGMENT_SIZE);
+
+    if (is_prefix) {
+      if (const TraceMemo::Entry *entry = this->data.trace_memo.find(key)) {
+        ++this->stats.trace_memo_segment_hits;
+        this->data.bitmap.addCells(entry->cells);
+        restoreTraceMemoState(entry->state);
+        if (entry->result != ProcessResultType::PROCESS_SUCCESS) {
+          return entry->result;
+        }
+        continue;
+      }
+      // The keys of the following segments include this segment.
+      is_prefix = false;
+    }
+    ++this->stats.trace_memo_segment_misses;
+
+    prev_bitmap.assign(this->data.bitmap.data,
+                       this->data.bitmap.data + this->data.bitmap.byteSize());
+    const ProcessResultType result = decodeTraceData();
+    TraceMemo::Entry entry{{}, result, saveTraceMemoState()};
+    this->data.bitmap.readDelta(prev_bitmap, entry.cells);
+    this->data.trace_memo.add(key, std::move(entry));
+    if (result != ProcessResultType::PROCESS_SUCCESS) {
+      return result;
+    }
+  }
+
+  // The rest is shorter than a segment.
+  this->decoder.trace_data.insert(this->decoder.trace_data.end(),
+                                  trace_data.begin() + offset,
+                                  trace_data.end());
+  return decodeTraceData();
+}
+
+TraceMemoState Process::saveTraceMemoState() const {
+  TraceMemoState state;
+  state.trace_data_offset = this->decoder.trace_data_offset;
+  state.decode_state = this->decoder.state;
+  state.is_synced = this->decoder.is_synced;
+  state.address_reg = this->decoder.address_reg;
+  state.context_id = this->decoder.context_id;
+  state.vmid = this->decoder.vmid;
+  state.prev_location = this->state.prev_location;
+  state.has_pending_address_packet = this->state.has_pending_address_packet;
+  return state;
+}
+
+void Process::restoreTraceMemoState(const TraceMemoState &state) {
+  this->decoder.trace_data_offset = state.trace_data_offset;
+  this->decoder.state = state.decode_state;
+  this->decoder.is_synced = state.is_synced;
+  this->decoder.address_reg = state.address_reg;
+  this->decoder.context_id = state.context_id;
+  this->decoder.vmid = state.vmid;
+  this->state.prev_location = state.prev_location;
+  this->state.has_pending_address_packet = state.has_pending_address_packet;
+}
+
 ProcessResultType PathProcess::run(const std::uint8_t *trace_data_addr,
                                    const std::size_t trace_data_size) {
-  this->deformatter.deformatTraceData(trace_data_addr, trace_data_size,
-                                      decoder.trace_data);
+  const struct iovec segment = {const_cast<std::uint8_t *>(trace_data_addr),
+                                trace_data_size};
+  return run(&segment, 1);
+}
+
+ProcessResultType PathProcess::run(const struct iovec *segments,
+                                   const std::size_t segment_num) {
+  deformatSegments(this->deformatter, this->decoder, this->stats, segments,
+                   segment_num);
 
+  const StatsTimer timer(this->stats.decode_ns);
   const std::size_t size = this->decoder.trace_data.size();
 
   while (this->decoder.trace_data_offset < size) {
+    if (not this->decoder.is_synced and
+        not syncDecoder(this->decoder, this->stats)) {
+      return ProcessResultType::PROCESS_SUCCESS;
+    }
+
     const Packet packet = this->decoder.decodePacket();
     DEBUG("%s\n", packet.toString().c_str());
 
@@ -419,118 +1141,235 @@ ProcessResultType PathProcess::run(const std::uint8_t *trace_data_addr,
     }
 
     this->decoder.trace_data_offset += packet.size;
+    this->stats.countPacket(packet.type);
 
-    switch (this->decoder.state) {
-    case DecodeState::START:
-    case DecodeState::TRACE: {
-      switch (packet.type) {
-      case PacketType::ETM4_PKT_I_ATOM_F1:
-      case PacketType::ETM4_PKT_I_ATOM_F2:
-      case PacketType::ETM4_PKT_I_ATOM_F3:
-      case PacketType::ETM4_PKT_I_ATOM_F4:
-      case PacketType::ETM4_PKT_I_ATOM_F5:
-      case PacketType::ETM4_PKT_I_ATOM_F6: {
-        // Convert EN bits to binary string.
-        std::size_t size =
-            std::min(packet.en_bits_len, MAX_ATOM_LEN - this->ctx_en_bits_len);
-        for (std::size_t i = 0; i < size; ++i) {
-          this->ctx_en_bits += (packet.en_bits & (1 << i)) ? '1' : '0';
+    // The packets are skipped until the next A-sync packet like Process.
+    if (packet.type == PacketType::PKT_UNKNOWN) {
+      this->coverage.leaveTracedRegion();
+      continue;
+    }
+
+    // The packets of other contexts are skipped like Process.
+    if (not this->decoder.isTargetContext()) {
+      if (this->coverage.state != DecodeState::UNMAPPED) {
+        if (this->decoder.context_id.has_value()) {
+          ++this->stats.context_switches;
         }
-        this->ctx_en_bits_len += size;
-        break;
+        this->coverage.leaveTracedRegion();
       }
+      this->stats.unmapped_atoms += packet.en_bits_len;
+      continue;
+    }
 
-      case PacketType::ETM4_PKT_I_ADDR_S_IS0:
-      case PacketType::ETM4_PKT_I_ADDR_L_64IS0:
-      case PacketType::ETM4_PKT_I_ADDR_CTXT_L_64IS0: {
-        const std::optional<Location> optional_target_location =
-            getLocation(this->memory_maps, packet.addr);
-        if (not optional_target_location.has_value()) {
-          return ProcessResultType::PROCESS_ERROR_PAGE_FAULT;
-        }
+    if (this->coverage.processPacket(packet, this->memory_maps, this->stats)) {
+      ++this->stats.page_faults;
+    }
+  }
 
-        const Location target_location = optional_target_location.value();
+  return ProcessResultType::PROCESS_SUCCESS;
+}
 
-        if (this->ctx_en_bits_len != 0) {
-          DEBUG("Update hash by EN bits: %s\n", this->ctx_en_bits.c_str());
-          this->ctx_hash = hashString(this->ctx_hash, ctx_en_bits);
-          this->ctx_en_bits = "";
-          this->ctx_en_bits_len = 0;
-        }
+void PathProcess::reset(std::vector<MemoryMap> &&memory_maps,
+                        std::uint8_t target_trace_id) {
+  this->deformatter.reset(target_trace_id);
+  this->decoder.reset();
+  this->memory_maps = std::move(memory_maps);
+  this->coverage.reset();
+}
 
-        DEBUG("Update hash by Address: (%ld, 0x%lx)\n", target_location.id,
-              target_location.offset);
-        this->ctx_hash = hashLocation(this->ctx_hash, target_location);
+ProcessResultType PathProcess::final() {
+  return ProcessResultType::PROCESS_SUCCESS;
+}
 
-        // XXX: We experimentally found that updating the bitmap
-        // only when the address count hits MAX_ADDRESS_LEN
-        // does not increase coverage. We modified the algorithm
-        // to update the bitmap every Address packet processing.
-        std::size_t index = mapHash(this->ctx_hash, this->bitmap.size);
-        this->bitmap.data[index]++;
+void PathCoverage::reset() {
+  this->bitmap.reset();
+  this->state = DecodeState::START;
+  resetContext();
+}
 
-        // Reset hash.
-        this->ctx_hash = 0;
-        break;
-      }
+void PathCoverage::leaveTracedRegion() {
+  resetContext();
+  this->state = DecodeState::UNMAPPED;
+}
 
-      case PacketType::ETM4_PKT_I_EXCEPT:
-        this->decoder.state = DecodeState::EXCEPTION_ADDR1;
-        break;
+void PathCoverage::resetContext() {
+  this->ctx_en_word = 0;
+  this->ctx_en_word_len = 0;
+  this->ctx_en_bits_len = 0;
+  this->ctx_hash = 0;
+}
 
-      case PacketType::ETM4_PKT_I_TRACE_ON:
-        this->decoder.state = DecodeState::WAIT_ADDR_AFTER_TRACE_ON;
-        break;
+bool PathCoverage::processPacket(const Packet &packet,
+                                 const std::vector<MemoryMap> &memory_maps,
+                                 Stats &stats) {
+  switch (this->state) {
+  case DecodeState::START:
+  case DecodeState::TRACE: {
+    switch (packet.type) {
+    case PacketType::ETM4_PKT_I_ATOM_F1:
+    case PacketType::ETM4_PKT_I_ATOM_F2:
+    case PacketType::ETM4_PKT_I_ATOM_F3:
+    case PacketType::ETM4_PKT_I_ATOM_F4:
+    case PacketType::ETM4_PKT_I_ATOM_F5:
+    case PacketType::ETM4_PKT_I_ATOM_F6:
+      stats.atoms += packet.en_bits_len;
+      processAtoms(packet.en_bits, packet.en_bits_len);
+      break;
 
-      default:
-        break;
+    case PacketType::ETM4_PKT_I_ADDR_S_IS0:
+    case PacketType::ETM4_PKT_I_ADDR_L_64IS0:
+    case PacketType::ETM4_PKT_I_ADDR_CTXT_L_64IS0: {
+      const std::optional<Location> optional_target_location =
+          getLocation(memory_maps, packet.addr);
+
+      // The trace has left the memory maps. The path to the unmapped code is
+      // dropped, since there is no target location to hash.
+      if (not optional_target_location.has_value()) {
+        leaveTracedRegion();
+        return true;
       }
+
+      processAddress(optional_target_location.value());
+      this->state = DecodeState::TRACE;
       break;
     }
 
-    case DecodeState::EXCEPTION_ADDR1: {
-      if (packet.type == PacketType::ETM4_PKT_I_ADDR_L_64IS0) {
-        this->decoder.state = DecodeState::EXCEPTION_ADDR2;
-      }
+    case PacketType::ETM4_PKT_I_EXCEPT:
+      this->state = DecodeState::EXCEPTION_ADDR1;
       break;
-    }
 
-    case DecodeState::EXCEPTION_ADDR2: {
-      if (packet.type == PacketType::ETM4_PKT_I_ADDR_L_64IS0) {
-        this->decoder.state = DecodeState::TRACE;
-      }
+    case PacketType::ETM4_PKT_I_TRACE_ON:
+      this->state = DecodeState::WAIT_ADDR_AFTER_TRACE_ON;
+      break;
+
+    default:
       break;
     }
+    break;
+  }
 
-    case DecodeState::WAIT_ADDR_AFTER_TRACE_ON: {
-      if (packet.type == PacketType::ETM4_PKT_I_ADDR_S_IS0 ||
-          packet.type == PacketType::ETM4_PKT_I_ADDR_L_64IS0 ||
-          packet.type == PacketType::ETM4_PKT_I_ADDR_CTXT_L_64IS0) {
-        this->decoder.state = DecodeState::TRACE;
+  // Like the edge coverage, the atoms are skipped until an address packet on
+  // the memory maps, which starts a new path.
+  case DecodeState::UNMAPPED: {
+    switch (packet.type) {
+    case PacketType::ETM4_PKT_I_ATOM_F1:
+    case PacketType::ETM4_PKT_I_ATOM_F2:
+    case PacketType::ETM4_PKT_I_ATOM_F3:
+    case PacketType::ETM4_PKT_I_ATOM_F4:
+    case PacketType::ETM4_PKT_I_ATOM_F5:
+    case PacketType::ETM4_PKT_I_ATOM_F6:
+      stats.unmapped_atoms += packet.en_bits_len;
+      break;
+
+    case PacketType::ETM4_PKT_I_ADDR_S_IS0:
+    case PacketType::ETM4_PKT_I_ADDR_L_64IS0:
+    case PacketType::ETM4_PKT_I_ADDR_CTXT_L_64IS0: {
+      const std::optional<Location> optional_target_location =
+          getLocation(memory_maps, packet.addr);
+      if (optional_target_location.has_value()) {
+        processAddress(optional_target_location.value());
+        this->state = DecodeState::TRACE;
       }
       break;
     }
 
     default:
-      __builtin_unreachable();
+      break;
     }
+    break;
   }
 
-  return ProcessResultType::PROCESS_SUCCESS;
+  case DecodeState::EXCEPTION_ADDR1: {
+    if (packet.type == PacketType::ETM4_PKT_I_ADDR_L_64IS0) {
+      this->state = DecodeState::EXCEPTION_ADDR2;
+    }
+    break;
+  }
+
+  case DecodeState::EXCEPTION_ADDR2: {
+    if (packet.type == PacketType::ETM4_PKT_I_ADDR_L_64IS0) {
+      this->state = DecodeState::TRACE;
+    }
+    break;
+  }
+
+  case DecodeState::WAIT_ADDR_AFTER_TRACE_ON: {
+    if (packet.type == PacketType::ETM4_PKT_I_ADDR_S_IS0 ||
+        packet.type == PacketType::ETM4_PKT_I_ADDR_L_64IS0 ||
+        packet.type == PacketType::ETM4_PKT_I_ADDR_CTXT_L_64IS0) {
+      // The trace may resume in the unmapped code.
+      if (not getLocation(memory_maps, packet.addr).has_value()) {
+        leaveTracedRegion();
+        return true;
+      }
+      this->state = DecodeState::TRACE;
+    }
+    break;
+  }
+
+  default:
+    __builtin_unreachable();
+  }
+
+  return false;
 }
 
-void PathProcess::reset(std::vector<MemoryMap> &&memory_maps,
-                        std::uint8_t target_trace_id) {
-  this->bitmap.reset();
-  this->deformatter.reset(target_trace_id);
-  this->decoder.reset();
-  this->memory_maps = std::move(memory_maps);
+void PathCoverage::processAddress(const Location &target_location) {
+  if (this->ctx_en_bits_len != 0) {
+    DEBUG("Update hash by EN bits: %ld bits\n", this->ctx_en_bits_len);
+    // Mix the rest of the bits and the length of the history, so that
+    // histories that differ only in trailing N atoms are distinguished.
+    this->ctx_hash = hashWord(this->ctx_hash, this->ctx_en_word);
+    this->ctx_hash = hashWord(this->ctx_hash, this->ctx_en_bits_len);
+    this->ctx_en_word = 0;
+    this->ctx_en_word_len = 0;
+    this->ctx_en_bits_len = 0;
+  }
 
-  this->ctx_en_bits = "";
-  this->ctx_en_bits_len = 0;
+  DEBUG("Update hash by Address: (%ld, 0x%lx)\n", target_location.id,
+        target_location.offset);
+  this->ctx_hash = hashLocation(this->ctx_hash, target_location);
+
+  // XXX: We experimentally found that updating the bitmap
+  // only when the address count hits MAX_ADDRESS_LEN
+  // does not increase coverage. We modified the algorithm
+  // to update the bitmap every Address packet processing.
+  std::size_t index = mapHash(this->ctx_hash, this->bitmap.size);
+  this->bitmap.writeKey(index);
+
+  // Reset hash.
   this->ctx_hash = 0;
 }
 
-ProcessResultType PathProcess::final() {
-  return ProcessResultType::PROCESS_SUCCESS;
+void PathCoverage::processAtoms(const std::uint32_t en_bits,
+                                const std::size_t en_bits_len) {
+  // The atoms are ignored while waiting for the address packets of an
+  // exception or a trace on packet.
+  if (this->state != DecodeState::START and
+      this->state != DecodeState::TRACE) {
+    return;
+  }
+
+  // Append EN bits to the packed history. A word is mixed into the hash as
+  // soon as it is filled, so the history never has to be stored.
+  const std::size_t size =
+      std::min(en_bits_len, this->max_atom_len - this->ctx_en_bits_len);
+  if (size == 0) {
+    return;
+  }
+
+  const std::uint64_t bits = en_bits & ((std::uint64_t(1) << size) - 1);
+  this->ctx_en_word |= bits << this->ctx_en_word_len;
+  this->ctx_en_word_len += size;
+
+  if (this->ctx_en_word_len >= 64) {
+    this->ctx_hash = hashWord(this->ctx_hash, this->ctx_en_word);
+    this->ctx_en_word_len -= 64;
+    // The bits that did not fit in the previous word.
+    this->ctx_en_word =
+        (this->ctx_en_word_len != 0) ? bits >> (size - this->ctx_en_word_len)
+                                     : 0;
+  }
+
+  this->ctx_en_bits_len += size;
 }
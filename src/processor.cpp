@@ -4,6 +4,7 @@
 #include <cassert>
 #include <cstdint>
 #include <cstring>
+#include <fstream>
 #include <iostream>
 #include <linux/limits.h>
 #include <vector>
@@ -14,7 +15,9 @@
 #include "decoder.hpp"
 #include "deformatter.hpp"
 #include "disassembler.hpp"
+#include "edgemap.hpp"
 #include "process.hpp"
+#include "tracepack.hpp"
 #include "utils.hpp"
 
 void usage(const char *argv0) {
@@ -35,9 +38,82 @@ void usage(const char *argv0) {
             << "\t--bitmap-type={edge,path} : Specify the coverage type. The "
                "default type is edge."
             << std::endl
+            << "\t--bitmap-cell-width={8,16,32} : Specify the width of a "
+               "bitmap cell in bits. The default width is 8."
+            << std::endl
+            << "\t--bitmap-key={hash,id}   : Specify how edges are mapped to "
+               "the bitmap. The default is hash. With id, every edge gets a "
+               "unique key and the bitmap size specifies the number of cells "
+               "reserved for indirect edges."
+            << std::endl
+            << "\t--cache-mode={none,branch,trace} : Specify what is cached "
+               "during decoding. The default mode is trace."
+            << std::endl
+            << "\t--max-atom-len=num        : Specify the maximum number of "
+               "atoms hashed between two address packets in the path coverage. "
+               "The default number is 4096."
+            << std::endl
+            << "\t--print-edge-cov          : Print the edge coverage to "
+               "stdout."
+            << std::endl
+            << "\t--edge-log=name           : Write the edge coverage to the "
+               "file in the edge log format."
+            << std::endl
+            << "\t--edge-profile=name       : Count the edges and write the "
+               "profile of each binary file to name.<index> in the "
+               "unsymbolized profile format of llvm-profgen."
+            << std::endl
+            << "\t--path-bitmap-filename=name : Calculate the path coverage "
+               "in the same pass as the edge coverage, and save its bitmap to "
+               "the file. The bitmap has the same size and cell width as the "
+               "edge coverage bitmap."
+            << std::endl
+            << "\t--context-id=id           : Decode only the trace of the "
+               "context ID in hexadecimal, e.g. the PID of the target in a "
+               "CPU-wide trace."
+            << std::endl
+            << "\t--context-bitmap=id,name  : Decode the trace of the context "
+               "ID in hexadecimal into its own bitmap with the same memory "
+               "maps, and save it to the file. The option can be repeated. The "
+               "bitmap must be the only output."
+            << std::endl
+            << "\t--huge-pages              : Back the caches with transparent "
+               "huge pages."
+            << std::endl
+            << "\t--stats                   : Print the statistics of the "
+               "decoder internals to stderr."
+            << std::endl
             << std::endl;
 }
 
+// Decodes the trace data, or the trace pack one block at a time, so that the
+// whole trace data is never decompressed into memory.
+template <typename P>
+static ProcessResultType runTraceData(P &process,
+                                      const std::vector<std::uint8_t> &data) {
+  if (not isTracePack(data.data(), data.size())) {
+    return process.run(data.data(), data.size());
+  }
+
+  const TracePackReader reader(data.data(), data.size());
+  if (reader.failed) {
+    std::exit(1);
+  }
+  std::vector<std::uint8_t> block;
+  for (std::size_t i = 0; i < reader.blocks.size(); ++i) {
+    if (not reader.readBlock(i, block)) {
+      std::cerr << "Failed to decompress the block " << std::dec << i
+                << " of the trace pack." << std::endl;
+      std::exit(1);
+    }
+    const ProcessResultType result = process.run(block.data(), block.size());
+    if (result != ProcessResultType::PROCESS_SUCCESS) {
+      return result;
+    }
+  }
+  return ProcessResultType::PROCESS_SUCCESS;
+}
+
 int main(int argc, char const *argv[]) {
   checkCapstoneVersion();
 
@@ -63,9 +139,20 @@ int main(int argc, char const *argv[]) {
   std::uint64_t bitmap_size = BITMAP_SIZE;
   std::string bitmap_filename = BITMAP_FILENAME;
   std::string bitmap_type = "edge";
+  BitmapCellType bitmap_cell_type = BitmapCellType::U8;
+  std::string bitmap_key = "hash";
+  std::string path_bitmap_filename;
+  std::string edge_profile_filename;
+  bool print_stats = false;
+  bool use_huge_pages = false;
+  std::optional<std::uint32_t> target_context_id;
+  std::vector<std::pair<std::uint32_t, std::string>> context_bitmap_filenames;
+  ProcessOptions options;
   std::vector<std::string> trace_binary_filenames;
   for (int i = binary_file_num * 3 + 4; i < argc; ++i) {
     std::uint64_t size = 0;
+    int width = 0;
+    std::uint32_t context_id = 0;
     char buf[PATH_MAX];
     if (sscanf(argv[i], "--bitmap-size=%lx", &size) == 1) {
       // Check if the size is a power of two.
@@ -79,6 +166,54 @@ int main(int argc, char const *argv[]) {
       bitmap_filename = std::string(buf);
     } else if (sscanf(argv[i], "--bitmap-type=%s", buf) == 1) {
       bitmap_type = std::string(buf);
+    } else if (sscanf(argv[i], "--bitmap-key=%s", buf) == 1) {
+      bitmap_key = std::string(buf);
+    } else if (sscanf(argv[i], "--path-bitmap-filename=%s", buf) == 1) {
+      path_bitmap_filename = std::string(buf);
+    } else if (sscanf(argv[i], "--context-id=%x", &context_id) == 1) {
+      target_context_id = context_id;
+    } else if (sscanf(argv[i], "--context-bitmap=%x,%s", &context_id, buf) ==
+               2) {
+      context_bitmap_filenames.emplace_back(context_id, std::string(buf));
+    } else if (std::strcmp(argv[i], "--huge-pages") == 0) {
+      use_huge_pages = true;
+    } else if (std::strcmp(argv[i], "--stats") == 0) {
+      print_stats = true;
+    } else if (std::strcmp(argv[i], "--print-edge-cov") == 0) {
+      options.sinks |= SINK_EDGE_LIST;
+    } else if (sscanf(argv[i], "--edge-profile=%s", buf) == 1) {
+      options.sinks |= SINK_EDGE_PROFILE;
+      edge_profile_filename = std::string(buf);
+    } else if (sscanf(argv[i], "--edge-log=%s", buf) == 1) {
+      options.sinks |= SINK_EDGE_LOG;
+      options.edge_log_filename = std::string(buf);
+    } else if (sscanf(argv[i], "--max-atom-len=%zu", &options.max_atom_len) ==
+               1) {
+      continue;
+    } else if (sscanf(argv[i], "--cache-mode=%s", buf) == 1) {
+      const std::string cache_mode(buf);
+      if (cache_mode == "none") {
+        options.cache_mode = CacheMode::NONE;
+      } else if (cache_mode == "branch") {
+        options.cache_mode = CacheMode::BRANCH;
+      } else if (cache_mode == "trace") {
+        options.cache_mode = CacheMode::TRACE;
+      } else {
+        std::cerr << "Invalid cache mode: " << cache_mode << std::endl;
+        std::exit(1);
+      }
+    } else if (sscanf(argv[i], "--bitmap-cell-width=%d", &width) == 1) {
+      if (width == 8) {
+        bitmap_cell_type = BitmapCellType::U8;
+      } else if (width == 16) {
+        bitmap_cell_type = BitmapCellType::U16;
+      } else if (width == 32) {
+        bitmap_cell_type = BitmapCellType::U32;
+      } else {
+        std::cerr << "The width of a bitmap cell must be 8, 16 or 32."
+                  << std::endl;
+        std::exit(1);
+      }
     } else {
       std::cerr << "Invalid option: " << argv[i] << std::endl;
       std::exit(1);
@@ -103,11 +238,54 @@ int main(int argc, char const *argv[]) {
       const std::uint64_t end_address =
           std::stol(argv[4 + id * 3 + 2], nullptr, 16);
 
-      memory_maps.emplace_back(MemoryMap(start_address, end_address, id));
+      memory_maps.emplace_back(
+          MemoryMap(start_address, end_address, id, argv[4 + id * 3]));
     }
   }
 
-  std::vector<std::uint8_t> bitmap(bitmap_size);
+  // The path coverage bitmap does not depend on the bitmap key.
+  std::vector<std::uint8_t> path_bitmap;
+  if (not path_bitmap_filename.empty()) {
+    if (bitmap_type != "edge") {
+      std::cerr << "The path coverage bitmap is only calculated together with "
+                   "the edge coverage."
+                << std::endl;
+      std::exit(1);
+    }
+    path_bitmap.resize(bitmap_size * getBitmapCellSize(bitmap_cell_type));
+    options.sinks |= SINK_PATH_BITMAP;
+    options.path_bitmap.emplace(path_bitmap.data(), bitmap_size,
+                                bitmap_cell_type);
+  }
+
+  std::optional<EdgeMap> edge_map;
+  if (bitmap_key == "id") {
+    if (bitmap_type != "edge") {
+      std::cerr << "The bitmap key id is only supported for edge coverage."
+                << std::endl;
+      std::exit(1);
+    }
+    // Enumerate the direct edges ahead of time. The bitmap consists of the
+    // cells for these edges and the cells reserved for indirect edges.
+    edge_map.emplace(memory_images);
+    bitmap_size += edge_map->static_edge_num;
+  } else if (bitmap_key != "hash") {
+    std::cerr << "Invalid bitmap key: " << bitmap_key << std::endl;
+    std::exit(1);
+  }
+
+  std::vector<std::uint8_t> bitmap(bitmap_size *
+                                   getBitmapCellSize(bitmap_cell_type));
+  if (not context_bitmap_filenames.empty() and
+      (bitmap_type != "edge" or options.sinks != SINK_BITMAP)) {
+    std::cerr << "The context bitmaps need the edge coverage bitmap as the "
+                 "only output."
+              << std::endl;
+    std::exit(1);
+  }
+  std::vector<std::vector<std::uint8_t>> context_bitmaps(
+      context_bitmap_filenames.size(),
+      std::vector<std::uint8_t>(bitmap.size()));
   const std::vector<std::uint8_t> trace_data =
       readBinaryFile(trace_data_filename);
 
@@ -115,20 +293,58 @@ int main(int argc, char const *argv[]) {
   ProcessResultType result = ProcessResultType::PROCESS_SUCCESS;
   if (bitmap_type == "edge") {
     Process process(std::move(memory_images),
-                    Bitmap(bitmap.data(), bitmap_size), Cache());
-    process.reset(std::move(memory_maps), trace_id);
+                    Bitmap(bitmap.data(), bitmap_size, bitmap_cell_type),
+                    Cache(use_huge_pages), std::move(edge_map), options);
+    if ((options.sinks & SINK_EDGE_LOG) and
+        not process.edge_log_sink.stream.is_open()) {
+      std::cerr << "Failed to open the edge log: "
+                << options.edge_log_filename << std::endl;
+      std::exit(1);
+    }
+    process.decoder.target_context_id = target_context_id;
+    process.reset(std::vector<MemoryMap>(memory_maps), trace_id);
+    for (std::size_t i = 0; i < context_bitmaps.size(); ++i) {
+      if (not process.addContextSession(
+              context_bitmap_filenames[i].first,
+              Bitmap(context_bitmaps[i].data(), bitmap_size, bitmap_cell_type),
+              std::vector<MemoryMap>(memory_maps))) {
+        std::cerr << "The context is given twice: " << std::hex
+                  << context_bitmap_filenames[i].first << std::endl;
+        std::exit(1);
+      }
+    }
 
     // Calculate edge coverage from trace data and binary data.
-    run_result = process.run(trace_data.data(), trace_data.size());
+    run_result = runTraceData(process, trace_data);
     result = process.final();
+
+    if (print_stats) {
+      process.stats.print(std::cerr);
+    }
+
+    if (not edge_profile_filename.empty()) {
+      for (const MemoryImage &memory_image : process.data.memory_images) {
+        std::ofstream stream(edge_profile_filename + "." +
+                             std::to_string(memory_image.id));
+        process.edge_profile_sink.write(stream, memory_image.id,
+                                        process.data.handle,
+                                        process.data.memory_images);
+      }
+    }
   } else if (bitmap_type == "path") {
     PathProcess process(std::move(memory_images),
-                        Bitmap(bitmap.data(), bitmap_size));
+                        Bitmap(bitmap.data(), bitmap_size, bitmap_cell_type),
+                        options);
+    process.decoder.target_context_id = target_context_id;
     process.reset(std::move(memory_maps), trace_id);
 
     // Calculate edge coverage from trace data and binary data.
-    run_result = process.run(trace_data.data(), trace_data.size());
+    run_result = runTraceData(process, trace_data);
     result = process.final();
+
+    if (print_stats) {
+      process.stats.print(std::cerr);
+    }
   } else {
     std::cerr << "Invalid bitmap type: " << bitmap_type << std::endl;
     std::exit(1);
@@ -146,6 +362,12 @@ int main(int argc, char const *argv[]) {
 
   // Write bitmap to the file.
   writeBinaryFile(bitmap, bitmap_filename);
+  if (not path_bitmap_filename.empty()) {
+    writeBinaryFile(path_bitmap, path_bitmap_filename);
+  }
+  for (std::size_t i = 0; i < context_bitmaps.size(); ++i) {
+    writeBinaryFile(context_bitmaps[i], context_bitmap_filenames[i].second);
+  }
 
   return 0;
 }
@@ -0,0 +1,146 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright 2021 Ricerca Security, Inc. All rights reserved. */
+
+#include <map>
+#include <utility>
+
+#include "sink.hpp"
+
+// Appends the number in hexadecimal without leading zeros.
+static void appendHex(std::string &buffer, std::uint64_t value) {
+  char digits[16];
+  std::size_t len = 0;
+  do {
+    digits[len++] = "0123456789abcdef"[value & 0xf];
+    value >>= 4;
+  } while (value != 0);
+
+  while (len > 0) {
+    buffer.push_back(digits[--len]);
+  }
+}
+
+void EdgeListSink::flush() {
+  if (this->buffer.empty()) {
+    return;
+  }
+  this->stream->write(this->buffer.data(), this->buffer.size());
+  this->stream->flush();
+  this->buffer.clear();
+}
+
+// Formats the location as "0x<offset> [<image id>]" in hexadecimal.
+void EdgeListSink::appendLocation(const Location &location) {
+  this->buffer.append("0x");
+  appendHex(this->buffer, location.offset);
+  this->buffer.append(" [");
+  appendHex(this->buffer, location.id);
+  this->buffer.push_back(']');
+}
+
+void EdgeCallbackSink::flush() {
+  if (this->edges.empty()) {
+    return;
+  }
+  this->callback(this->user_data, this->edges.data(), this->edges.size());
+  this->edges.clear();
+}
+
+EdgeLogSink::EdgeLogSink(const std::string &filename)
+    : edge_num(0), prev_location(0, 0) {
+  if (filename.empty()) {
+    return;
+  }
+
+  this->stream.open(filename, std::ios::out | std::ios::binary);
+  this->buffer.reserve(BUFFER_SIZE + MAX_EDGE_SIZE);
+  appendEdgeLogHeader(this->buffer);
+  this->stream.write(reinterpret_cast<const char *>(this->buffer.data()),
+                     this->buffer.size());
+  this->buffer.clear();
+}
+
+void EdgeLogSink::beginSession(const std::vector<MemoryMap> &memory_maps) {
+  flush();
+
+  binary_data_t record;
+  appendEdgeLogImages(record, memory_maps);
+  this->stream.write(reinterpret_cast<const char *>(record.data()),
+                     record.size());
+  this->prev_location = Location(0, 0);
+}
+
+void EdgeLogSink::flush() {
+  if (this->edge_num == 0) {
+    return;
+  }
+
+  binary_data_t record;
+  record.push_back(static_cast<std::uint8_t>(EdgeLogRecordType::EDGES));
+  appendVarint(record, this->edge_num);
+  appendVarint(record, this->buffer.size());
+  this->stream.write(reinterpret_cast<const char *>(record.data()),
+                     record.size());
+  this->stream.write(reinterpret_cast<const char *>(this->buffer.data()),
+                     this->buffer.size());
+  this->stream.flush();
+
+  this->buffer.clear();
+  this->edge_num = 0;
+}
+
+// Writes the counters as "<size>" followed by "<from><separator><to>:<count>"
+// lines, with the addresses in hexadecimal as llvm-profgen writes them.
+static void
+writeProfileCounters(std::ostream &stream, const char *separator,
+                     const std::map<std::pair<addr_t, addr_t>, std::uint64_t>
+                         &counters) {
+  stream << std::dec << counters.size() << "\n";
+  for (const auto &[addresses, count] : counters) {
+    stream << std::hex << std::uppercase << addresses.first << separator
+           << addresses.second << ":" << std::dec << count << "\n";
+  }
+}
+
+// An edge is a block from its start to its branch instruction, followed by the
+// branch to the destination. The ranges of the blocks are counted for each
+// edge, and the branches unless they fall through to the next instruction,
+// since llvm-profgen expects only the taken branches like LBR samples.
+void EdgeProfileSink::write(std::ostream &stream, const image_id_t id,
+                            const csh &handle,
+                            const std::vector<MemoryImage> &memory_images)
+    const {
+  std::unordered_map<Location, BranchInsn> branch_insns;
+  std::map<std::pair<addr_t, addr_t>, std::uint64_t> ranges;
+  std::map<std::pair<addr_t, addr_t>, std::uint64_t> branches;
+  for (const auto &[edge, count] : this->counts) {
+    if (edge.from_location.id != id) {
+      continue;
+    }
+
+    auto it = branch_insns.find(edge.from_location);
+    if (it == branch_insns.end()) {
+      it = branch_insns
+               .emplace(edge.from_location,
+                        getNextBranchInsn(handle, edge.from_location,
+                                          memory_images))
+               .first;
+    }
+    const BranchInsn &insn = it->second;
+    ranges[{edge.from_location.offset, insn.offset}] += count;
+
+    const bool is_fall_through =
+        insn.type == BranchType::ISB_BRANCH or
+        (insn.type == BranchType::DIRECT_BRANCH and
+         edge.to_location.offset == insn.not_taken_offset and
+         edge.to_location.offset != insn.taken_offset);
+    // llvm-profgen takes a single binary, so the branches to the other images
+    // are left out.
+    if (not is_fall_through and edge.to_location.id == id) {
+      branches[{insn.offset, edge.to_location.offset}] += count;
+    }
+  }
+
+  writeProfileCounters(stream, "-", ranges);
+  writeProfileCounters(stream, "->", branches);
+}
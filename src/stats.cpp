@@ -0,0 +1,88 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright 2021 Ricerca Security, Inc. All rights reserved. */
+
+#include "stats.hpp"
+
+const char *packetTypeToString(const PacketType type) {
+  switch (type) {
+  case PacketType::ETM4_PKT_I_EXTENSION:
+    return "ETM4_PKT_I_EXTENSION";
+  case PacketType::ETM4_PKT_I_TRACE_INFO:
+    return "ETM4_PKT_I_TRACE_INFO";
+  case PacketType::ETM4_PKT_I_TIMESTAMP:
+    return "ETM4_PKT_I_TIMESTAMP";
+  case PacketType::ETM4_PKT_I_TRACE_ON:
+    return "ETM4_PKT_I_TRACE_ON";
+  case PacketType::ETM4_PKT_I_EXCEPT:
+    return "ETM4_PKT_I_EXCEPT";
+  case PacketType::ETM4_PKT_I_CTXT:
+    return "ETM4_PKT_I_CTXT";
+  case PacketType::ETM4_PKT_I_ADDR_S_IS0:
+    return "ETM4_PKT_I_ADDR_S_IS0";
+  case PacketType::ETM4_PKT_I_ADDR_L_64IS0:
+    return "ETM4_PKT_I_ADDR_L_64IS0";
+  case PacketType::ETM4_PKT_I_ADDR_CTXT_L_64IS0:
+    return "ETM4_PKT_I_ADDR_CTXT_L_64IS0";
+  case PacketType::ETM4_PKT_I_ATOM_F1:
+    return "ETM4_PKT_I_ATOM_F1";
+  case PacketType::ETM4_PKT_I_ATOM_F2:
+    return "ETM4_PKT_I_ATOM_F2";
+  case PacketType::ETM4_PKT_I_ATOM_F3:
+    return "ETM4_PKT_I_ATOM_F3";
+  case PacketType::ETM4_PKT_I_ATOM_F4:
+    return "ETM4_PKT_I_ATOM_F4";
+  case PacketType::ETM4_PKT_I_ATOM_F5:
+    return "ETM4_PKT_I_ATOM_F5";
+  case PacketType::ETM4_PKT_I_ATOM_F6:
+    return "ETM4_PKT_I_ATOM_F6";
+  case PacketType::ETM4_PKT_I_ASYNC:
+    return "ETM4_PKT_I_ASYNC";
+  case PacketType::ETM4_PKT_I_OVERFLOW:
+    return "ETM4_PKT_I_OVERFLOW";
+  case PacketType::PKT_UNKNOWN:
+    return "PKT_UNKNOWN";
+  case PacketType::PKT_INCOMPLETE:
+    return "PKT_INCOMPLETE";
+  }
+  return "PKT_UNKNOWN";
+}
+
+void Stats::print(std::ostream &stream) const {
+  stream << std::dec;
+  for (std::size_t i = 0; i < PACKET_TYPE_NUM; ++i) {
+    if (this->packets[i] != 0) {
+      stream << "packets." << packetTypeToString(static_cast<PacketType>(i))
+             << ": " << this->packets[i] << "\n";
+    }
+  }
+
+  stream << "formatted_bytes: " << this->formatted_bytes << "\n"
+         << "deformatted_bytes: " << this->deformatted_bytes << "\n"
+         << "atoms: " << this->atoms << "\n"
+         << "unmapped_atoms: " << this->unmapped_atoms << "\n"
+         << "branch_cache_hits: " << this->branch_cache_hits << "\n"
+         << "branch_cache_misses: " << this->branch_cache_misses << "\n"
+         << "block_interval_hits: " << this->block_interval_hits << "\n"
+         << "trace_cache_hits: " << this->trace_cache_hits << "\n"
+         << "trace_cache_misses: " << this->trace_cache_misses << "\n"
+         << "indirect_target_cache_hits: " << this->indirect_target_cache_hits
+         << "\n"
+         << "indirect_target_cache_misses: "
+         << this->indirect_target_cache_misses << "\n"
+         << "trace_memo_hits: " << this->trace_memo_hits << "\n"
+         << "trace_memo_misses: " << this->trace_memo_misses << "\n"
+         << "trace_memo_segment_hits: " << this->trace_memo_segment_hits
+         << "\n"
+         << "trace_memo_segment_misses: " << this->trace_memo_segment_misses
+         << "\n"
+         << "disassembled_insns: " << this->disassembled_insns << "\n"
+         << "page_faults: " << this->page_faults << "\n"
+         << "context_switches: " << this->context_switches << "\n"
+         << "context_session_switches: " << this->context_session_switches
+         << "\n"
+         << "unknown_packets: " << this->unknown_packets << "\n"
+         << "unsynced_bytes: " << this->unsynced_bytes << "\n"
+         << "deformat_ns: " << this->deformat_ns << "\n"
+         << "decode_ns: " << this->decode_ns << "\n"
+         << "disassemble_ns: " << this->disassemble_ns << std::endl;
+}
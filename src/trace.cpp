@@ -2,13 +2,14 @@
 /* Copyright 2021 Ricerca Security, Inc. All rights reserved. */
 
 #include <cassert>
-#include <iostream>
 
 #include "bitmap.hpp"
 #include "trace.hpp"
 
-AtomTrace::AtomTrace(const Location &location)
-    : has_pending_address_packet(false) {
+AtomTrace::AtomTrace(const Location &location,
+                     std::pmr::memory_resource *resource)
+    : locations(resource), bitmap_keys(resource),
+      has_pending_address_packet(false) {
   this->locations.emplace_back(location);
 }
 
@@ -16,6 +17,10 @@ void AtomTrace::addLocation(const Location &location) {
   this->locations.emplace_back(location);
 }
 
+void AtomTrace::addBitmapKey(const std::size_t key) {
+  this->bitmap_keys.emplace_back(key);
+}
+
 void AtomTrace::calculateBitmapKeys(const std::size_t bitmap_size) {
   for (std::size_t i = 0, len = this->locations.size() - 1; i < len; ++i) {
     const Location from_location = this->locations[i];
@@ -27,30 +32,13 @@ void AtomTrace::calculateBitmapKeys(const std::size_t bitmap_size) {
 }
 
 void AtomTrace::writeBitmapKeys(const Bitmap &bitmap) const {
-  for (const std::uint64_t key : this->bitmap_keys) {
-    bitmap.data[key]++;
-  }
+  bitmap.writeKeys(this->bitmap_keys);
 }
 
 void AtomTrace::setPendingAddressPacket() {
   this->has_pending_address_packet = true;
 }
 
-void AtomTrace::printTraceLocations(
-    const std::vector<MemoryMap> &memory_map) const {
-  for (std::size_t i = 0, len = this->locations.size() - 1; i < len; i++) {
-    const Location prev_location = this->locations[i];
-    const Location next_location = this->locations[i + 1];
-
-    std::cout << std::hex << "0x" << prev_location.offset << " ["
-              << memory_map[prev_location.id].id << "]";
-    std::cout << " -> ";
-    std::cout << std::hex << "0x" << next_location.offset << " ["
-              << memory_map[next_location.id].id << "]";
-    std::cout << std::endl;
-  }
-}
-
 AddressTrace::AddressTrace(const Location &src_location,
                            const Location &dest_location)
     : src_location(src_location), dest_location(dest_location), bitmap_key(0) {}
@@ -64,18 +52,5 @@ void AddressTrace::calculateBitmapKey(const std::size_t bitmap_size) {
 }
 
 void AddressTrace::writeBitmapKey(const Bitmap &bitmap) const {
-  bitmap.data[this->bitmap_key]++;
-}
-
-void AddressTrace::printTraceLocation(
-    const std::vector<MemoryMap> &memory_map) const {
-  const Location prev_location = this->src_location;
-  const Location next_location = this->dest_location;
-
-  std::cout << std::hex << "0x" << prev_location.offset << " ["
-            << memory_map[prev_location.id].id << "]";
-  std::cout << " -> ";
-  std::cout << std::hex << "0x" << next_location.offset << " ["
-            << memory_map[next_location.id].id << "]";
-  std::cout << std::endl;
+  bitmap.writeKey(this->bitmap_key);
 }
@@ -0,0 +1,314 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright 2021 Ricerca Security, Inc. All rights reserved. */
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "tracepack.hpp"
+
+// The number of the entries of the hash table of the compressor in bits.
+constexpr std::size_t TRACE_PACK_HASH_BITS = 14;
+constexpr std::size_t TRACE_PACK_MAX_OFFSET = 0xffff;
+
+static void appendLittleEndian(binary_data_t &buffer, std::uint64_t value,
+                               std::size_t size);
+static std::uint64_t readLittleEndian(const std::uint8_t *data,
+                                      std::size_t size);
+static std::size_t appendLiterals(binary_data_t &buffer,
+                                  const std::uint8_t *literals,
+                                  std::size_t literal_len);
+static void appendMatch(binary_data_t &buffer, std::size_t token,
+                        std::size_t offset, std::size_t match_len);
+static void appendLength(binary_data_t &buffer, std::size_t length);
+static bool readLength(const std::uint8_t *&ptr, const std::uint8_t *end,
+                       std::size_t &length);
+
+// Greedy LZ77 with a hash table of the last position of each 4-byte word. It
+// is not as thorough as the real LZ4, but the trace data is repetitive enough.
+void compressTracePackBlock(const std::uint8_t *data, const std::size_t size,
+                            binary_data_t &buffer) {
+  // The positions are stored plus 1, so that 0 means no position.
+  std::vector<std::uint32_t> table(std::size_t(1) << TRACE_PACK_HASH_BITS, 0);
+
+  std::size_t anchor = 0;
+  std::size_t pos = 0;
+  while (pos + TRACE_PACK_MIN_MATCH <= size) {
+    std::uint32_t word;
+    std::memcpy(&word, data + pos, sizeof(word));
+    const std::size_t hash =
+        (word * 2654435761u) >> (32 - TRACE_PACK_HASH_BITS);
+    const std::size_t candidate = table[hash];
+    table[hash] = pos + 1;
+
+    if (candidate == 0 or pos - (candidate - 1) > TRACE_PACK_MAX_OFFSET or
+        std::memcmp(data + candidate - 1, data + pos, TRACE_PACK_MIN_MATCH) !=
+            0) {
+      ++pos;
+      continue;
+    }
+
+    const std::size_t match = candidate - 1;
+    std::size_t match_len = TRACE_PACK_MIN_MATCH;
+    while (pos + match_len < size and
+           data[match + match_len] == data[pos + match_len]) {
+      ++match_len;
+    }
+
+    const std::size_t token =
+        appendLiterals(buffer, data + anchor, pos - anchor);
+    appendMatch(buffer, token, pos - match, match_len);
+    pos += match_len;
+    anchor = pos;
+  }
+
+  // The last sequence has the literals only.
+  appendLiterals(buffer, data + anchor, size - anchor);
+}
+
+bool decompressTracePackBlock(const std::uint8_t *data, const std::size_t size,
+                              std::uint8_t *raw_data,
+                              const std::size_t raw_size) {
+  const std::uint8_t *ptr = data;
+  const std::uint8_t *const end = data + size;
+  std::uint8_t *out = raw_data;
+  std::uint8_t *const out_end = raw_data + raw_size;
+
+  while (ptr < end) {
+    const std::uint8_t token = *ptr++;
+
+    std::size_t literal_len = token >> 4;
+    if (literal_len == 15 and not readLength(ptr, end, literal_len)) {
+      return false;
+    }
+    if (literal_len > static_cast<std::size_t>(end - ptr) or
+        literal_len > static_cast<std::size_t>(out_end - out)) {
+      return false;
+    }
+    std::memcpy(out, ptr, literal_len);
+    ptr += literal_len;
+    out += literal_len;
+
+    if (ptr == end) {
+      // The end of the last sequence.
+      return out == out_end;
+    }
+
+    if (end - ptr < 2) {
+      return false;
+    }
+    const std::size_t offset = ptr[0] | (ptr[1] << 8);
+    ptr += 2;
+    std::size_t match_len = token & 0xf;
+    if (match_len == 15 and not readLength(ptr, end, match_len)) {
+      return false;
+    }
+    match_len += TRACE_PACK_MIN_MATCH;
+    if (offset == 0 or offset > static_cast<std::size_t>(out - raw_data) or
+        match_len > static_cast<std::size_t>(out_end - out)) {
+      return false;
+    }
+
+    // The match overlaps the output if it is closer than its length, which
+    // repeats the last bytes.
+    const std::uint8_t *match = out - offset;
+    if (offset >= match_len) {
+      std::memcpy(out, match, match_len);
+    } else {
+      for (std::size_t i = 0; i < match_len; ++i) {
+        out[i] = match[i];
+      }
+    }
+    out += match_len;
+  }
+  return false;
+}
+
+bool isTracePack(const std::uint8_t *data, const std::size_t size) {
+  return size >= sizeof(TRACE_PACK_MAGIC) and
+         std::memcmp(data, TRACE_PACK_MAGIC, sizeof(TRACE_PACK_MAGIC)) == 0;
+}
+
+binary_data_t packTraceData(const std::uint8_t *data, const std::size_t size,
+                            const std::size_t block_size) {
+  binary_data_t buffer(TRACE_PACK_MAGIC,
+                       TRACE_PACK_MAGIC + sizeof(TRACE_PACK_MAGIC));
+  appendLittleEndian(buffer, TRACE_PACK_VERSION, 4);
+  appendLittleEndian(buffer, block_size, 4);
+
+  std::vector<TracePackBlock> blocks;
+  for (std::size_t offset = 0; offset < size; offset += block_size) {
+    const std::size_t raw_size = std::min(block_size, size - offset);
+    const std::size_t block_offset = buffer.size();
+    compressTracePackBlock(data + offset, raw_size, buffer);
+    if (buffer.size() - block_offset >= raw_size) {
+      buffer.resize(block_offset);
+      buffer.insert(buffer.end(), data + offset, data + offset + raw_size);
+    }
+    blocks.push_back(TracePackBlock{
+        block_offset, static_cast<std::uint32_t>(buffer.size() - block_offset),
+        static_cast<std::uint32_t>(raw_size)});
+  }
+
+  for (const TracePackBlock &block : blocks) {
+    appendLittleEndian(buffer, block.offset, 8);
+    appendLittleEndian(buffer, block.size, 4);
+    appendLittleEndian(buffer, block.raw_size, 4);
+  }
+  appendLittleEndian(buffer, blocks.size(), 8);
+  appendLittleEndian(buffer, size, 8);
+  return buffer;
+}
+
+TracePackReader::TracePackReader(const std::uint8_t *data,
+                                 const std::size_t size)
+    : data(data), size(size), block_size(0), raw_size(0), failed(false) {
+  if (size < TRACE_PACK_HEADER_SIZE + TRACE_PACK_FOOTER_SIZE or
+      not isTracePack(data, size)) {
+    std::cerr << "Not a trace pack." << std::endl;
+    this->failed = true;
+    return;
+  }
+  if (readLittleEndian(data + 8, 4) != TRACE_PACK_VERSION) {
+    std::cerr << "Unsupported trace pack version." << std::endl;
+    this->failed = true;
+    return;
+  }
+
+  this->block_size = readLittleEndian(data + 12, 4);
+  const std::size_t index_end = size - TRACE_PACK_FOOTER_SIZE;
+  const std::uint64_t block_num = readLittleEndian(data + index_end, 8);
+  this->raw_size = readLittleEndian(data + index_end + 8, 8);
+  if (this->block_size == 0 or this->block_size > TRACE_PACK_MAX_BLOCK_SIZE or
+      block_num > (index_end - TRACE_PACK_HEADER_SIZE) /
+                      TRACE_PACK_INDEX_ENTRY_SIZE) {
+    std::cerr << "The trace pack is broken." << std::endl;
+    this->failed = true;
+    return;
+  }
+
+  // Every block but the last has block_size bytes, so that the block of an
+  // offset of the trace data is found by a division.
+  const std::size_t index_offset =
+      index_end - block_num * TRACE_PACK_INDEX_ENTRY_SIZE;
+  std::uint64_t total_size = 0;
+  for (std::size_t i = 0; i < block_num; ++i) {
+    const std::uint8_t *entry =
+        data + index_offset + i * TRACE_PACK_INDEX_ENTRY_SIZE;
+    const TracePackBlock block{
+        readLittleEndian(entry, 8),
+        static_cast<std::uint32_t>(readLittleEndian(entry + 8, 4)),
+        static_cast<std::uint32_t>(readLittleEndian(entry + 12, 4))};
+    const bool is_last = i + 1 == block_num;
+    if (block.offset < TRACE_PACK_HEADER_SIZE or block.offset > index_offset or
+        block.size > index_offset - block.offset or
+        block.size > block.raw_size or block.raw_size == 0 or
+        block.raw_size > this->block_size or
+        (not is_last and block.raw_size != this->block_size)) {
+      std::cerr << "The trace pack is broken." << std::endl;
+      this->failed = true;
+      return;
+    }
+    total_size += block.raw_size;
+    this->blocks.push_back(block);
+  }
+  if (total_size != this->raw_size) {
+    std::cerr << "The trace pack is broken." << std::endl;
+    this->failed = true;
+  }
+}
+
+bool TracePackReader::readBlock(const std::size_t index,
+                                binary_data_t &buffer) const {
+  const TracePackBlock &block = this->blocks[index];
+  buffer.resize(block.raw_size);
+  if (block.size == block.raw_size) {
+    std::memcpy(buffer.data(), this->data + block.offset, block.size);
+    return true;
+  }
+  return decompressTracePackBlock(this->data + block.offset, block.size,
+                                  buffer.data(), block.raw_size);
+}
+
+bool TracePackReader::readRange(const std::uint64_t offset,
+                                const std::uint64_t size,
+                                binary_data_t &buffer) const {
+  if (offset > this->raw_size or size > this->raw_size - offset) {
+    return false;
+  }
+
+  buffer.clear();
+  binary_data_t block;
+  std::uint64_t block_offset = offset / this->block_size * this->block_size;
+  for (std::size_t i = offset / this->block_size; buffer.size() < size; ++i) {
+    if (not readBlock(i, block)) {
+      return false;
+    }
+    const std::uint64_t start = std::max(offset, block_offset) - block_offset;
+    const std::uint64_t end =
+        std::min(offset + size - block_offset, std::uint64_t(block.size()));
+    buffer.insert(buffer.end(), block.begin() + start, block.begin() + end);
+    block_offset += block.size();
+  }
+  return true;
+}
+
+static void appendLittleEndian(binary_data_t &buffer, std::uint64_t value,
+                               const std::size_t size) {
+  for (std::size_t i = 0; i < size; ++i) {
+    buffer.push_back(static_cast<std::uint8_t>(value >> (i * 8)));
+  }
+}
+
+static std::uint64_t readLittleEndian(const std::uint8_t *data,
+                                      const std::size_t size) {
+  std::uint64_t value = 0;
+  for (std::size_t i = 0; i < size; ++i) {
+    value |= static_cast<std::uint64_t>(data[i]) << (i * 8);
+  }
+  return value;
+}
+
+// Appends the token and the literals of a sequence, and returns the position
+// of the token, whose match length is filled in by appendMatch.
+static std::size_t appendLiterals(binary_data_t &buffer,
+                                  const std::uint8_t *literals,
+                                  const std::size_t literal_len) {
+  const std::size_t token = buffer.size();
+  buffer.push_back(std::min<std::size_t>(literal_len, 15) << 4);
+  if (literal_len >= 15) {
+    appendLength(buffer, literal_len - 15);
+  }
+  buffer.insert(buffer.end(), literals, literals + literal_len);
+  return token;
+}
+
+static void appendMatch(binary_data_t &buffer, const std::size_t token,
+                        const std::size_t offset, const std::size_t match_len) {
+  const std::size_t code = match_len - TRACE_PACK_MIN_MATCH;
+  buffer[token] |= std::min<std::size_t>(code, 15);
+  appendLittleEndian(buffer, offset, 2);
+  if (code >= 15) {
+    appendLength(buffer, code - 15);
+  }
+}
+
+static void appendLength(binary_data_t &buffer, std::size_t length) {
+  for (; length >= 255; length -= 255) {
+    buffer.push_back(255);
+  }
+  buffer.push_back(static_cast<std::uint8_t>(length));
+}
+
+static bool readLength(const std::uint8_t *&ptr, const std::uint8_t *end,
+                       std::size_t &length) {
+  std::uint8_t byte;
+  do {
+    if (ptr == end) {
+      return false;
+    }
+    byte = *ptr++;
+    length += byte;
+  } while (byte == 255);
+  return true;
+}
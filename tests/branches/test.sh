@@ -17,7 +17,7 @@ run () {
 
     $PROGRAM $(cat $target/decoderargs.txt) --bitmap-size=0x1000 \
                                             --bitmap-filename=$bitmap_file \
-                                            > $output_file
+                                            --print-edge-cov > $output_file
     if [ $? -ne 0 ]; then
         echo "Failed to run decoder."
         exit 1
@@ -0,0 +1,541 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright 2021 Ricerca Security, Inc. All rights reserved. */
+
+// Per-stage microbenchmarks of the decoder. Every input is generated
+// synthetically, so no trace data or ARM hardware is required. The results
+// are printed in the JSON Lines format, one benchmark per line.
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <linux/perf_event.h>
+#include <optional>
+#include <random>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+#include "bitmap.hpp"
+#include "cache.hpp"
+#include "common.hpp"
+#include "decoder.hpp"
+#include "deformatter.hpp"
+#include "process.hpp"
+
+static const std::uint8_t TRACE_ID = 0x10;
+static const addr_t IMAGE_START_ADDRESS = 0x400000;
+
+// Synthetic memory image: BLOCK_NUM blocks of BLOCK_INSN_NUM instructions.
+static const std::size_t BLOCK_NUM = 4096;
+static const std::size_t BLOCK_INSN_NUM = 4;
+static const std::size_t BLOCK_SIZE = BLOCK_INSN_NUM * 4;
+
+static const std::uint32_t A64_NOP = 0xd503201f;
+
+// The trace data is put into the decoder directly, and run is called with none.
+static const std::uint8_t *const NO_TRACE_DATA = nullptr;
+
+// Hardware counters collected with perf_event_open(2), if available.
+struct PerfCounters {
+  static constexpr std::size_t COUNTER_NUM = 4;
+  static constexpr const char *names[COUNTER_NUM] = {
+      "cycles", "instructions", "cache_misses", "branch_misses"};
+
+  std::array<int, COUNTER_NUM> fds;
+
+  PerfCounters(bool enabled) {
+    static const std::uint64_t configs[COUNTER_NUM] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+
+    for (std::size_t i = 0; i < COUNTER_NUM; ++i) {
+      this->fds[i] = -1;
+      if (not enabled) {
+        continue;
+      }
+
+      struct perf_event_attr attr;
+      std::memset(&attr, 0, sizeof(attr));
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.size = sizeof(attr);
+      attr.config = configs[i];
+      attr.disabled = 1;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+
+      this->fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+  }
+
+  ~PerfCounters() {
+    for (const int fd : this->fds) {
+      if (fd >= 0) {
+        close(fd);
+      }
+    }
+  }
+
+  void start() const {
+    for (const int fd : this->fds) {
+      if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+      }
+    }
+  }
+
+  void stop() const {
+    for (const int fd : this->fds) {
+      if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+      }
+    }
+  }
+
+  std::array<std::optional<std::uint64_t>, COUNTER_NUM> read() const {
+    std::array<std::optional<std::uint64_t>, COUNTER_NUM> values;
+    for (std::size_t i = 0; i < COUNTER_NUM; ++i) {
+      std::uint64_t value = 0;
+      if (this->fds[i] >= 0 and
+          ::read(this->fds[i], &value, sizeof(value)) == sizeof(value)) {
+        values[i] = value;
+      }
+    }
+    return values;
+  }
+};
+
+struct BenchmarkResult {
+  std::string name;
+  // The unit of the processed items, e.g. bytes or packets.
+  std::string unit;
+  std::uint64_t items;
+  std::uint64_t ns;
+  std::array<std::optional<std::uint64_t>, PerfCounters::COUNTER_NUM> counters;
+
+  void print() const {
+    std::printf("{\"name\": \"%s\", \"unit\": \"%s\", \"items\": %lu, "
+                "\"ns\": %lu, \"items_per_sec\": %.1f",
+                this->name.c_str(), this->unit.c_str(), this->items, this->ns,
+                this->ns ? this->items * 1e9 / this->ns : 0.0);
+    for (std::size_t i = 0; i < PerfCounters::COUNTER_NUM; ++i) {
+      if (this->counters[i].has_value()) {
+        std::printf(", \"%s\": %lu", PerfCounters::names[i],
+                    this->counters[i].value());
+      } else {
+        std::printf(", \"%s\": null", PerfCounters::names[i]);
+      }
+    }
+    std::printf("}\n");
+    std::fflush(stdout);
+  }
+};
+
+// Runs `body` `iterations` times and measures only the body. `setup` is run
+// before each iteration and is excluded from the measurement.
+BenchmarkResult runBenchmark(const PerfCounters &perf, const std::string &name,
+                             const std::string &unit,
+                             std::uint64_t items_per_iteration,
+                             std::size_t iterations,
+                             const std::function<void()> &setup,
+                             const std::function<void()> &body) {
+  BenchmarkResult result{name, unit, items_per_iteration * iterations, 0, {}};
+  std::array<std::uint64_t, PerfCounters::COUNTER_NUM> sums{};
+  std::array<bool, PerfCounters::COUNTER_NUM> valid;
+  valid.fill(true);
+
+  for (std::size_t i = 0; i < iterations; ++i) {
+    setup();
+
+    perf.start();
+    const auto start = std::chrono::steady_clock::now();
+    body();
+    const auto end = std::chrono::steady_clock::now();
+    perf.stop();
+
+    result.ns +=
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+            .count();
+
+    const auto counters = perf.read();
+    for (std::size_t c = 0; c < PerfCounters::COUNTER_NUM; ++c) {
+      if (counters[c].has_value()) {
+        sums[c] += counters[c].value();
+      } else {
+        valid[c] = false;
+      }
+    }
+  }
+
+  for (std::size_t c = 0; c < PerfCounters::COUNTER_NUM; ++c) {
+    if (valid[c]) {
+      result.counters[c] = sums[c];
+    }
+  }
+  return result;
+}
+
+void appendWord(binary_data_t &data, std::uint32_t word) {
+  for (int i = 0; i < 4; ++i) {
+    data.emplace_back((word >> (i * 8)) & 0xff);
+  }
+}
+
+std::size_t getTakenBlock(std::size_t block) {
+  return (block * 7 + 3) % BLOCK_NUM;
+}
+
+// Each block consists of NOPs followed by a B.NE to getTakenBlock(). The
+// not-taken path falls through to the next block. The last block ends with
+// an unconditional B to the first block.
+binary_data_t createImage() {
+  binary_data_t data;
+  for (std::size_t block = 0; block < BLOCK_NUM; ++block) {
+    for (std::size_t i = 0; i < BLOCK_INSN_NUM - 1; ++i) {
+      appendWord(data, A64_NOP);
+    }
+
+    const std::int64_t pc = block * BLOCK_SIZE + (BLOCK_INSN_NUM - 1) * 4;
+    if (block == BLOCK_NUM - 1) {
+      const std::int64_t imm26 = (0 - pc) / 4;
+      appendWord(data, 0x14000000 | (imm26 & 0x3ffffff));
+    } else {
+      const std::int64_t target = getTakenBlock(block) * BLOCK_SIZE;
+      const std::int64_t imm19 = (target - pc) / 4;
+      appendWord(data, 0x54000001 | ((imm19 & 0x7ffff) << 5));
+    }
+  }
+  return data;
+}
+
+// The decoder starts decoding at the first A-sync packet.
+void appendAsyncPacket(binary_data_t &data) {
+  data.insert(data.end(), ASYNC_PACKET_SIZE - 1, 0x00);
+  data.emplace_back(0x80);
+}
+
+void appendLongAddressPacket(binary_data_t &data, addr_t address) {
+  data.emplace_back(0b10011101);
+  data.emplace_back((address >> 2) & 0x7f);
+  data.emplace_back((address >> 9) & 0x7f);
+  for (int i = 2; i < 8; ++i) {
+    data.emplace_back((address >> (i * 8)) & 0xff);
+  }
+}
+
+void appendShortAddressPacket(binary_data_t &data, addr_t address) {
+  data.emplace_back(0b10010101);
+  data.emplace_back((address >> 2) & 0x7f);
+}
+
+// Generates a deformatted trace that walks the synthetic image with random
+// branch decisions, packed into Atom format 3 packets.
+binary_data_t createAtomTrace(std::size_t atom_packet_num,
+                              std::mt19937_64 &rng) {
+  binary_data_t data;
+  appendAsyncPacket(data);
+  appendLongAddressPacket(data, IMAGE_START_ADDRESS);
+
+  std::size_t block = 0;
+  for (std::size_t i = 0; i < atom_packet_num; ++i) {
+    std::uint8_t en_bits = 0;
+    for (int atom = 0; atom < 3; ++atom) {
+      const bool is_taken = (block == BLOCK_NUM - 1) ? true : (rng() & 1);
+      if (is_taken) {
+        en_bits |= 1 << atom;
+        block = (block == BLOCK_NUM - 1) ? 0 : getTakenBlock(block);
+      } else {
+        block = block + 1;
+      }
+    }
+    data.emplace_back(0b11111000 | en_bits);
+  }
+  return data;
+}
+
+binary_data_t createPacketMix(const std::string &mix, std::size_t packet_num,
+                              std::mt19937_64 &rng) {
+  binary_data_t data;
+  appendLongAddressPacket(data, IMAGE_START_ADDRESS);
+
+  for (std::size_t i = 0; i < packet_num; ++i) {
+    const addr_t address = IMAGE_START_ADDRESS + (rng() % BLOCK_NUM) * 16;
+    if (mix == "atom_f3") {
+      data.emplace_back(0b11111000 | (rng() & 0b111));
+    } else if (mix == "atom_f6") {
+      data.emplace_back(0b11000000 | (rng() & 0b11111));
+    } else if (mix == "addr_short") {
+      appendShortAddressPacket(data, address);
+    } else if (mix == "addr_long") {
+      appendLongAddressPacket(data, address);
+    } else {
+      // Typical mix: mostly atoms with occasional address packets.
+      const std::uint64_t r = rng() % 8;
+      if (r == 0) {
+        appendShortAddressPacket(data, address);
+      } else if (r == 1) {
+        appendLongAddressPacket(data, address);
+      } else {
+        data.emplace_back(0b11111000 | (rng() & 0b111));
+      }
+    }
+  }
+  return data;
+}
+
+// Generates formatter frames with random payload. Every other frame belongs to
+// the target trace ID.
+binary_data_t createFormattedTrace(std::size_t frame_num,
+                                   std::mt19937_64 &rng) {
+  binary_data_t data;
+  for (std::size_t frame = 0; frame < frame_num; ++frame) {
+    const std::uint8_t trace_id = (frame % 2) ? TRACE_ID : TRACE_ID + 1;
+    data.emplace_back((trace_id << 1) | 1);
+    for (int i = 1; i < 15; ++i) {
+      // Data bytes at even positions carry their LSB in the auxiliary byte.
+      data.emplace_back((i % 2) ? rng() & 0xff : rng() & 0xfe);
+    }
+    data.emplace_back(0);
+  }
+  return data;
+}
+
+std::vector<MemoryImage> createMemoryImages() {
+  std::vector<MemoryImage> memory_images;
+  memory_images.emplace_back(MemoryImage(createImage(), 0));
+  return memory_images;
+}
+
+std::vector<MemoryMap> createMemoryMaps() {
+  std::vector<MemoryMap> memory_maps;
+  memory_maps.emplace_back(MemoryMap(
+      IMAGE_START_ADDRESS, IMAGE_START_ADDRESS + BLOCK_NUM * BLOCK_SIZE, 0));
+  return memory_maps;
+}
+
+void benchDeformatter(const PerfCounters &perf, std::size_t scale,
+                      std::mt19937_64 &rng) {
+  const binary_data_t trace = createFormattedTrace(0x10000 * scale, rng);
+
+  Deformatter deformatter;
+  std::pmr::vector<std::uint8_t> out;
+  out.reserve(trace.size());
+
+  runBenchmark(
+      perf, "deformatter", "bytes", trace.size(), 8,
+      [&]() {
+        deformatter.reset(TRACE_ID);
+        out.clear();
+      },
+      [&]() { deformatter.deformatTraceData(trace.data(), trace.size(), out); })
+      .print();
+}
+
+void benchDecodePacket(const PerfCounters &perf, std::size_t scale,
+                       std::mt19937_64 &rng) {
+  for (const std::string mix :
+       {"atom_f3", "atom_f6", "addr_short", "addr_long", "mixed"}) {
+    const std::size_t packet_num = 0x40000 * scale;
+    const binary_data_t trace = createPacketMix(mix, packet_num, rng);
+
+    Decoder decoder;
+    runBenchmark(
+        perf, "decode_packet/" + mix, "packets", packet_num + 1, 8,
+        [&]() {
+          decoder.reset();
+          decoder.trace_data.assign(trace.begin(), trace.end());
+        },
+        [&]() {
+          const std::size_t size = decoder.trace_data.size();
+          while (decoder.trace_data_offset < size) {
+            const Packet packet = decoder.decodePacket();
+            decoder.trace_data_offset += packet.size;
+          }
+        })
+        .print();
+  }
+}
+
+void benchProcessAtoms(const PerfCounters &perf, std::size_t scale,
+                       std::mt19937_64 &rng) {
+  const std::size_t atom_packet_num = 0x10000 * scale;
+  const binary_data_t trace = createAtomTrace(atom_packet_num, rng);
+
+  std::vector<std::uint8_t> bitmap(BITMAP_SIZE);
+
+  // A fresh process for every iteration: the caches are empty, so every block
+  // is disassembled.
+  std::optional<Process> process;
+  runBenchmark(
+      perf, "process_atoms/cold", "atoms", atom_packet_num * 3, 4,
+      [&]() {
+        process.reset();
+        process.emplace(createMemoryImages(),
+                        Bitmap(bitmap.data(), bitmap.size()), Cache());
+        process->reset(createMemoryMaps(), TRACE_ID);
+        process->decoder.trace_data.assign(trace.begin(), trace.end());
+      },
+      [&]() { process->run(NO_TRACE_DATA, 0); })
+      .print();
+
+  // The same process for every iteration: the caches are warm.
+  runBenchmark(
+      perf, "process_atoms/warm", "atoms", atom_packet_num * 3, 8,
+      [&]() {
+        process->reset(createMemoryMaps(), TRACE_ID);
+        process->decoder.trace_data.assign(trace.begin(), trace.end());
+      },
+      [&]() { process->run(NO_TRACE_DATA, 0); })
+      .print();
+}
+
+void benchGetLocation(const PerfCounters &perf, std::size_t scale,
+                      std::mt19937_64 &rng) {
+  for (const std::size_t map_num : {1, 4, 16, 64, 256}) {
+    std::vector<MemoryMap> memory_maps;
+    for (std::size_t id = 0; id < map_num; ++id) {
+      const addr_t start = IMAGE_START_ADDRESS + id * 0x100000;
+      memory_maps.emplace_back(MemoryMap(start, start + 0x100000, id));
+    }
+
+    const std::size_t query_num = 0x100000 * scale;
+    std::vector<addr_t> addresses;
+    for (std::size_t i = 0; i < query_num; ++i) {
+      addresses.emplace_back(IMAGE_START_ADDRESS +
+                             rng() % (map_num * 0x100000));
+    }
+
+    std::size_t found = 0;
+    runBenchmark(
+        perf, "get_location/maps=" + std::to_string(map_num), "lookups",
+        query_num, 4, []() {},
+        [&]() {
+          for (const addr_t address : addresses) {
+            found += getLocation(memory_maps, address).has_value();
+          }
+        })
+        .print();
+
+    if (found == 0) {
+      std::cerr << "Unexpected lookup results." << std::endl;
+    }
+  }
+}
+
+void benchPathProcess(const PerfCounters &perf, std::size_t scale,
+                      std::mt19937_64 &rng) {
+  // Atom packets with an address packet every 16 packets on average.
+  binary_data_t trace;
+  appendAsyncPacket(trace);
+  appendLongAddressPacket(trace, IMAGE_START_ADDRESS);
+  const std::size_t packet_num = 0x40000 * scale;
+  for (std::size_t i = 0; i < packet_num; ++i) {
+    if (rng() % 16 == 0) {
+      appendShortAddressPacket(trace,
+                               IMAGE_START_ADDRESS + (rng() % 0x80) * 4);
+    } else {
+      trace.emplace_back(0b11000000 | (rng() & 0b111111));
+    }
+  }
+
+  std::vector<std::uint8_t> bitmap(BITMAP_SIZE);
+  PathProcess process(createMemoryImages(),
+                      Bitmap(bitmap.data(), bitmap.size()));
+
+  runBenchmark(
+      perf, "path_process", "packets", packet_num + 1, 8,
+      [&]() {
+        process.reset(createMemoryMaps(), TRACE_ID);
+        process.decoder.trace_data.assign(trace.begin(), trace.end());
+      },
+      [&]() { process.run(NO_TRACE_DATA, 0); })
+      .print();
+}
+
+void benchBitmapWrites(const PerfCounters &perf, std::size_t scale,
+                       std::mt19937_64 &rng) {
+  const std::size_t key_num = 0x100000 * scale;
+  std::pmr::vector<std::size_t> keys;
+  for (std::size_t i = 0; i < key_num; ++i) {
+    keys.emplace_back(rng() % BITMAP_SIZE);
+  }
+
+  const std::pair<const char *, BitmapCellType> cell_types[] = {
+      {"u8", BitmapCellType::U8},
+      {"u16", BitmapCellType::U16},
+      {"u32", BitmapCellType::U32},
+  };
+
+  for (const auto &cell_type : cell_types) {
+    std::vector<std::uint8_t> data(BITMAP_SIZE *
+                                   getBitmapCellSize(cell_type.second));
+    const Bitmap bitmap(data.data(), BITMAP_SIZE, cell_type.second);
+
+    runBenchmark(
+        perf, std::string("bitmap_write/") + cell_type.first, "keys", key_num,
+        8, [&]() { bitmap.reset(); }, [&]() { bitmap.writeKeys(keys); })
+        .print();
+  }
+}
+
+void usage(const char *argv0) {
+  std::cerr << "Usage: " << argv0 << " [OPTIONS]" << std::endl
+            << "OPTIONS:" << std::endl
+            << "\t--scale=num    : Multiply the size of the synthetic inputs. "
+               "The default value is 1."
+            << std::endl
+            << "\t--filter=name  : Run only the benchmarks whose stage name "
+               "starts with name."
+            << std::endl
+            << "\t--no-perf      : Do not collect hardware counters." << std::endl
+            << std::endl;
+}
+
+int main(int argc, char const *argv[]) {
+  std::size_t scale = 1;
+  bool use_perf = true;
+  std::string filter;
+  for (int i = 1; i < argc; ++i) {
+    char buf[256];
+    if (sscanf(argv[i], "--scale=%zu", &scale) == 1) {
+      continue;
+    } else if (sscanf(argv[i], "--filter=%255s", buf) == 1) {
+      filter = std::string(buf);
+    } else if (std::strcmp(argv[i], "--no-perf") == 0) {
+      use_perf = false;
+    } else {
+      usage(argv[0]);
+      std::exit(EXIT_FAILURE);
+    }
+  }
+
+  const PerfCounters perf(use_perf);
+  // A fixed seed, so that every run uses the same inputs.
+  std::mt19937_64 rng(0);
+
+  const std::pair<const char *,
+                  void (*)(const PerfCounters &, std::size_t,
+                           std::mt19937_64 &)>
+      benchmarks[] = {
+          {"deformatter", benchDeformatter},
+          {"decode_packet", benchDecodePacket},
+          {"process_atoms", benchProcessAtoms},
+          {"get_location", benchGetLocation},
+          {"path_process", benchPathProcess},
+          {"bitmap_write", benchBitmapWrites},
+      };
+
+  for (const auto &benchmark : benchmarks) {
+    if (std::string(benchmark.first).rfind(filter, 0) == 0) {
+      benchmark.second(perf, scale, rng);
+    }
+  }
+
+  return 0;
+}
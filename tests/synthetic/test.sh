@@ -0,0 +1,225 @@
+#!/bin/bash
+
+
+# Program for generating synthetic trace data
+GENERATOR=./tracegen
+# Program for calculating edge coverage
+PROGRAM=../../processor
+# Program for converting the edge log
+EDGECONV=../../edgeconv
+# Program for compressing the trace data
+PACKCONV=../../packconv
+
+FIB_IMAGES="3 ../fib/fib 0xaaaadd370000 0xaaaadd371000 \
+    ../fib/ld-2.31.so 0xffff9d470000 0xffff9d491000 \
+    ../fib/libc-2.31.so 0xffff9d2fd000 0xffff9d470000"
+# Address of main() of the fib program
+FIB_START=0xaaaadd3707ec
+
+BRANCHES_IMAGES="3 ../branches/branches 0xaaaaceaa0000 0xaaaaceaa1000 \
+    ../branches/ld-2.31.so 0xffffbe9f6000 0xffffbea17000 \
+    ../branches/libc-2.31.so 0xffffbe873000 0xffffbe9e6000"
+# Address of _start of the branches program
+BRANCHES_START=0xaaaaceaa0610
+
+
+# Generate trace data and compare the edge coverage calculated by the decoder
+# with the expected one.
+run () {
+    target="$1"
+    shift
+
+    mkdir -p $target
+    $GENERATOR $target 0x10 "$@"
+    if [ $? -ne 0 ]; then
+        echo "Failed to generate trace data: $target"
+        exit 1
+    fi
+
+    $PROGRAM $(cat $target/decoderargs.txt) --bitmap-size=0x1000 \
+                                            --bitmap-filename=$target/bitmap.out \
+                                            --print-edge-cov \
+                                            > $target/edge_coverage.out
+    if [ $? -ne 0 ]; then
+        echo "Failed to run decoder: $target"
+        exit 1
+    fi
+
+    diff $target/expected_edge_coverage.out $target/edge_coverage.out > /dev/null
+    if [ $? -ne 0 ]; then
+        echo "Found differences: $target"
+        exit 1
+    fi
+}
+
+
+# Atom and address packets only
+run trace1 $FIB_IMAGES --start=$FIB_START --seed=1 --branches=20000
+
+# Every generated branch is counted as an atom by the statistics
+atoms=$($PROGRAM $(cat trace1/decoderargs.txt) --bitmap-filename=trace1/bitmap.out \
+                 --stats 2>&1 >/dev/null | grep "^atoms:" | cut -d " " -f 2)
+if [ "$atoms" != "20000" ]; then
+    echo "Unexpected number of atoms: $atoms"
+    exit 1
+fi
+
+# Multiple trace IDs, exceptions and discontinuities
+run trace2 $FIB_IMAGES --start=$FIB_START --seed=2 --branches=50000 \
+    --noise-ids=3 --exception-interval=100 --trace-on-interval=1000 \
+    --async-interval=256
+
+# Every cache mode reports the same edge coverage
+for mode in none branch trace; do
+    $PROGRAM $(cat trace2/decoderargs.txt) --bitmap-size=0x1000 \
+             --bitmap-filename=trace2/bitmap.out --print-edge-cov \
+             --cache-mode=$mode > trace2/edge_coverage_$mode.out
+    diff trace2/expected_edge_coverage.out trace2/edge_coverage_$mode.out > /dev/null
+    if [ $? -ne 0 ]; then
+        echo "Found differences: trace2 with --cache-mode=$mode"
+        exit 1
+    fi
+done
+
+# The caches on transparent huge pages give the same edge coverage
+$PROGRAM $(cat trace2/decoderargs.txt) --bitmap-size=0x1000 \
+         --bitmap-filename=trace2/bitmap.out --print-edge-cov --huge-pages \
+         > trace2/edge_coverage_huge_pages.out
+if ! diff trace2/expected_edge_coverage.out trace2/edge_coverage_huge_pages.out \
+        > /dev/null; then
+    echo "Found differences: trace2 with --huge-pages"
+    exit 1
+fi
+
+# The trace pack decompresses to the same trace data and gives the same edge
+# coverage. The small blocks make frames and packets cross the block boundaries.
+$PACKCONV trace2/cstrace.bin --output=trace2/cstrace.pack --block-size=1000
+$PACKCONV trace2/cstrace.pack --decompress --output=trace2/cstrace.raw
+$PACKCONV trace2/cstrace.pack --range=1234,5000 --output=trace2/range.raw
+$PROGRAM trace2/cstrace.pack $(cut -d " " -f 2- trace2/decoderargs.txt) \
+         --bitmap-size=0x1000 --bitmap-filename=trace2/bitmap.out \
+         --print-edge-cov > trace2/edge_coverage_pack.out
+if ! cmp trace2/cstrace.bin trace2/cstrace.raw ||
+   ! dd if=trace2/cstrace.bin bs=1 skip=$((0x1234)) count=$((0x5000)) \
+        2>/dev/null | cmp - trace2/range.raw ||
+   ! diff trace2/expected_edge_coverage.out trace2/edge_coverage_pack.out \
+        > /dev/null; then
+    echo "Found differences: trace2 trace pack"
+    exit 1
+fi
+
+# Blocks entered in the middle are found in the ranges already disassembled
+hits=$($PROGRAM $(cat trace2/decoderargs.txt) --bitmap-filename=trace2/bitmap.out \
+                --stats 2>&1 >/dev/null | grep "^block_interval_hits:" | cut -d " " -f 2)
+if [ "$hits" == "0" ]; then
+    echo "Unexpected number of block interval hits: $hits"
+    exit 1
+fi
+
+# The profile counts the block of every edge leaving each image
+$PROGRAM $(cat trace2/decoderargs.txt) --bitmap-filename=trace2/bitmap.out \
+         --edge-profile=trace2/profile
+for id in 0 1 2; do
+    ranges=$(awk 'NR == 1 { n = $1 } NR > 1 && NR <= n + 1 {
+                      split($0, a, ":"); sum += a[2] } END { print sum + 0 }' \
+                 trace2/profile.$id)
+    edges=$(grep -c "^0x[0-9a-f]* \[$id\] ->" trace2/expected_edge_coverage.out)
+    if [ "$ranges" != "$edges" ]; then
+        echo "Unexpected number of blocks in the profile of image $id: $ranges"
+        exit 1
+    fi
+done
+
+run trace3 $BRANCHES_IMAGES --start=$BRANCHES_START --seed=3 --branches=50000 \
+    --noise-ids=1 --exception-interval=500 --trace-on-interval=200
+
+# The edge log is converted back to the same edges and bitmap
+$PROGRAM $(cat trace3/decoderargs.txt) --bitmap-filename=trace3/bitmap.out \
+         --bitmap-cell-width=16 --edge-log=trace3/edge.log
+$EDGECONV trace3/edge.log > trace3/edge_log.out
+$EDGECONV trace3/edge.log --format=bitmap --bitmap-cell-width=16 \
+          --bitmap-filename=trace3/edge_log_bitmap.out
+if ! diff trace3/expected_edge_coverage.out trace3/edge_log.out > /dev/null ||
+   ! cmp trace3/bitmap.out trace3/edge_log_bitmap.out; then
+    echo "Found differences: trace3 edge log"
+    exit 1
+fi
+
+# The combined pass writes the same bitmaps as the separate edge and path passes
+$PROGRAM $(cat trace3/decoderargs.txt) --bitmap-type=path \
+         --bitmap-filename=trace3/path_bitmap.out --bitmap-cell-width=16
+$PROGRAM $(cat trace3/decoderargs.txt) --bitmap-filename=trace3/combined_bitmap.out \
+         --bitmap-cell-width=16 \
+         --path-bitmap-filename=trace3/combined_path_bitmap.out
+if ! cmp trace3/bitmap.out trace3/combined_bitmap.out ||
+   ! cmp trace3/path_bitmap.out trace3/combined_path_bitmap.out; then
+    echo "Found differences: trace3 combined edge and path coverage"
+    exit 1
+fi
+
+# The decoder skips the code of an image left out of the memory maps
+run trace5 $FIB_IMAGES --start=$FIB_START --seed=5 --branches=20000 \
+    --exception-interval=300 --trace-on-interval=500 --unmapped-images=1
+
+# The skipped atoms are counted separately
+stats=$($PROGRAM $(cat trace5/decoderargs.txt) --bitmap-filename=trace5/bitmap.out \
+                 --stats 2>&1 >/dev/null)
+atoms=$(echo "$stats" | grep "^atoms:" | cut -d " " -f 2)
+unmapped_atoms=$(echo "$stats" | grep "^unmapped_atoms:" | cut -d " " -f 2)
+if [ "$unmapped_atoms" == "0" ] || [ $((atoms + unmapped_atoms)) != "20000" ]; then
+    echo "Unexpected number of atoms: $atoms + $unmapped_atoms"
+    exit 1
+fi
+
+# The path coverage skips the same code
+$PROGRAM $(cat trace5/decoderargs.txt) --bitmap-type=path \
+         --bitmap-filename=trace5/path_bitmap.out
+$PROGRAM $(cat trace5/decoderargs.txt) --bitmap-filename=trace5/combined_bitmap.out \
+         --path-bitmap-filename=trace5/combined_path_bitmap.out
+if ! cmp trace5/bitmap.out trace5/combined_bitmap.out ||
+   ! cmp trace5/path_bitmap.out trace5/combined_path_bitmap.out; then
+    echo "Found differences: trace5 combined edge and path coverage"
+    exit 1
+fi
+
+# The trace of other contexts is skipped by the context ID
+run trace6 $FIB_IMAGES --start=$FIB_START --seed=6 --branches=50000 \
+    --context-id=1234 --other-context-interval=200 --exception-interval=500 \
+    --trace-on-interval=1000 --noise-ids=1
+
+# One pass decodes the other contexts into their own bitmaps, the same as
+# filtering the trace by each of them
+args=$(cat trace6/decoderargs.txt | sed "s/ --context-id=[0-9a-f]*//")
+for id in 1234 1235 1236; do
+    $PROGRAM $args --context-id=$id --bitmap-filename=trace6/bitmap_$id.out
+done
+$PROGRAM $args --context-id=1234 --bitmap-filename=trace6/session_bitmap_1234.out \
+         --context-bitmap=1235,trace6/session_bitmap_1235.out \
+         --context-bitmap=1236,trace6/session_bitmap_1236.out
+if ! cmp trace6/bitmap_1234.out trace6/session_bitmap_1234.out ||
+   ! cmp trace6/bitmap_1235.out trace6/session_bitmap_1235.out ||
+   ! cmp trace6/bitmap_1236.out trace6/session_bitmap_1236.out; then
+    echo "Found differences: trace6 context sessions"
+    exit 1
+fi
+
+# The decoder resynchronizes at the next Async packet after corrupted bytes
+run trace7 $BRANCHES_IMAGES --start=$BRANCHES_START --seed=7 --branches=30000 \
+    --corrupt-interval=300 --exception-interval=500 --noise-ids=1
+
+# The corrupted bytes are skipped without being decoded
+stats=$($PROGRAM $(cat trace7/decoderargs.txt) --bitmap-filename=trace7/bitmap.out \
+                 --stats 2>&1 >/dev/null)
+unknown_packets=$(echo "$stats" | grep "^unknown_packets:" | cut -d " " -f 2)
+unsynced_bytes=$(echo "$stats" | grep "^unsynced_bytes:" | cut -d " " -f 2)
+if [ "$unknown_packets" == "0" ] || [ "$unsynced_bytes" == "0" ]; then
+    echo "Unexpected resynchronization: $unknown_packets $unsynced_bytes"
+    exit 1
+fi
+
+# Branch decisions given by a script
+run trace4 $BRANCHES_IMAGES --start=$BRANCHES_START --script=script.txt \
+    --noise-ids=2
+
+# The decoder reports the expected edge coverage for all synthetic trace data
+echo "PASSED synthetic test"
@@ -0,0 +1,922 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright 2021 Ricerca Security, Inc. All rights reserved. */
+
+// Synthetic ETMv4 trace generator. The generator walks the static control flow
+// graph of the given memory images, either with random branch decisions or
+// with the decisions of a script, and writes the formatted trace data together
+// with the edges that the decoder is expected to report. No ARM hardware is
+// required, and the size of the trace is only limited by the number of
+// branches to generate.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <linux/limits.h>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "common.hpp"
+#include "disassembler.hpp"
+#include "utils.hpp"
+
+// The trace ID 0 is reserved by the formatter to pad the frames.
+static const std::uint8_t NULL_TRACE_ID = 0;
+static const std::size_t FRAME_SIZE = 16;
+
+// The maximum number of E atoms encoded by an Atom format 6 packet, followed by
+// one more E or N atom. The decoder accepts up to 24 atoms in one packet.
+static const std::size_t MAX_ATOM_F6_E_CNT = 23;
+
+// Atoms are written out at least every MAX_PENDING_ATOM_NUM atoms.
+static const std::size_t MAX_PENDING_ATOM_NUM = 64;
+
+static const std::size_t MAX_CALL_STACK_DEPTH = 1024;
+
+// Addresses of the exception vectors reported by the exception packets. They
+// are outside of the memory maps, as in the case of a kernel.
+static const addr_t EXCEPTION_VECTOR_BASE = 0xffff800010010000;
+
+// Encoder of the ETMv4 instruction trace stream of a single trace ID.
+struct PacketEncoder {
+  binary_data_t data;
+
+  // The address register of the decoder, to compress address packets.
+  addr_t address_reg;
+
+  // Atoms that have not been written as atom packets yet.
+  std::vector<bool> atoms;
+
+  // An Async packet is inserted every async_interval bytes at the boundary
+  // of packets. 0 disables it.
+  std::size_t async_interval;
+  std::size_t next_async_offset;
+
+  PacketEncoder(std::size_t async_interval)
+      : address_reg(0), async_interval(async_interval),
+        next_async_offset(async_interval) {}
+
+  void appendAsyncPacket() {
+    this->data.insert(this->data.end(), 11, 0x00);
+    this->data.emplace_back(0x80);
+  }
+
+  void appendTraceInfoPacket() {
+    this->data.emplace_back(0b00000001);
+    this->data.emplace_back(0x00);
+  }
+
+  // A reserved header followed by random bytes, as in a corrupted trace
+  // buffer. The bytes are not zero, so that they do not form an A-sync packet.
+  void appendCorruptBytes(std::mt19937_64 &rng) {
+    this->flushAtoms();
+    this->data.emplace_back(0b00000101);
+    const std::size_t size = 1 + rng() % 64;
+    for (std::size_t i = 0; i < size; ++i) {
+      this->data.emplace_back(1 + rng() % 255);
+    }
+  }
+
+  void appendTraceOnPacket() {
+    this->flushAtoms();
+    this->data.emplace_back(0b00000100);
+  }
+
+  // An exception packet is followed by the preferred exception return address
+  // and the address of the exception vector.
+  void appendExceptionPacket(std::uint8_t exception_type, addr_t return_address,
+                             addr_t vector_address) {
+    this->flushAtoms();
+    this->data.emplace_back(0b00000110);
+    this->data.emplace_back((exception_type & 0b11111) << 1);
+    this->appendLongAddressPacket(return_address);
+    this->appendLongAddressPacket(vector_address);
+  }
+
+  void appendLongAddressPacket(addr_t address) {
+    this->data.emplace_back(0b10011101);
+    this->appendLongAddress(address);
+  }
+
+  // 64-bit IS0 long Address packet with an information byte, followed by the
+  // Context ID section if the context ID is given.
+  void appendLongAddressWithContextPacket(
+      addr_t address, std::optional<std::uint32_t> context_id = std::nullopt) {
+    this->data.emplace_back(0b10000101);
+    this->appendLongAddress(address);
+    this->appendContextInfo(context_id);
+  }
+
+  // Context packet with a payload.
+  void appendContextPacket(std::optional<std::uint32_t> context_id) {
+    this->data.emplace_back(0b10000001);
+    this->appendContextInfo(context_id);
+  }
+
+  // Returns false if the address cannot be compressed into an IS0 Short
+  // Address packet.
+  bool appendShortAddressPacket(addr_t address) {
+    if ((address & ~(addr_t)0x1FF) == (this->address_reg & ~(addr_t)0x1FF)) {
+      this->data.emplace_back(0b10010101);
+      this->data.emplace_back((address >> 2) & 0x7F);
+    } else if ((address & ~(addr_t)0x1FFFF) ==
+               (this->address_reg & ~(addr_t)0x1FFFF)) {
+      this->data.emplace_back(0b10010101);
+      this->data.emplace_back(0b10000000 | ((address >> 2) & 0x7F));
+      this->data.emplace_back((address >> 9) & 0xFF);
+    } else {
+      return false;
+    }
+    this->address_reg = address;
+    return true;
+  }
+
+  // The indirect branch must be the last atom of a packet, because the
+  // address packet of the branch destination follows it.
+  void addAtom(bool is_taken) {
+    this->atoms.emplace_back(is_taken);
+    if (this->atoms.size() >= MAX_PENDING_ATOM_NUM) {
+      this->flushAtoms();
+    }
+  }
+
+  void flushAtoms() {
+    std::size_t i = 0;
+    const std::size_t len = this->atoms.size();
+    while (i < len) {
+      std::size_t e_cnt = 0;
+      while (i + e_cnt < len and this->atoms[i + e_cnt] and
+             e_cnt < MAX_ATOM_F6_E_CNT) {
+        ++e_cnt;
+      }
+      // Atom format 6 needs at least 3 E atoms followed by one more atom.
+      if (i + e_cnt == len) {
+        --e_cnt;
+      }
+
+      if (e_cnt >= 3) {
+        const bool is_last_taken = this->atoms[i + e_cnt];
+        this->data.emplace_back((is_last_taken ? 0b11000000 : 0b11100000) |
+                                (e_cnt - 3));
+        i += e_cnt + 1;
+      } else if (len - i >= 3) {
+        this->data.emplace_back(0b11111000 | this->atoms[i] |
+                                this->atoms[i + 1] << 1 |
+                                this->atoms[i + 2] << 2);
+        i += 3;
+      } else if (len - i == 2) {
+        this->data.emplace_back(0b11011000 | this->atoms[i] |
+                                this->atoms[i + 1] << 1);
+        i += 2;
+      } else {
+        this->data.emplace_back(0b11110110 | this->atoms[i]);
+        i += 1;
+      }
+    }
+    this->atoms.clear();
+
+    if (this->async_interval and this->data.size() >= this->next_async_offset) {
+      this->appendAsyncPacket();
+      this->next_async_offset = this->data.size() + this->async_interval;
+    }
+  }
+
+private:
+  void appendContextInfo(std::optional<std::uint32_t> context_id) {
+    this->data.emplace_back(context_id.has_value() ? 0b10000000 : 0);
+    if (context_id.has_value()) {
+      for (int i = 0; i < 4; ++i) {
+        this->data.emplace_back((context_id.value() >> (i * 8)) & 0xFF);
+      }
+    }
+  }
+
+  void appendLongAddress(addr_t address) {
+    this->data.emplace_back((address >> 2) & 0x7F);
+    this->data.emplace_back((address >> 9) & 0x7F);
+    for (int i = 2; i < 8; ++i) {
+      this->data.emplace_back((address >> (i * 8)) & 0xFF);
+    }
+    this->address_reg = address;
+  }
+};
+
+// A piece of the data of one trace ID, written to the formatter frames.
+struct Chunk {
+  std::uint8_t trace_id;
+  const std::uint8_t *data;
+  std::size_t size;
+};
+
+// Writes the chunks to formatter frames. An ID byte can only be placed at an
+// even position of a frame. When a chunk ends at an even position, the ID byte
+// of the next chunk is written there with the auxiliary bit set, so that it
+// takes effect after the last byte of the chunk.
+binary_data_t formatTraceData(const std::vector<Chunk> &chunks) {
+  binary_data_t out;
+  binary_data_t frame(FRAME_SIZE, 0);
+  std::size_t pos = 0;
+  std::optional<std::uint8_t> current_id;
+
+  const auto put = [&](std::uint8_t byte, bool is_id, bool is_delayed) {
+    if (pos % 2 == 0) {
+      frame[pos] = is_id ? byte : byte & 0xFE;
+      const bool aux = is_id ? is_delayed : byte & 1;
+      frame[FRAME_SIZE - 1] |= aux << (pos / 2);
+    } else {
+      frame[pos] = byte;
+    }
+
+    if (++pos == FRAME_SIZE - 1) {
+      out.insert(out.end(), frame.begin(), frame.end());
+      std::fill(frame.begin(), frame.end(), 0);
+      pos = 0;
+    }
+  };
+
+  for (std::size_t i = 0; i < chunks.size(); ++i) {
+    const Chunk &chunk = chunks[i];
+    const std::uint8_t next_id =
+        (i + 1 < chunks.size()) ? chunks[i + 1].trace_id : NULL_TRACE_ID;
+
+    for (std::size_t j = 0; j < chunk.size; ++j) {
+      if (current_id != chunk.trace_id) {
+        put((chunk.trace_id << 1) | 1, true, false);
+        current_id = chunk.trace_id;
+      }
+
+      const bool is_last = (j + 1 == chunk.size);
+      if (is_last and next_id != chunk.trace_id and pos % 2 == 0 and
+          pos < FRAME_SIZE - 2) {
+        put((next_id << 1) | 1, true, true);
+        current_id = next_id;
+      }
+      put(chunk.data[j], false, false);
+    }
+  }
+
+  // Pad the last frame.
+  if (pos != 0) {
+    if (current_id != NULL_TRACE_ID) {
+      put((NULL_TRACE_ID << 1) | 1, true, false);
+    }
+    while (pos != 0) {
+      put(0, false, false);
+    }
+  }
+
+  return out;
+}
+
+// Branch instructions of a memory image, used to walk the control flow graph
+// without disassembling at every step.
+struct CodeImage {
+  // Sorted by the offset.
+  std::vector<BranchInsn> branch_insns;
+  // Offsets of the words that cannot be disassembled. The decoder fails if it
+  // runs into them, so the walk avoids them.
+  std::vector<addr_t> invalid_offsets;
+  // Targets of the BL instructions, used as the destinations of indirect
+  // branches and trace discontinuities.
+  std::vector<addr_t> entries;
+  // The walk stays within the mapped part of the image.
+  addr_t size;
+};
+
+struct Walker {
+  const std::vector<MemoryImage> &memory_images;
+  const std::vector<MemoryMap> &memory_maps;
+  std::vector<CodeImage> code_images;
+  std::vector<Location> entries;
+
+  Walker(const csh &handle, const std::vector<MemoryImage> &memory_images,
+         const std::vector<MemoryMap> &memory_maps)
+      : memory_images(memory_images), memory_maps(memory_maps) {
+    for (const MemoryImage &memory_image : memory_images) {
+      const MemoryMap &memory_map = memory_maps[memory_image.id];
+
+      CodeImage code_image;
+      code_image.branch_insns = getBranchInsns(handle, memory_image);
+      code_image.invalid_offsets = getInvalidOffsets(handle, memory_image);
+      code_image.size =
+          std::min<addr_t>(memory_map.end_address - memory_map.start_address,
+                           memory_image.data.size());
+      this->code_images.emplace_back(std::move(code_image));
+    }
+
+    for (const CodeImage &code_image : this->code_images) {
+      for (const BranchInsn &insn : code_image.branch_insns) {
+        const Location target(insn.taken_offset, insn.id);
+        if (insn.type == BranchType::DIRECT_BRANCH and
+            isCall(this->getInsnWord(insn)) and this->isWalkable(target)) {
+          this->entries.emplace_back(target);
+        }
+      }
+    }
+  }
+
+  std::optional<BranchInsn> findNextBranchInsn(const Location &location) const {
+    const CodeImage &code_image = this->code_images[location.id];
+
+    const auto insn = std::lower_bound(
+        code_image.branch_insns.begin(), code_image.branch_insns.end(),
+        location.offset, [](const BranchInsn &insn, addr_t offset) {
+          return insn.offset < offset;
+        });
+    if (insn == code_image.branch_insns.end() or
+        insn->offset >= code_image.size) {
+      return std::nullopt;
+    }
+
+    const auto invalid_offset =
+        std::lower_bound(code_image.invalid_offsets.begin(),
+                         code_image.invalid_offsets.end(), location.offset);
+    if (invalid_offset != code_image.invalid_offsets.end() and
+        *invalid_offset < insn->offset) {
+      return std::nullopt;
+    }
+
+    return *insn;
+  }
+
+  bool isWalkable(const Location &location) const {
+    return location.id < this->code_images.size() and
+           location.offset % 4 == 0 and
+           location.offset < this->code_images[location.id].size and
+           this->findNextBranchInsn(location).has_value();
+  }
+
+  std::uint32_t getInsnWord(const BranchInsn &insn) const {
+    const binary_data_t &data = this->memory_images[insn.id].data;
+    std::uint32_t word;
+    std::memcpy(&word, &data[insn.offset], sizeof(word));
+    return word;
+  }
+
+  addr_t getAddress(const Location &location) const {
+    return this->memory_maps[location.id].start_address + location.offset;
+  }
+
+  // B and BL
+  static bool isUnconditional(std::uint32_t word) {
+    return (word & 0x7C000000) == 0x14000000;
+  }
+
+  // BL and BLR
+  static bool isCall(std::uint32_t word) {
+    return (word & 0xFC000000) == 0x94000000 or
+           (word & 0xFFFFFC1F) == 0xD63F0000;
+  }
+
+  static bool isReturn(std::uint32_t word) {
+    return (word & 0xFFFFFC1F) == 0xD65F0000;
+  }
+
+private:
+  static std::vector<addr_t>
+  getInvalidOffsets(const csh &handle, const MemoryImage &memory_image) {
+    std::vector<addr_t> invalid_offsets;
+
+    const std::uint8_t *code_ptr = memory_image.data.data();
+    std::size_t code_size = memory_image.data.size();
+    std::uint64_t address = 0;
+
+    cs_insn *insn = cs_malloc(handle);
+    while (code_size >= 4) {
+      if (not cs_disasm_iter(handle, &code_ptr, &code_size, &address, insn)) {
+        invalid_offsets.emplace_back(address);
+        code_ptr += 4;
+        code_size -= 4;
+        address += 4;
+      }
+    }
+    cs_free(insn, 1);
+
+    return invalid_offsets;
+  }
+};
+
+// Decisions read from a script. A token consisting of E and N gives the
+// decisions of conditional branches, and a token starting with 0x gives the
+// destination address of the next indirect branch.
+struct Script {
+  std::vector<std::string> tokens;
+  std::size_t token_idx = 0;
+  std::size_t char_idx = 0;
+
+  bool isEnd() const { return this->token_idx >= this->tokens.size(); }
+
+  bool isNextAddress() const {
+    return not this->isEnd() and
+           this->tokens[this->token_idx].rfind("0x", 0) == 0;
+  }
+
+  addr_t nextAddress() {
+    return std::stoul(this->tokens[this->token_idx++], nullptr, 16);
+  }
+
+  bool nextDecision() {
+    const std::string &token = this->tokens[this->token_idx];
+    const char c = token[this->char_idx];
+    if (c != 'E' and c != 'N') {
+      std::cerr << "Invalid token in the script: " << token << std::endl;
+      std::exit(1);
+    }
+
+    if (++this->char_idx == token.size()) {
+      ++this->token_idx;
+      this->char_idx = 0;
+    }
+    return c == 'E';
+  }
+};
+
+struct GeneratorConfig {
+  std::size_t branch_num = 100000;
+  std::uint64_t seed = 0;
+  std::size_t noise_id_num = 0;
+  // The average number of branches between two events. 0 disables the event.
+  std::size_t exception_interval = 0;
+  std::size_t trace_on_interval = 0;
+  // The trace of other contexts than context_id is inserted.
+  std::size_t other_context_interval = 0;
+  // The corrupted bytes are inserted at the start of the trace too.
+  std::size_t corrupt_interval = 0;
+  std::size_t async_interval = 4096;
+  std::optional<std::uint32_t> context_id;
+  // The last unmapped_image_num images are left out of the memory maps of the
+  // decoder. The walk goes through them, but their edges are not reported.
+  std::size_t unmapped_image_num = 0;
+  bool print_edges = true;
+};
+
+struct GeneratorStats {
+  std::size_t branch_num = 0;
+  std::size_t edge_num = 0;
+  std::size_t exception_num = 0;
+  std::size_t trace_on_num = 0;
+  std::size_t other_context_num = 0;
+  std::size_t corruption_num = 0;
+};
+
+void writeEdge(std::ostream &stream, const Location &from,
+               const Location &to) {
+  stream << std::hex << "0x" << from.offset << " [" << from.id << "] -> 0x"
+         << to.offset << " [" << to.id << "]\n";
+}
+
+// Walks the control flow graph from the start location and encodes the
+// executed branches. The edges are written in the order the decoder reports
+// them.
+GeneratorStats generateTrace(const Walker &walker, const Location &start,
+                             const GeneratorConfig &config,
+                             std::optional<Script> &script,
+                             std::mt19937_64 &rng, PacketEncoder &encoder,
+                             std::ostream &edge_stream) {
+  GeneratorStats stats;
+  std::vector<Location> call_stack;
+
+  const auto chooseEntry = [&]() {
+    return walker.entries.empty()
+               ? start
+               : walker.entries[rng() % walker.entries.size()];
+  };
+  // The decoder skips the trace outside the memory maps, and resumes at the
+  // next address on them without an edge from the unmapped code.
+  const std::size_t mapped_image_num =
+      walker.memory_images.size() - config.unmapped_image_num;
+  const auto addEdge = [&](const Location &from, const Location &to) {
+    if (config.print_edges and from.id < mapped_image_num and
+        to.id < mapped_image_num) {
+      writeEdge(edge_stream, from, to);
+    }
+    ++stats.edge_num;
+  };
+
+  // The capture begins in the middle of a packet.
+  if (config.corrupt_interval) {
+    encoder.appendCorruptBytes(rng);
+  }
+  encoder.appendAsyncPacket();
+  encoder.appendTraceInfoPacket();
+  if (config.context_id.has_value()) {
+    encoder.appendContextPacket(config.context_id);
+  }
+  encoder.appendLongAddressPacket(walker.getAddress(start));
+
+  Location location = start;
+  while (stats.branch_num < config.branch_num) {
+    if (script.has_value() and script->isEnd()) {
+      break;
+    }
+
+    if (config.exception_interval and rng() % config.exception_interval == 0) {
+      encoder.appendExceptionPacket(
+          rng(), walker.getAddress(location),
+          EXCEPTION_VECTOR_BASE + (rng() % 16) * 0x80);
+      ++stats.exception_num;
+    }
+
+    // The target is switched out, and another context runs for a while. Its
+    // atoms and addresses look valid, so the decoder must skip them by the
+    // context ID. The target resumes at the same location, without an edge.
+    if (config.other_context_interval and
+        rng() % config.other_context_interval == 0) {
+      encoder.flushAtoms();
+      encoder.appendLongAddressWithContextPacket(
+          walker.getAddress(chooseEntry()),
+          config.context_id.value() + 1 + rng() % 3);
+      const std::size_t atom_num = 1 + rng() % 128;
+      for (std::size_t i = 0; i < atom_num; ++i) {
+        encoder.addAtom(rng() & 1);
+        if (rng() % 16 == 0) {
+          encoder.flushAtoms();
+          encoder.appendLongAddressPacket(walker.getAddress(chooseEntry()));
+        }
+      }
+      encoder.flushAtoms();
+      if (rng() & 1) {
+        encoder.appendLongAddressWithContextPacket(walker.getAddress(location),
+                                                   config.context_id);
+      } else {
+        encoder.appendContextPacket(config.context_id);
+        encoder.appendLongAddressPacket(walker.getAddress(location));
+      }
+      ++stats.other_context_num;
+    }
+
+    // The trace buffer is corrupted, e.g. partially overwritten. The decoder
+    // loses the packet boundaries at the reserved header, and the trace starts
+    // again after the next A-sync packet, so there is no edge.
+    if (config.corrupt_interval and rng() % config.corrupt_interval == 0) {
+      location = chooseEntry();
+      call_stack.clear();
+      encoder.appendCorruptBytes(rng);
+      encoder.appendAsyncPacket();
+      encoder.appendTraceInfoPacket();
+      encoder.appendLongAddressPacket(walker.getAddress(location));
+      ++stats.corruption_num;
+      continue;
+    }
+
+    // A discontinuity of the trace, e.g. after the trace was disabled by the
+    // filter. The trace resumes at a different location, so there is no edge.
+    if (not walker.isWalkable(location) or
+        (config.trace_on_interval and rng() % config.trace_on_interval == 0)) {
+      location = chooseEntry();
+      call_stack.clear();
+      encoder.appendTraceOnPacket();
+      if (rng() & 1) {
+        encoder.appendLongAddressPacket(walker.getAddress(location));
+      } else {
+        encoder.appendLongAddressWithContextPacket(walker.getAddress(location));
+      }
+      ++stats.trace_on_num;
+      continue;
+    }
+
+    const BranchInsn insn = walker.findNextBranchInsn(location).value();
+    const std::uint32_t word = walker.getInsnWord(insn);
+    ++stats.branch_num;
+
+    switch (insn.type) {
+    case BranchType::ISB_BRANCH: {
+      const Location next(insn.taken_offset, insn.id);
+      encoder.addAtom(true);
+      addEdge(location, next);
+      location = next;
+      break;
+    }
+
+    case BranchType::DIRECT_BRANCH: {
+      const Location taken(insn.taken_offset, insn.id);
+      const Location not_taken(insn.not_taken_offset, insn.id);
+
+      bool is_taken = true;
+      if (script.has_value() and not Walker::isUnconditional(word)) {
+        is_taken = script->nextDecision();
+      } else if (not Walker::isUnconditional(word)) {
+        is_taken = rng() & 1;
+        // Prefer the direction that the walk can continue from.
+        if (not walker.isWalkable(is_taken ? taken : not_taken)) {
+          is_taken = not is_taken;
+        }
+      }
+
+      const Location next = is_taken ? taken : not_taken;
+      encoder.addAtom(is_taken);
+      addEdge(location, next);
+
+      if (is_taken and Walker::isCall(word) and
+          call_stack.size() < MAX_CALL_STACK_DEPTH) {
+        call_stack.emplace_back(not_taken);
+      }
+      location = next;
+      break;
+    }
+
+    case BranchType::INDIRECT_BRANCH: {
+      Location next;
+      if (script.has_value() and script->isNextAddress()) {
+        const addr_t address = script->nextAddress();
+        const std::optional<Location> optional_next =
+            getLocation(walker.memory_maps, address);
+        if (not optional_next.has_value()) {
+          std::cerr << "The address is not on the memory map: 0x" << std::hex
+                    << address << std::endl;
+          std::exit(1);
+        }
+        next = optional_next.value();
+      } else if (Walker::isReturn(word) and not call_stack.empty()) {
+        next = call_stack.back();
+        call_stack.pop_back();
+      } else {
+        next = chooseEntry();
+      }
+
+      if (Walker::isCall(word) and call_stack.size() < MAX_CALL_STACK_DEPTH) {
+        call_stack.emplace_back(insn.offset + 4, insn.id);
+      }
+
+      encoder.addAtom(true);
+      encoder.flushAtoms();
+
+      const addr_t address = walker.getAddress(next);
+      const std::uint64_t r = rng() % 4;
+      if (r == 0) {
+        encoder.appendLongAddressPacket(address);
+      } else if (r == 1) {
+        encoder.appendLongAddressWithContextPacket(address);
+      } else if (not encoder.appendShortAddressPacket(address)) {
+        encoder.appendLongAddressPacket(address);
+      }
+
+      addEdge(location, next);
+      location = next;
+      break;
+    }
+
+    default:
+      __builtin_unreachable();
+    }
+  }
+
+  encoder.flushAtoms();
+  return stats;
+}
+
+// Splits the trace into chunks interleaved with the chunks of other trace IDs
+// carrying random bytes.
+std::vector<Chunk> createChunks(const binary_data_t &trace,
+                                std::uint8_t trace_id,
+                                const binary_data_t &noise,
+                                std::size_t noise_id_num,
+                                std::mt19937_64 &rng) {
+  std::vector<Chunk> chunks;
+  std::size_t offset = 0;
+  while (offset < trace.size()) {
+    if (noise_id_num and rng() % 2 == 0) {
+      const std::uint8_t noise_id = trace_id + 1 + rng() % noise_id_num;
+      const std::size_t size = 1 + rng() % 32;
+      chunks.emplace_back(Chunk{noise_id, noise.data() + rng() % 32, size});
+    }
+
+    const std::size_t size =
+        std::min<std::size_t>(1 + rng() % 64, trace.size() - offset);
+    chunks.emplace_back(Chunk{trace_id, trace.data() + offset, size});
+    offset += size;
+  }
+  return chunks;
+}
+
+void usage(const char *argv0) {
+  std::cerr << "Usage: " << argv0 << " "
+            << "[output_dir] [trace_id] [binary_file_num] "
+            << "[binary_data1_filename] [binary_data1_start_address] "
+               "[binary_data1_end_address] ... "
+            << "[binary_dataN_filename] [binary_dataN_start_address] "
+               "[binary_dataN_end_address] --start=address [OPTIONS]"
+            << std::endl
+            << "OPTIONS:" << std::endl
+            << "\t--start=address            : Specify the address where the "
+               "trace starts in hexadecimal."
+            << std::endl
+            << "\t--branches=num             : Specify the number of branches "
+               "to generate. The default number is 100000."
+            << std::endl
+            << "\t--seed=num                 : Specify the seed of the random "
+               "walk. The default seed is 0."
+            << std::endl
+            << "\t--script=filename          : Take the branch decisions from "
+               "the script instead of the random walk."
+            << std::endl
+            << "\t--noise-ids=num            : Interleave the trace with num "
+               "other trace IDs. The default number is 0."
+            << std::endl
+            << "\t--exception-interval=num   : Insert an exception every num "
+               "branches on average. The default is 0 (disabled)."
+            << std::endl
+            << "\t--trace-on-interval=num    : Insert a trace discontinuity "
+               "every num branches on average. The default is 0 (disabled)."
+            << std::endl
+            << "\t--context-id=id            : Specify the context ID of the "
+               "trace in hexadecimal. The processor decodes only this context "
+               "ID."
+            << std::endl
+            << "\t--other-context-interval=num : Insert the trace of other "
+               "context IDs every num branches on average. The default is 0 "
+               "(disabled). It needs --context-id."
+            << std::endl
+            << "\t--corrupt-interval=num     : Insert corrupted bytes "
+               "followed by an Async packet every num branches on average, and "
+               "at the start. The default is 0 (disabled)."
+            << std::endl
+            << "\t--async-interval=size      : Insert an Async packet every "
+               "size bytes. The default size is 4096."
+            << std::endl
+            << "\t--unmapped-images=num      : Leave the last num images out of "
+               "the arguments of the processor. The default number is 0."
+            << std::endl
+            << "\t--no-edges                 : Do not write the expected edge "
+               "coverage."
+            << std::endl
+            << std::endl
+            << "The trace data, the arguments of the processor and the "
+               "expected edge coverage are written to cstrace.bin, "
+               "decoderargs.txt and expected_edge_coverage.out in output_dir."
+            << std::endl;
+}
+
+int main(int argc, char const *argv[]) {
+  checkCapstoneVersion();
+
+  if (argc < 7) {
+    usage(argv[0]);
+    std::exit(EXIT_FAILURE);
+  }
+
+  const std::string output_dir = argv[1];
+  const std::uint8_t trace_id = std::stol(argv[2], nullptr, 16);
+  const int binary_file_num = std::stol(argv[3], nullptr, 10);
+
+  if (binary_file_num <= 0) {
+    std::cerr << "Specify 1 or more for the number of binary files."
+              << std::endl;
+    std::exit(1);
+  }
+  if (argc < binary_file_num * 3 + 4) {
+    std::cerr << "Fewer arguments for binary file information." << std::endl;
+    std::exit(1);
+  }
+
+  GeneratorConfig config;
+  std::optional<addr_t> start_address;
+  std::optional<Script> script;
+  for (int i = binary_file_num * 3 + 4; i < argc; ++i) {
+    addr_t address = 0;
+    std::uint32_t context_id = 0;
+    char buf[PATH_MAX];
+    if (sscanf(argv[i], "--start=%lx", &address) == 1) {
+      start_address = address;
+    } else if (sscanf(argv[i], "--branches=%zu", &config.branch_num) == 1) {
+      continue;
+    } else if (sscanf(argv[i], "--seed=%lu", &config.seed) == 1) {
+      continue;
+    } else if (sscanf(argv[i], "--script=%s", buf) == 1) {
+      std::ifstream file(buf);
+      if (not file) {
+        std::cerr << "Cannot open the script: " << buf << std::endl;
+        std::exit(1);
+      }
+      script.emplace();
+      std::string token;
+      while (file >> token) {
+        script->tokens.emplace_back(token);
+      }
+    } else if (sscanf(argv[i], "--noise-ids=%zu", &config.noise_id_num) == 1) {
+      continue;
+    } else if (sscanf(argv[i], "--exception-interval=%zu",
+                      &config.exception_interval) == 1) {
+      continue;
+    } else if (sscanf(argv[i], "--trace-on-interval=%zu",
+                      &config.trace_on_interval) == 1) {
+      continue;
+    } else if (sscanf(argv[i], "--context-id=%x", &context_id) == 1) {
+      config.context_id = context_id;
+    } else if (sscanf(argv[i], "--other-context-interval=%zu",
+                      &config.other_context_interval) == 1) {
+      continue;
+    } else if (sscanf(argv[i], "--corrupt-interval=%zu",
+                      &config.corrupt_interval) == 1) {
+      continue;
+    } else if (sscanf(argv[i], "--async-interval=%zu",
+                      &config.async_interval) == 1) {
+      continue;
+    } else if (sscanf(argv[i], "--unmapped-images=%zu",
+                      &config.unmapped_image_num) == 1) {
+      continue;
+    } else if (std::strcmp(argv[i], "--no-edges") == 0) {
+      config.print_edges = false;
+    } else {
+      std::cerr << "Invalid option: " << argv[i] << std::endl;
+      std::exit(1);
+    }
+  }
+
+  if (trace_id == NULL_TRACE_ID or trace_id + config.noise_id_num >= 0x70) {
+    std::cerr << "The trace IDs must be in the range of 0x01 to 0x6f."
+              << std::endl;
+    std::exit(1);
+  }
+
+  if (config.other_context_interval and not config.context_id.has_value()) {
+    std::cerr << "Specify the context ID with --context-id." << std::endl;
+    std::exit(1);
+  }
+  if (config.unmapped_image_num >= (std::size_t)binary_file_num) {
+    std::cerr << "At least one image must be on the memory maps." << std::endl;
+    std::exit(1);
+  }
+
+  std::vector<MemoryImage> memory_images;
+  std::vector<MemoryMap> memory_maps;
+  for (int id = 0; id < binary_file_num; ++id) {
+    memory_images.emplace_back(
+        MemoryImage(readBinaryFile(argv[4 + id * 3]), (std::size_t)id));
+
+    const addr_t start = std::stoul(argv[4 + id * 3 + 1], nullptr, 16);
+    const addr_t end = std::stoul(argv[4 + id * 3 + 2], nullptr, 16);
+    memory_maps.emplace_back(MemoryMap(start, end, id));
+  }
+
+  if (not start_address.has_value()) {
+    std::cerr << "Specify the start address with --start." << std::endl;
+    std::exit(1);
+  }
+  const std::optional<Location> start =
+      getLocation(memory_maps, start_address.value());
+  if (not start.has_value() or
+      start->id >= binary_file_num - config.unmapped_image_num) {
+    std::cerr << "The start address is not on the memory map." << std::endl;
+    std::exit(1);
+  }
+
+  csh handle;
+  disassembleInit(&handle);
+  const Walker walker(handle, memory_images, memory_maps);
+  disassembleDelete(&handle);
+
+  if (not walker.isWalkable(start.value())) {
+    std::cerr << "No branch instruction is reachable from the start address."
+              << std::endl;
+    std::exit(1);
+  }
+
+  std::mt19937_64 rng(config.seed);
+  PacketEncoder encoder(config.async_interval);
+
+  std::ofstream edge_stream;
+  if (config.print_edges) {
+    edge_stream.open(output_dir + "/expected_edge_coverage.out");
+    if (not edge_stream) {
+      std::cerr << "Cannot open the output directory: " << output_dir
+                << std::endl;
+      std::exit(1);
+    }
+  }
+
+  const GeneratorStats stats = generateTrace(
+      walker, start.value(), config, script, rng, encoder, edge_stream);
+
+  binary_data_t noise(64);
+  for (std::uint8_t &byte : noise) {
+    byte = rng();
+  }
+  const binary_data_t trace_data = formatTraceData(
+      createChunks(encoder.data, trace_id, noise, config.noise_id_num, rng));
+  writeBinaryFile(trace_data, output_dir + "/cstrace.bin");
+
+  const int mapped_file_num = binary_file_num - config.unmapped_image_num;
+  std::ofstream args_stream(output_dir + "/decoderargs.txt");
+  args_stream << output_dir << "/cstrace.bin " << std::hex << "0x"
+              << (int)trace_id << std::dec << " " << mapped_file_num;
+  for (int i = 4; i < mapped_file_num * 3 + 4; ++i) {
+    args_stream << " " << argv[i];
+  }
+  if (config.context_id.has_value()) {
+    args_stream << " --context-id=" << std::hex << config.context_id.value();
+  }
+  args_stream << std::endl;
+
+  std::cerr << std::dec << "Generated " << stats.branch_num << " branches, "
+            << stats.edge_num << " edges, " << stats.exception_num
+            << " exceptions, " << stats.trace_on_num << " discontinuities, "
+            << stats.other_context_num << " other contexts, "
+            << stats.corruption_num << " corruptions in "
+            << trace_data.size() << " bytes." << std::endl;
+
+  return 0;
+}
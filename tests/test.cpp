@@ -16,6 +16,7 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <vector>
 
@@ -92,10 +93,12 @@ libcsdec_memory_map *read_memory_map(const std::string &decoder_args_path,
 }
 
 std::optional<double> run_decoder(libcsdec_t &libcsdec,
+                                  libcsdec_async_t async,
                                   const std::string &decoder_args_path,
                                   unsigned char *global_bitmap,
                                   unsigned char *local_bitmap,
-                                  const int bitmap_size, bool has_new_cov) {
+                                  const int bitmap_size, bool has_new_cov,
+                                  std::optional<size_t> split_offset) {
   char trace_data_filepath[PATH_MAX];
   int trace_id = 0;
   int memory_map_num = 0;
@@ -106,6 +109,47 @@ std::optional<double> run_decoder(libcsdec_t &libcsdec,
   size_t trace_data_size = 0;
   load_bin(trace_data_filepath, &trace_data_addr, &trace_data_size);
 
+  if (async != nullptr) {
+    // Submit the session to the background decoder and wait for the result.
+    std::chrono::system_clock::time_point start =
+        std::chrono::system_clock::now();
+
+    const size_t offset =
+        std::min(split_offset.value_or(trace_data_size), trace_data_size);
+    const struct iovec segments[2] = {
+        {trace_data_addr, offset},
+        {(char *)trace_data_addr + offset, trace_data_size - offset},
+    };
+    libcsdec_ticket_t ticket = 0;
+    if (libcsdec_submit_async(async, trace_id, memory_map_num, memory_map,
+                              segments, 2, &ticket) != LIBCSDEC_SUCCESS) {
+      std::cerr << "Failed to submit decoder." << std::endl;
+      return std::nullopt;
+    }
+    void *bitmap_addr = nullptr;
+    if (libcsdec_wait_async(async, ticket, &bitmap_addr) != LIBCSDEC_SUCCESS) {
+      std::cerr << "Failed to run decoder." << std::endl;
+      return std::nullopt;
+    }
+
+    std::chrono::system_clock::time_point end =
+        std::chrono::system_clock::now();
+    double elapsed =
+        std::chrono::duration_cast<std::chrono::microseconds>(end - start)
+            .count();
+
+    int diff_cnt = check_bitmaps((unsigned char *)global_bitmap,
+                                 (unsigned char *)bitmap_addr, bitmap_size);
+
+    if (has_new_cov) {
+      assert(diff_cnt > 0);
+    } else {
+      assert(diff_cnt == 0);
+    }
+
+    return elapsed;
+  }
+
   if (cov == Cov::Edge) {
     libcsdec_reset_edge(libcsdec, trace_id, memory_map_num, memory_map);
   } else if (cov == Cov::Path) {
@@ -118,7 +162,25 @@ std::optional<double> run_decoder(libcsdec_t &libcsdec,
   std::chrono::system_clock::time_point start =
       std::chrono::system_clock::now();
 
-  if (cov == Cov::Edge) {
+  if (split_offset.has_value()) {
+    // Pass the trace data as the two halves of a wrapped ring buffer.
+    const size_t offset = std::min(split_offset.value(), trace_data_size);
+    const struct iovec segments[2] = {
+        {trace_data_addr, offset},
+        {(char *)trace_data_addr + offset, trace_data_size - offset},
+    };
+    if (cov == Cov::Edge) {
+      if (libcsdec_runv_edge(libcsdec, segments, 2) != LIBCSDEC_SUCCESS) {
+        std::cerr << "Failed to run decoder." << std::endl;
+      }
+    } else if (cov == Cov::Path) {
+      if (libcsdec_runv_path(libcsdec, segments, 2) != LIBCSDEC_SUCCESS) {
+        std::cerr << "Failed to run decoder." << std::endl;
+      }
+    } else {
+      __builtin_unreachable();
+    }
+  } else if (cov == Cov::Edge) {
     if (libcsdec_run_edge(libcsdec, trace_data_addr, trace_data_size) !=
         LIBCSDEC_SUCCESS) {
       std::cerr << "Failed to run decoder." << std::endl;
@@ -211,6 +273,31 @@ void usage(const char *argv0) {
             << "\t                         for each trace data. The default "
                "value is 1."
             << std::endl
+            << "\t--cache-mode=mode      : Specify what is cached during "
+               "decoding (none, branch "
+            << std::endl
+            << "\t                         or trace). The default mode is "
+               "trace."
+            << std::endl
+            << "\t--split=offset         : Pass the trace data as two "
+               "segments split at the offset, "
+            << std::endl
+            << "\t                         as a wrapped ring buffer."
+            << std::endl
+            << "\t--async                : Submit the trace data to the "
+               "background decoder and wait "
+            << std::endl
+            << "\t                         for the result."
+            << std::endl
+            << "\t--trace-memo-size=size : Specify the memory limit of the "
+               "trace memo in bytes. "
+            << std::endl
+            << "\t                         The default value is 0, which "
+               "disables it."
+            << std::endl
+            << "\t--context-id=id        : Decode only the trace of the "
+               "context ID in hexadecimal."
+            << std::endl
             << std::endl;
 }
 
@@ -242,13 +329,40 @@ int main(int argc, char const *argv[]) {
 
   std::optional<std::string> output_filename;
   int loop_cnt = 1;
+  std::optional<size_t> split_offset;
+  bool async_mode = false;
+  uint64_t context_id = LIBCSDEC_CONTEXT_ID_ANY;
+  struct libcsdec_options options;
+  libcsdec_default_options(&options);
   for (int i = 3 + trace_data_num + memory_image_num; i < argc; ++i) {
     int cnt = 0;
+    size_t offset = 0;
+    size_t size = 0;
+    uint32_t id = 0;
     char buf[PATH_MAX];
     if (sscanf(argv[i], "--output-filename=%s", buf) == 1) {
       output_filename = std::string(buf);
     } else if (sscanf(argv[i], "--loop-cnt=%d", &cnt) == 1) {
       loop_cnt = cnt;
+    } else if (sscanf(argv[i], "--split=%zu", &offset) == 1) {
+      split_offset = offset;
+    } else if (sscanf(argv[i], "--trace-memo-size=%zu", &size) == 1) {
+      options.trace_memo_size = size;
+    } else if (std::strcmp(argv[i], "--async") == 0) {
+      async_mode = true;
+    } else if (sscanf(argv[i], "--context-id=%x", &id) == 1) {
+      context_id = id;
+    } else if (sscanf(argv[i], "--cache-mode=%s", buf) == 1) {
+      if (std::strcmp(buf, "none") == 0) {
+        options.cache_mode = LIBCSDEC_CACHE_NONE;
+      } else if (std::strcmp(buf, "branch") == 0) {
+        options.cache_mode = LIBCSDEC_CACHE_BRANCH;
+      } else if (std::strcmp(buf, "trace") == 0) {
+        options.cache_mode = LIBCSDEC_CACHE_TRACE;
+      } else {
+        std::cerr << "Invalid cache mode: " << buf << std::endl;
+        std::exit(1);
+      }
     } else {
       std::cerr << "Invalid option: " << argv[i] << std::endl;
       std::exit(1);
@@ -258,11 +372,13 @@ int main(int argc, char const *argv[]) {
   libcsdec_t libcsdec = nullptr;
   {
     if (cov == Cov::Edge) {
-      libcsdec = libcsdec_init_edge(local_bitmap, bitmap_size, memory_image_num,
-                                    libcsdec_memory_image);
+      libcsdec = libcsdec_init_edge_opts(local_bitmap, bitmap_size,
+                                         memory_image_num,
+                                         libcsdec_memory_image, &options);
     } else if (cov == Cov::Path) {
-      libcsdec = libcsdec_init_path(local_bitmap, bitmap_size, memory_image_num,
-                                    libcsdec_memory_image);
+      libcsdec = libcsdec_init_path_opts(local_bitmap, bitmap_size,
+                                         memory_image_num,
+                                         libcsdec_memory_image, &options);
     } else {
       __builtin_unreachable();
     }
@@ -273,6 +389,30 @@ int main(int argc, char const *argv[]) {
     std::exit(EXIT_FAILURE);
   }
 
+  if (cov == Cov::Edge) {
+    libcsdec_filter_context_edge(libcsdec, context_id);
+  } else if (cov == Cov::Path) {
+    libcsdec_filter_context_path(libcsdec, context_id);
+  } else {
+    __builtin_unreachable();
+  }
+
+  libcsdec_async_t async = nullptr;
+  if (async_mode) {
+    if (cov == Cov::Edge) {
+      async = libcsdec_init_async_edge(libcsdec);
+    } else if (cov == Cov::Path) {
+      async = libcsdec_init_async_path(libcsdec);
+    } else {
+      __builtin_unreachable();
+    }
+
+    if (async == nullptr) {
+      std::cerr << "Failed to start the background decoder." << std::endl;
+      std::exit(EXIT_FAILURE);
+    }
+  }
+
   unsigned char *global_bitmap = (unsigned char *)malloc(bitmap_size);
   memset(global_bitmap, 0, bitmap_size);
 
@@ -283,8 +423,9 @@ int main(int argc, char const *argv[]) {
           trace_data_dir[i] + "/decoderargs.txt";
 
       std::optional<double> execution_time =
-          run_decoder(libcsdec, decoder_args_path, global_bitmap, local_bitmap,
-                      bitmap_size, (i == 0 and time == 0));
+          run_decoder(libcsdec, async, decoder_args_path, global_bitmap,
+                      local_bitmap, bitmap_size, (i == 0 and time == 0),
+                      split_offset);
       if (execution_time.has_value()) {
         execution_times.emplace_back(execution_time.value());
       }